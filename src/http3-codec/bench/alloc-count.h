@@ -0,0 +1,6 @@
+// alloc-count.h - Heap allocations counted by alloc-count.cpp's global operator new
+#pragma once
+#include <cstddef>
+
+// Allocations made through any form of operator new since the program started
+size_t allocationCount();
@@ -0,0 +1,312 @@
+// codec-bench.cpp - QPACK, frame decoding and WebTransport validation without MsQuic
+#include "alloc-count.h"
+#include "http3-codec/frame.h"
+#include "http3-codec/log.h"
+#include "http3-codec/qpack.h"
+#include "http3-codec/sendpool.h"
+#include "http3-codec/webtransport.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static volatile uint64_t sink;
+
+// The codec logs through Http3Log, which is not started here, so each log call is one
+// relaxed load and the numbers measure the codec alone; "log record" prices the rest
+template <typename Fn>
+static void run(const char* name, const char* unit, size_t count, Fn&& fn) {
+    constexpr int ROUNDS = 50;
+    fn(); // warm up
+
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < ROUNDS; ++round) {
+        fn();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count() / (static_cast<double>(count) * ROUNDS);
+    std::cout << "  " << std::left << std::setw(28) << name << std::fixed << std::setprecision(2) << ns << " ns/" << unit << "\n";
+}
+
+// The request the client sends to open a WebTransport session
+static std::vector<uint8_t> encodeConnectRequest(QpackEncoder& encoder) {
+    encoder.clear();
+    encoder.encodeHeader(":method", "CONNECT");
+    encoder.encodeHeader(":protocol", "webtransport");
+    encoder.encodeHeader(":scheme", "https");
+    encoder.encodeHeader(":authority", "localhost:4443");
+    encoder.encodeHeader(":path", "/webtransport/echo");
+    return encoder.getEncoded();
+}
+
+int main() {
+    constexpr size_t BLOCKS = 4096;
+    constexpr size_t PACKET_SIZE = 1200;
+
+    QpackEncoder encoder;
+    auto block = encodeConnectRequest(encoder);
+
+    // Round trip once before timing anything
+    QpackDecoder decoder;
+    std::vector<QpackDecoder::Header> headers;
+    WebTransportValidator validator;
+    bool decoded = decoder.decodeHeaders(block, headers);
+    if (!decoded || !validator.validate(headers).isValid) {
+        std::cerr << "CONNECT request did not round trip\n";
+        return 1;
+    }
+
+    // A request stream's worth of HEADERS + DATA frames, cut into packet-sized buffers
+    std::vector<uint8_t> body(256, 0x5A);
+    std::vector<uint8_t> stream(BLOCKS * (block.size() + body.size() + 2 * Http3Varint::MAX_LENGTH));
+    {
+        Http3FrameWriter writer(stream);
+        for (size_t i = 0; i < BLOCKS; ++i) {
+            Http3FrameBuilder::writeHeadersFrame(writer, block);
+            writer.appendFrame(Http3FrameType::DATA, body);
+        }
+        stream.resize(writer.size());
+    }
+    std::vector<Http3Buffer> chain;
+    for (size_t offset = 0; offset < stream.size(); offset += PACKET_SIZE) {
+        size_t length = std::min(PACKET_SIZE, stream.size() - offset);
+        chain.push_back({ static_cast<uint32_t>(length), stream.data() + offset });
+    }
+
+    size_t frames = 0;
+    {
+        Http3FrameDecoder<> frameDecoder;
+        Http3BufferCursor<> cursor(chain);
+        for (const auto& event : frameDecoder.events(cursor)) {
+            if (event.type == Http3FrameDecoder<>::EventType::Frame || event.frameComplete) ++frames;
+        }
+        if (frames != BLOCKS * 2 || !cursor.empty()) {
+            std::cerr << "Frame decoder produced " << frames << " frames, expected " << BLOCKS * 2 << "\n";
+            return 1;
+        }
+    }
+
+    std::cout << "HTTP/3 codec, CONNECT header block of " << block.size() << " bytes, "
+        << frames << " frames in " << chain.size() << " buffers\n";
+
+    run("QPACK encode", "block", BLOCKS, [&] {
+        uint64_t total = 0;
+        for (size_t i = 0; i < BLOCKS; ++i) {
+            total += encodeConnectRequest(encoder).size();
+        }
+        sink = total;
+    });
+
+    run("QPACK decode", "block", BLOCKS, [&] {
+        uint64_t total = 0;
+        for (size_t i = 0; i < BLOCKS; ++i) {
+            decoder.decodeHeaders(block, headers);
+            total += headers.size();
+        }
+        sink = total;
+    });
+
+    // Same request with a dynamic table: after the first request every field but the static
+    // matches is an indexed dynamic reference, acknowledged by the decoder after each section
+    QpackEncoder dynamicEncoder;
+    QpackDecoder dynamicDecoder;
+    dynamicEncoder.setPeerMaxTableCapacity(QpackEncoder::DEFAULT_TABLE_CAPACITY);
+    dynamicDecoder.setMaxTableCapacity(QpackEncoder::DEFAULT_TABLE_CAPACITY);
+    uint64_t streamId = 0;
+    size_t dynamicBlockSize = 0;
+    auto dynamicRoundTrip = [&] {
+        dynamicEncoder.beginSection(streamId);
+        dynamicEncoder.encodeHeader(":method", "CONNECT");
+        dynamicEncoder.encodeHeader(":protocol", "webtransport");
+        dynamicEncoder.encodeHeader(":scheme", "https");
+        dynamicEncoder.encodeHeader(":authority", "localhost:4443");
+        dynamicEncoder.encodeHeader(":path", "/webtransport/echo");
+        bool ok = dynamicDecoder.processEncoderStream(dynamicEncoder.pendingEncoderStreamData()) &&
+            dynamicDecoder.decodeHeaders(streamId, dynamicEncoder.encoded(), headers) == QpackDecoder::Status::Ok &&
+            dynamicEncoder.processDecoderStream(dynamicDecoder.pendingDecoderStreamData());
+        dynamicEncoder.clearEncoderStreamData();
+        dynamicDecoder.clearDecoderStreamData();
+        streamId += 4;
+        dynamicBlockSize = dynamicEncoder.encoded().size();
+        return ok;
+    };
+    bool dynamicOk = dynamicRoundTrip() && dynamicRoundTrip();
+    if (!dynamicOk || headers.size() != 5) {
+        std::cerr << "CONNECT request did not round trip through the dynamic table\n";
+        return 1;
+    }
+    std::cout << "  dynamic table block: " << dynamicBlockSize << " bytes\n";
+
+    run("QPACK dynamic round trip", "block", BLOCKS, [&] {
+        uint64_t ok = 0;
+        for (size_t i = 0; i < BLOCKS; ++i) {
+            ok += dynamicRoundTrip();
+        }
+        sink = ok;
+    });
+
+    QpackArena arena;
+    std::vector<QpackDecoder::HeaderView> views;
+    run("QPACK decode (views)", "block", BLOCKS, [&] {
+        uint64_t total = 0;
+        for (size_t i = 0; i < BLOCKS; ++i) {
+            arena.reset();
+            decoder.decodeHeaders(block, arena, views);
+            total += views.size();
+        }
+        sink = total;
+    });
+
+    // Allocations per block once the reused vectors have grown
+    size_t before = allocationCount();
+    decoder.decodeHeaders(block, headers);
+    size_t owning = allocationCount() - before;
+    before = allocationCount();
+    arena.reset();
+    decoder.decodeHeaders(block, arena, views);
+    size_t viewing = allocationCount() - before;
+    std::cout << "  heap allocations per block: " << owning << " owning, " << viewing << " views\n";
+
+    run("WebTransport validate", "request", BLOCKS, [&] {
+        uint64_t valid = 0;
+        for (size_t i = 0; i < BLOCKS; ++i) {
+            valid += validator.validate(headers).isValid;
+        }
+        sink = valid;
+    });
+
+    // Session setup as the server did it before, decoding then validating, against picking
+    // the pseudo-headers up while decoding
+    run("decode, then validate", "request", BLOCKS, [&] {
+        uint64_t valid = 0;
+        for (size_t i = 0; i < BLOCKS; ++i) {
+            arena.reset();
+            decoder.decodeHeaders(block, arena, views);
+            valid += validator.validate(views).isValid;
+        }
+        sink = valid;
+    });
+
+    run("decode with request parser", "request", BLOCKS, [&] {
+        uint64_t valid = 0;
+        for (size_t i = 0; i < BLOCKS; ++i) {
+            arena.reset();
+            WebTransportRequest request;
+            WebTransportRequestParser parser(request);
+            decoder.decodeHeaders(0, block, arena, parser);
+            valid += parser.finish().isValid;
+        }
+        sink = valid;
+    });
+
+    constexpr Http3Setting settings[] = {
+        { Http3SettingId::ENABLE_WEBTRANSPORT, 1 },
+        { Http3SettingId::MAX_FIELD_SECTION_SIZE, 16384 },
+        { Http3SettingId::QPACK_MAX_TABLE_CAPACITY, 0 },
+    };
+    std::vector<uint8_t> sendBuffer(64 * 1024);
+
+    run("SETTINGS frame write", "frame", BLOCKS, [&] {
+        Http3FrameWriter writer(sendBuffer);
+        for (size_t i = 0; i < BLOCKS; ++i) {
+            Http3FrameBuilder::writeSettingsFrame(writer, settings);
+        }
+        sink = writer.size();
+    });
+
+    run("HEADERS frame write", "frame", BLOCKS, [&] {
+        Http3FrameWriter writer(sendBuffer);
+        for (size_t i = 0; i < BLOCKS; ++i) {
+            Http3FrameBuilder::writeHeadersFrame(writer, block);
+        }
+        sink = writer.size();
+    });
+
+    // A HEADERS frame written into a pooled send buffer and handed back as SEND_COMPLETE would
+    using SendPool = Http3SendBufferPool<>;
+    auto pooledSend = [&] {
+        auto* buffer = SendPool::acquire();
+        Http3FrameWriter writer = buffer->writer(block.size() + 2 * Http3Varint::MAX_LENGTH);
+        Http3FrameBuilder::writeHeadersFrame(writer, block);
+        buffer->commit(writer);
+        uint64_t length = buffer->buffers()->Length;
+        SendPool::release(buffer);
+        return length;
+    };
+    run("pooled HEADERS send", "frame", BLOCKS, [&] {
+        uint64_t bytes = 0;
+        for (size_t i = 0; i < BLOCKS; ++i) {
+            bytes += pooledSend();
+        }
+        sink = bytes;
+    });
+    before = allocationCount();
+    sink = pooledSend();
+    std::cout << "  heap allocations per pooled send: " << allocationCount() - before << "\n";
+
+    // A large DATA frame: copied behind its header, or gathered as header segment + payload reference
+    constexpr size_t LARGE_BODY = 64 * 1024;
+    constexpr size_t LARGE_FRAMES = 1000;
+    std::vector<uint8_t> largeBody(LARGE_BODY, 0x5a);
+    run("64 KiB DATA send, copied", "frame", LARGE_FRAMES, [&] {
+        uint64_t bytes = 0;
+        for (size_t i = 0; i < LARGE_FRAMES; ++i) {
+            auto* buffer = SendPool::acquire();
+            Http3FrameWriter writer = buffer->writer(LARGE_BODY + 2 * Http3Varint::MAX_LENGTH);
+            writer.appendFrame(Http3FrameType::DATA, largeBody);
+            buffer->commit(writer);
+            bytes += buffer->totalLength();
+            SendPool::release(buffer);
+        }
+        sink = bytes;
+    });
+    run("64 KiB DATA send, gathered", "frame", LARGE_FRAMES, [&] {
+        uint64_t bytes = 0;
+        for (size_t i = 0; i < LARGE_FRAMES; ++i) {
+            auto* buffer = SendPool::acquire();
+            buffer->appendFrame(Http3FrameType::DATA, largeBody);
+            bytes += buffer->totalLength();
+            SendPool::release(buffer);
+        }
+        sink = bytes;
+    });
+
+    // What a log call costs a worker with the logger running: capture into the thread's ring.
+    // The ring is drained between rounds, so no record is dropped.
+    {
+        constexpr size_t RECORDS = Http3Log::RING_RECORDS / 2;
+        constexpr int ROUNDS = 50;
+        std::ostream discard(nullptr);
+        Http3Log::start(discard);
+        std::chrono::steady_clock::duration elapsed{};
+        for (int round = 0; round <= ROUNDS; ++round) {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < RECORDS; ++i) {
+                Http3Log::write("Raw buffer {} ({} bytes): {}", i, block.size(), Http3LogBytes{ block });
+            }
+            if (round > 0) {
+                elapsed += std::chrono::steady_clock::now() - start; // Round 0 registers the ring
+            }
+            Http3Log::flush();
+        }
+        Http3Log::stop();
+        double ns = std::chrono::duration<double, std::nano>(elapsed).count() / (static_cast<double>(RECORDS) * ROUNDS);
+        std::cout << "  " << std::left << std::setw(28) << "log record" << std::fixed << std::setprecision(2) << ns << " ns/record\n";
+    }
+
+    run("frame decode", "frame", frames, [&] {
+        Http3FrameDecoder<> frameDecoder;
+        Http3BufferCursor<> cursor(chain);
+        uint64_t bytes = 0;
+        for (const auto& event : frameDecoder.events(cursor)) {
+            bytes += event.payload.size();
+        }
+        sink = bytes;
+    });
+
+    return 0;
+}
@@ -0,0 +1,193 @@
+// varint-bench.cpp - Http3Varint against the original per-byte varint code
+#include "http3-codec/varint.h"
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <utility>
+#include <vector>
+
+// The decoder/encoder the client and server used before Http3Varint, kept as the baseline
+namespace legacy {
+
+static std::pair<uint64_t, size_t> decodeVarint(const std::vector<uint8_t>& data, size_t offset) {
+    if (offset >= data.size()) {
+        return { 0, 0 };
+    }
+
+    uint8_t firstByte = data[offset];
+    uint8_t prefix = (firstByte & 0xC0) >> 6;
+
+    switch (prefix) {
+    case 0:
+        return { firstByte & 0x3F, 1 };
+
+    case 1:
+        if (offset + 1 >= data.size()) return { 0, 0 };
+        return {
+            ((static_cast<uint64_t>(firstByte & 0x3F) << 8) | data[offset + 1]),
+            2
+        };
+
+    case 2:
+        if (offset + 3 >= data.size()) return { 0, 0 };
+        return {
+            ((static_cast<uint64_t>(firstByte & 0x3F) << 24) |
+             (static_cast<uint64_t>(data[offset + 1]) << 16) |
+             (static_cast<uint64_t>(data[offset + 2]) << 8) |
+             static_cast<uint64_t>(data[offset + 3])),
+            4
+        };
+
+    case 3:
+        if (offset + 7 >= data.size()) return { 0, 0 };
+        uint64_t value = static_cast<uint64_t>(firstByte & 0x3F);
+        for (int i = 1; i < 8; ++i) {
+            value = (value << 8) | static_cast<uint64_t>(data[offset + i]);
+        }
+        return { value, 8 };
+    }
+
+    return { 0, 0 };
+}
+
+static void encodeVarint(std::vector<uint8_t>& buffer, uint64_t value) {
+    if (value < 64) {
+        buffer.push_back(static_cast<uint8_t>(value));
+    }
+    else if (value < 16384) {
+        buffer.push_back(static_cast<uint8_t>(0x40 | (value >> 8)));
+        buffer.push_back(static_cast<uint8_t>(value & 0xFF));
+    }
+    else if (value < 1073741824) {
+        buffer.push_back(static_cast<uint8_t>(0x80 | (value >> 24)));
+        buffer.push_back(static_cast<uint8_t>((value >> 16) & 0xFF));
+        buffer.push_back(static_cast<uint8_t>((value >> 8) & 0xFF));
+        buffer.push_back(static_cast<uint8_t>(value & 0xFF));
+    }
+    else {
+        buffer.push_back(static_cast<uint8_t>(0xC0 | (value >> 56)));
+        for (int i = 6; i >= 0; --i) {
+            buffer.push_back(static_cast<uint8_t>((value >> (i * 8)) & 0xFF));
+        }
+    }
+}
+
+} // namespace legacy
+
+// Keeps results observable so the optimizer cannot drop the measured loops
+static volatile uint64_t sink;
+
+template <typename Fn>
+static void run(const char* name, size_t count, Fn&& fn) {
+    constexpr int ROUNDS = 50;
+    fn(); // warm up
+
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < ROUNDS; ++round) {
+        fn();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count() / (static_cast<double>(count) * ROUNDS);
+    std::cout << "  " << std::left << std::setw(28) << name << std::fixed << std::setprecision(2) << ns << " ns/varint\n";
+}
+
+// Mostly 1- and 2-byte values as in frame headers and SETTINGS, with some larger ones
+static std::vector<uint64_t> makeValues(size_t count, std::mt19937_64& rng) {
+    std::vector<uint64_t> values(count);
+    std::discrete_distribution<int> lengthClass({ 60, 25, 10, 5 });
+    const uint64_t limits[] = { 63, 16383, 1073741823, Http3Varint::MAX_VALUE };
+    for (auto& value : values) {
+        value = std::uniform_int_distribution<uint64_t>(0, limits[lengthClass(rng)])(rng);
+    }
+    return values;
+}
+
+int main() {
+    constexpr size_t COUNT = 1 << 16;
+    std::mt19937_64 rng(9114);
+    auto values = makeValues(COUNT, rng);
+
+    std::vector<uint8_t> encoded;
+    for (uint64_t value : values) {
+        legacy::encodeVarint(encoded, value);
+    }
+
+    // Both decoders must agree before timing anything
+    std::vector<uint64_t> decoded(COUNT);
+    size_t decodedCount = 0;
+    size_t used = Http3Varint::decodeBatch(encoded, decoded, decodedCount);
+    size_t offset = 0;
+    for (size_t i = 0; i < COUNT; ++i) {
+        uint64_t single = 0;
+        size_t length = Http3Varint::decode(std::span<const uint8_t>(encoded).subspan(offset), single);
+        auto [expected, legacyLength] = legacy::decodeVarint(encoded, offset);
+        if (length != legacyLength || single != expected || decoded[i] != expected) {
+            std::cerr << "Mismatch at varint " << i << "\n";
+            return 1;
+        }
+        offset += length;
+    }
+    std::vector<uint8_t> reencoded;
+    for (uint64_t value : values) {
+        Http3Varint::encode(value, reencoded);
+    }
+    if (used != encoded.size() || decodedCount != COUNT || reencoded != encoded) {
+        std::cerr << "Batch decode or encode mismatch\n";
+        return 1;
+    }
+
+    std::cout << "Varint codec, " << COUNT << " values (" << encoded.size() << " bytes)\n";
+
+    run("decode (legacy)", COUNT, [&] {
+        uint64_t sum = 0;
+        for (size_t pos = 0; pos < encoded.size();) {
+            auto [value, length] = legacy::decodeVarint(encoded, pos);
+            sum += value;
+            pos += length;
+        }
+        sink = sum;
+    });
+
+    run("decode (Http3Varint)", COUNT, [&] {
+        uint64_t sum = 0;
+        std::span<const uint8_t> data(encoded);
+        for (size_t pos = 0; pos < data.size();) {
+            uint64_t value = 0;
+            pos += Http3Varint::decode(data.subspan(pos), value);
+            sum += value;
+        }
+        sink = sum;
+    });
+
+    run("decodeBatch (Http3Varint)", COUNT, [&] {
+        size_t count = 0;
+        Http3Varint::decodeBatch(encoded, decoded, count);
+        sink = decoded[count - 1];
+    });
+
+    std::vector<uint8_t> output;
+    output.reserve(encoded.size());
+
+    run("encode (legacy)", COUNT, [&] {
+        output.clear();
+        for (uint64_t value : values) {
+            legacy::encodeVarint(output, value);
+        }
+        sink = output.size();
+    });
+
+    std::vector<uint8_t> raw(COUNT * Http3Varint::MAX_LENGTH);
+    run("encode (Http3Varint)", COUNT, [&] {
+        std::span<uint8_t> out(raw);
+        size_t pos = 0;
+        for (uint64_t value : values) {
+            pos += Http3Varint::encode(value, out.subspan(pos));
+        }
+        sink = pos;
+    });
+
+    return 0;
+}
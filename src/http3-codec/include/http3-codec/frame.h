@@ -0,0 +1,903 @@
+// frame.h - HTTP/3 frame parsing, stream decoding and frame building (RFC 9114 section 7)
+// Shared by the client, the server and the codec benchmarks; no MsQuic dependency.
+// The buffer chain types are templates over anything shaped like QUIC_BUFFER (a
+// uint32_t Length and a uint8_t* Buffer), so MsQuic RECEIVE buffers are read in place.
+#pragma once
+#include "http3-codec/log.h"
+#include "http3-codec/varint.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// HTTP/3 frame types used by the client and server
+struct Http3FrameType {
+    static constexpr uint64_t DATA = 0x00;
+    static constexpr uint64_t HEADERS = 0x01;
+    static constexpr uint64_t CANCEL_PUSH = 0x03;
+    static constexpr uint64_t SETTINGS = 0x04;
+    static constexpr uint64_t PUSH_PROMISE = 0x05;
+    static constexpr uint64_t GOAWAY = 0x07;
+    static constexpr uint64_t MAX_PUSH_ID = 0x0D;
+    static constexpr uint64_t WEBTRANSPORT_STREAM = 0x41;
+
+    static std::string name(uint64_t type) {
+        switch (type) {
+        case DATA: return "DATA";
+        case HEADERS: return "HEADERS";
+        case CANCEL_PUSH: return "CANCEL_PUSH";
+        case SETTINGS: return "SETTINGS";
+        case PUSH_PROMISE: return "PUSH_PROMISE";
+        case GOAWAY: return "GOAWAY";
+        case MAX_PUSH_ID: return "MAX_PUSH_ID";
+        case WEBTRANSPORT_STREAM: return "WEBTRANSPORT_STREAM";
+        default: return "UNKNOWN(" + std::to_string(type) + ")";
+        }
+    }
+};
+
+// Unidirectional stream types (RFC 9114 section 6.2, RFC 9204 section 4.2)
+struct Http3StreamType {
+    static constexpr uint64_t CONTROL = 0x00;
+    static constexpr uint64_t PUSH = 0x01;
+    static constexpr uint64_t QPACK_ENCODER = 0x02;
+    static constexpr uint64_t QPACK_DECODER = 0x03;
+};
+
+// SETTINGS identifiers (RFC 9114 section 7.2.4.1, RFC 9204 section 5, RFC 9220, RFC 9297,
+// WebTransport draft-02 and later drafts)
+struct Http3SettingId {
+    static constexpr uint64_t QPACK_MAX_TABLE_CAPACITY = 0x01;
+    static constexpr uint64_t MAX_FIELD_SECTION_SIZE = 0x06;
+    static constexpr uint64_t QPACK_BLOCKED_STREAMS = 0x07;
+    static constexpr uint64_t ENABLE_CONNECT_PROTOCOL = 0x08;
+    static constexpr uint64_t H3_DATAGRAM = 0x33;
+    static constexpr uint64_t H3_DATAGRAM_DRAFT04 = 0xffd277;
+    static constexpr uint64_t ENABLE_WEBTRANSPORT = 0x2b603742;
+    static constexpr uint64_t WEBTRANSPORT_MAX_SESSIONS = 0xc671706a;
+};
+
+// HTTP/3 and QPACK application error codes (RFC 9114 section 8.1, RFC 9204 section 6)
+struct Http3ErrorCode {
+    static constexpr uint64_t H3_NO_ERROR = 0x100;
+    static constexpr uint64_t H3_INTERNAL_ERROR = 0x102;
+    static constexpr uint64_t H3_STREAM_CREATION_ERROR = 0x103;
+    static constexpr uint64_t H3_FRAME_UNEXPECTED = 0x105;
+    static constexpr uint64_t H3_FRAME_ERROR = 0x106;
+    static constexpr uint64_t H3_EXCESSIVE_LOAD = 0x107;
+    static constexpr uint64_t H3_SETTINGS_ERROR = 0x109;
+    static constexpr uint64_t H3_MISSING_SETTINGS = 0x10a;
+    static constexpr uint64_t H3_REQUEST_REJECTED = 0x10b;
+    static constexpr uint64_t H3_REQUEST_CANCELLED = 0x10c;
+    static constexpr uint64_t QPACK_DECOMPRESSION_FAILED = 0x200;
+    static constexpr uint64_t QPACK_ENCODER_STREAM_ERROR = 0x201;
+    static constexpr uint64_t QPACK_DECODER_STREAM_ERROR = 0x202;
+};
+
+struct Http3Setting {
+    uint64_t id = 0;
+    uint64_t value = 0;
+};
+
+// What the peer's SETTINGS frame allows. Until it arrives the RFC 9114 defaults apply:
+// no dynamic table, no blocked streams, no extensions, unlimited field sections.
+struct Http3NegotiatedSettings {
+    static constexpr uint64_t UNLIMITED = std::numeric_limits<uint64_t>::max();
+
+    bool received = false;
+    uint64_t qpackMaxTableCapacity = 0;
+    uint64_t qpackBlockedStreams = 0;
+    uint64_t maxFieldSectionSize = UNLIMITED;
+    bool enableConnectProtocol = false;
+    bool h3Datagram = false;
+    bool enableWebTransport = false;      // draft-02 SETTINGS_ENABLE_WEBTRANSPORT
+    uint64_t webTransportMaxSessions = 0; // Later drafts: sessions the peer accepts
+
+    bool webTransportEnabled() const { return enableWebTransport || webTransportMaxSessions > 0; }
+
+    // Applies a SETTINGS payload. Returns 0, or the error code to close the connection with:
+    // H3_FRAME_ERROR for a truncated payload, H3_SETTINGS_ERROR for a repeated identifier,
+    // an HTTP/2-only one or a boolean out of range. Unknown identifiers are ignored.
+    uint64_t apply(std::span<const uint8_t> payload) {
+        uint64_t seen = 0;  // Bit per known identifier, to catch repeats
+        size_t position = 0;
+        while (position < payload.size()) {
+            uint64_t id = 0;
+            uint64_t value = 0;
+            size_t idLength = Http3Varint::decode(payload.subspan(position), id);
+            size_t valueLength = idLength ? Http3Varint::decode(payload.subspan(position + idLength), value) : 0;
+            if (valueLength == 0) return Http3ErrorCode::H3_FRAME_ERROR;
+            position += idLength + valueLength;
+
+            int bit = knownSetting(id);
+            if (bit < 0) continue;
+            if (bit == 0 || (seen & (1ULL << bit)) != 0) return Http3ErrorCode::H3_SETTINGS_ERROR;
+            seen |= 1ULL << bit;
+
+            switch (id) {
+            case Http3SettingId::QPACK_MAX_TABLE_CAPACITY: qpackMaxTableCapacity = value; break;
+            case Http3SettingId::QPACK_BLOCKED_STREAMS: qpackBlockedStreams = value; break;
+            case Http3SettingId::MAX_FIELD_SECTION_SIZE: maxFieldSectionSize = value; break;
+            case Http3SettingId::WEBTRANSPORT_MAX_SESSIONS: webTransportMaxSessions = value; break;
+            default:
+                // The rest are booleans
+                if (value > 1) return Http3ErrorCode::H3_SETTINGS_ERROR;
+                if (id == Http3SettingId::ENABLE_CONNECT_PROTOCOL) enableConnectProtocol = value == 1;
+                else if (id == Http3SettingId::ENABLE_WEBTRANSPORT) enableWebTransport = value == 1;
+                else h3Datagram = h3Datagram || value == 1;  // Either codepoint
+                break;
+            }
+        }
+        received = true;
+        return 0;
+    }
+
+private:
+    // Bit for each identifier we act on; 0 for the HTTP/2 ones that must not appear
+    // (RFC 9114 section 7.2.4.1), -1 for everything else
+    static int knownSetting(uint64_t id) {
+        switch (id) {
+        case 0x02: case 0x03: case 0x04: case 0x05: return 0;
+        case Http3SettingId::QPACK_MAX_TABLE_CAPACITY: return 1;
+        case Http3SettingId::MAX_FIELD_SECTION_SIZE: return 2;
+        case Http3SettingId::QPACK_BLOCKED_STREAMS: return 3;
+        case Http3SettingId::ENABLE_CONNECT_PROTOCOL: return 4;
+        case Http3SettingId::H3_DATAGRAM: return 5;
+        case Http3SettingId::H3_DATAGRAM_DRAFT04: return 6;
+        case Http3SettingId::ENABLE_WEBTRANSPORT: return 7;
+        case Http3SettingId::WEBTRANSPORT_MAX_SESSIONS: return 8;
+        default: return -1;
+        }
+    }
+};
+
+// Layout-compatible stand-in for QUIC_BUFFER, for callers without MsQuic
+struct Http3Buffer {
+    uint32_t Length = 0;
+    uint8_t* Buffer = nullptr;
+};
+
+// Read-only cursor over a buffer chain such as the QUIC_BUFFERs of a RECEIVE event.
+// Nothing is copied; the cursor only tracks (buffer index, offset) so that values
+// and payloads may straddle buffer boundaries.
+template <typename BufferT = Http3Buffer>
+class Http3BufferCursor {
+public:
+    Http3BufferCursor() = default;
+
+    explicit Http3BufferCursor(std::span<const BufferT> buffers)
+        : buffers(buffers) {
+        skipEmptyBuffers();
+    }
+
+    bool empty() const { return index >= buffers.size(); }
+    uint64_t consumed() const { return consumedBytes; }
+
+    uint64_t remaining() const {
+        uint64_t total = 0;
+        for (size_t i = index; i < buffers.size(); ++i) {
+            total += buffers[i].Length;
+        }
+        return total - offset;
+    }
+
+    // Bytes available contiguously in the current buffer
+    std::span<const uint8_t> contiguous() const {
+        if (empty()) return {};
+        return { buffers[index].Buffer + offset, buffers[index].Length - offset };
+    }
+
+    bool readByte(uint8_t& value) {
+        if (empty()) return false;
+        value = buffers[index].Buffer[offset];
+        advanceInBuffer(1);
+        return true;
+    }
+
+    // Advance without touching the bytes; fails (and does not move) if the chain is too short
+    bool skip(uint64_t count) {
+        if (!empty() && count <= buffers[index].Length - offset) {
+            advanceInBuffer(static_cast<uint32_t>(count));
+            return true;
+        }
+        if (count > remaining()) return false;
+        while (count > 0) {
+            uint32_t step = static_cast<uint32_t>(std::min<uint64_t>(count, buffers[index].Length - offset));
+            advanceInBuffer(step);
+            count -= step;
+        }
+        return true;
+    }
+
+    std::span<const BufferT> chain() const { return buffers; }
+    size_t bufferIndex() const { return index; }
+    uint32_t bufferOffset() const { return offset; }
+
+private:
+    std::span<const BufferT> buffers;
+    size_t index = 0;
+    uint32_t offset = 0;
+    uint64_t consumedBytes = 0;
+
+    void advanceInBuffer(uint32_t count) {
+        offset += count;
+        consumedBytes += count;
+        if (offset == buffers[index].Length) {
+            ++index;
+            offset = 0;
+            skipEmptyBuffers();
+        }
+    }
+
+    void skipEmptyBuffers() {
+        while (index < buffers.size() && buffers[index].Length == 0) {
+            ++index;
+        }
+    }
+};
+
+// Non-owning view of a frame payload inside a buffer chain
+template <typename BufferT = Http3Buffer>
+class Http3PayloadView {
+public:
+    Http3PayloadView() = default;
+
+    Http3PayloadView(const Http3BufferCursor<BufferT>& start, uint64_t length)
+        : buffers(start.chain()), index(start.bufferIndex()), offset(start.bufferOffset()), length(length) {}
+
+    uint64_t size() const { return length; }
+    bool empty() const { return length == 0; }
+
+    // The payload as a single span, if it does not straddle buffers
+    std::optional<std::span<const uint8_t>> contiguous() const {
+        if (length == 0) return std::span<const uint8_t>{};
+        if (index < buffers.size() && buffers[index].Length - offset >= length) {
+            return std::span<const uint8_t>(buffers[index].Buffer + offset, static_cast<size_t>(length));
+        }
+        return std::nullopt;
+    }
+
+    // Visit each contiguous piece of the payload in order
+    template <typename Fn>
+    void forEachSegment(Fn&& fn) const {
+        uint64_t left = length;
+        uint32_t segmentOffset = offset;
+        for (size_t i = index; i < buffers.size() && left > 0; ++i) {
+            uint64_t take = std::min<uint64_t>(left, buffers[i].Length - segmentOffset);
+            fn(std::span<const uint8_t>(buffers[i].Buffer + segmentOffset, static_cast<size_t>(take)));
+            left -= take;
+            segmentOffset = 0;
+        }
+    }
+
+    // Gather the payload into caller-provided storage (only needed when it straddles buffers)
+    void copyTo(uint8_t* destination) const {
+        forEachSegment([&](std::span<const uint8_t> segment) {
+            std::memcpy(destination, segment.data(), segment.size());
+            destination += segment.size();
+        });
+    }
+
+    // Borrow the payload in place, falling back to gathering it into storage when it straddles buffers
+    std::span<const uint8_t> contiguousOr(std::vector<uint8_t>& storage) const {
+        if (auto span = contiguous()) {
+            return *span;
+        }
+        storage.resize(static_cast<size_t>(length));
+        copyTo(storage.data());
+        return storage;
+    }
+
+private:
+    std::span<const BufferT> buffers;
+    size_t index = 0;
+    uint32_t offset = 0;
+    uint64_t length = 0;
+};
+
+template <typename BufferT = Http3Buffer>
+struct Http3FrameView {
+    uint64_t type = 0;
+    uint64_t length = 0;
+    Http3PayloadView<BufferT> payload;
+};
+
+// Zero-copy HTTP/3 frame parser over buffer chains
+class Http3FrameParser {
+public:
+    enum class ParseStatus {
+        Ok,
+        Incomplete      // Not enough bytes for the header or the payload
+    };
+
+    // Decode HTTP/3 variable-length integer, reading across buffer boundaries
+    template <typename BufferT>
+    static bool decodeVarint(Http3BufferCursor<BufferT>& cursor, uint64_t& value) {
+        // Common case: the whole varint sits in the current buffer
+        size_t used = Http3Varint::decode(cursor.contiguous(), value);
+        if (used != 0) {
+            cursor.skip(used);
+            return true;
+        }
+
+        Http3BufferCursor<BufferT> start = cursor;
+        uint8_t firstByte = 0;
+        if (!cursor.readByte(firstByte)) {
+            return false;
+        }
+
+        size_t length = Http3Varint::lengthFromFirstByte(firstByte);
+        value = firstByte & 0x3F;
+        for (size_t i = 1; i < length; ++i) {
+            uint8_t byte = 0;
+            if (!cursor.readByte(byte)) {
+                cursor = start;
+                return false;
+            }
+            value = (value << 8) | byte;
+        }
+        return true;
+    }
+
+    // Parse one frame at the cursor. On Ok the cursor is left after the payload and
+    // frame.payload points into the caller's buffers; otherwise the cursor is untouched.
+    template <typename BufferT>
+    ParseStatus parseFrame(Http3BufferCursor<BufferT>& cursor, Http3FrameView<BufferT>& frame) {
+        Http3BufferCursor<BufferT> start = cursor;
+
+        if (!decodeVarint(cursor, frame.type) || !decodeVarint(cursor, frame.length)) {
+            cursor = start;
+            return ParseStatus::Incomplete;
+        }
+
+        size_t headerSize = static_cast<size_t>(cursor.consumed() - start.consumed());
+        HTTP3_LOG_TRACE("[parseFrame] Frame type: {}, length: {} (header {} bytes, {} bytes available)", frame.type, frame.length, headerSize, cursor.remaining());
+
+        // Validate we have enough data for the payload
+        if (cursor.remaining() < frame.length) {
+            HTTP3_LOG_TRACE("[parseFrame] Incomplete frame payload");
+            cursor = start;
+            return ParseStatus::Incomplete;
+        }
+
+        frame.payload = Http3PayloadView<BufferT>(cursor, frame.length);
+        cursor.skip(frame.length);
+        return ParseStatus::Ok;
+    }
+
+    std::string getFrameTypeName(uint64_t type) {
+        return Http3FrameType::name(type);
+    }
+};
+
+// Resumable HTTP/3 frame decoder, one per stream. Partial varints, partially received
+// payloads and the unread tail of skipped frames are carried across RECEIVE events,
+// so the transport may split frames at any byte. On a control stream the first frame must
+// be SETTINGS whatever its type, so that check comes before unknown frames are skipped;
+// WEBTRANSPORT_STREAM is only taken as the first frame of a bidirectional stream.
+template <typename BufferT = Http3Buffer>
+class Http3FrameDecoder {
+public:
+    using Cursor = Http3BufferCursor<BufferT>;
+
+    enum class EventType {
+        NeedMoreData,       // Cursor exhausted; call again with the next RECEIVE
+        StreamType,         // Unidirectional stream type prefix (value)
+        Frame,              // Complete non-DATA frame (value = frame type)
+        DataChunk,          // Piece of a DATA frame; frameComplete on the last piece
+        WebTransportStream, // WEBTRANSPORT_STREAM signal (value = session ID)
+        RawData,            // Opaque stream bytes after WEBTRANSPORT_STREAM or enterRawMode()
+        Error
+    };
+
+    // payload points either into the caller's buffers or into the decoder's own
+    // reassembly buffer; it is only valid until the next call to next(). DataChunk and
+    // RawData payloads always point into the caller's buffers, so they stay valid for as
+    // long as the caller keeps those.
+    struct Event {
+        EventType type = EventType::NeedMoreData;
+        uint64_t value = 0;
+        std::span<const uint8_t> payload;
+        bool frameComplete = false;
+        const char* error = nullptr;
+        uint64_t errorCode = 0;  // Http3ErrorCode to close the stream or connection with on Error
+    };
+
+    static constexpr uint64_t DEFAULT_MAX_BUFFERED_FRAME = 64 * 1024;
+
+    explicit Http3FrameDecoder(bool expectStreamType = false, uint64_t maxBufferedFrame = DEFAULT_MAX_BUFFERED_FRAME)
+        : state(expectStreamType ? State::StreamType : State::FrameType), maxBufferedFrame(maxBufferedFrame), unidirectional(expectStreamType) {}
+
+    // Deliver the rest of the stream as RawData (e.g. stream types we do not parse)
+    void enterRawMode() { state = State::Raw; }
+
+    bool failed() const { return state == State::Failed; }
+
+    // Type announced by a unidirectional stream, once its StreamType event has been seen
+    uint64_t streamType() const { return uniStreamType; }
+
+    // Range over every event available in the cursor, so one pass drains all frames of a
+    // RECEIVE: for (const auto& event : decoder.events(cursor)) { ... }
+    class EventRange {
+    public:
+        class iterator {
+        public:
+            iterator(Http3FrameDecoder* decoder, Cursor* cursor)
+                : decoder(decoder), cursor(cursor), current(decoder->next(*cursor)) {}
+
+            const Event& operator*() const { return current; }
+            const Event* operator->() const { return &current; }
+
+            iterator& operator++() {
+                // Nothing follows an error; the decoder stays failed
+                current = (current.type == EventType::Error) ? Event{} : decoder->next(*cursor);
+                return *this;
+            }
+
+            bool operator==(std::default_sentinel_t) const { return current.type == EventType::NeedMoreData; }
+
+        private:
+            Http3FrameDecoder* decoder;
+            Cursor* cursor;
+            Event current;
+        };
+
+        EventRange(Http3FrameDecoder& decoder, Cursor& cursor) : decoder(&decoder), cursor(&cursor) {}
+
+        iterator begin() { return iterator(decoder, cursor); }
+        std::default_sentinel_t end() { return {}; }
+
+    private:
+        Http3FrameDecoder* decoder;
+        Cursor* cursor;
+    };
+
+    EventRange events(Cursor& cursor) { return EventRange(*this, cursor); }
+
+    Event next(Cursor& cursor) {
+        Event event;
+        while (true) {
+            switch (state) {
+            case State::StreamType:
+                if (!readVarint(cursor, event.value)) return event;
+                uniStreamType = event.value;
+                awaitingSettings = (uniStreamType == Http3StreamType::CONTROL);
+                state = State::FrameType;
+                event.type = EventType::StreamType;
+                return event;
+
+            case State::FrameType:
+                if (varintHave == 0 && nextCompleteFrame(cursor, event)) {
+                    if (event.type != EventType::NeedMoreData) return event;
+                    break;
+                }
+                if (!readVarint(cursor, frameType)) return event;
+                if (!checkFirstFrame(frameType, event)) return event;
+                frameSeen = true;
+                state = State::FrameLength;
+                break;
+
+            case State::FrameLength: {
+                uint64_t length = 0;
+                if (!readVarint(cursor, length)) return event;
+
+                if (frameType == Http3FrameType::WEBTRANSPORT_STREAM) {
+                    // Not a real frame: the "length" is the session ID and the rest of the stream is data
+                    state = State::Raw;
+                    event.type = EventType::WebTransportStream;
+                    event.value = length;
+                    return event;
+                }
+
+                frameRemaining = length;
+                if (frameType == Http3FrameType::DATA) {
+                    state = State::Data;
+                    if (length == 0) {
+                        state = State::FrameType;
+                        event.type = EventType::DataChunk;
+                        event.frameComplete = true;
+                        return event;
+                    }
+                }
+                else if (isBufferedFrame(frameType)) {
+                    if (length > maxBufferedFrame) {
+                        return fail(event, "Frame exceeds reassembly limit", Http3ErrorCode::H3_EXCESSIVE_LOAD);
+                    }
+                    payloadBuffer.clear();
+                    state = State::Payload;
+                }
+                else {
+                    // Unknown and reserved (GREASE) frame types must be ignored
+                    state = State::Skip;
+                }
+                break;
+            }
+
+            case State::Payload: {
+                auto available = cursor.contiguous();
+                if (payloadBuffer.empty() && available.size() >= frameRemaining) {
+                    // Whole payload sits in the current buffer: hand it out in place
+                    event.payload = available.first(static_cast<size_t>(frameRemaining));
+                    cursor.skip(frameRemaining);
+                }
+                else {
+                    if (available.empty()) return event;
+                    if (payloadBuffer.empty()) {
+                        payloadBuffer.reserve(static_cast<size_t>(frameRemaining));
+                    }
+                    size_t take = static_cast<size_t>(std::min<uint64_t>(available.size(), frameRemaining));
+                    payloadBuffer.insert(payloadBuffer.end(), available.begin(), available.begin() + take);
+                    cursor.skip(take);
+                    frameRemaining -= take;
+                    if (frameRemaining > 0) break;
+                    event.payload = payloadBuffer;
+                }
+                frameRemaining = 0;
+                state = State::FrameType;
+                event.type = EventType::Frame;
+                event.value = frameType;
+                return event;
+            }
+
+            case State::Data: {
+                auto available = cursor.contiguous();
+                if (available.empty()) return event;
+                size_t take = static_cast<size_t>(std::min<uint64_t>(available.size(), frameRemaining));
+                event.payload = available.first(take);
+                cursor.skip(take);
+                frameRemaining -= take;
+                event.type = EventType::DataChunk;
+                event.value = Http3FrameType::DATA;
+                event.frameComplete = (frameRemaining == 0);
+                if (event.frameComplete) {
+                    state = State::FrameType;
+                }
+                return event;
+            }
+
+            case State::Skip: {
+                auto available = cursor.contiguous();
+                if (frameRemaining > 0 && available.empty()) return event;
+                uint64_t take = std::min<uint64_t>(available.size(), frameRemaining);
+                cursor.skip(take);
+                frameRemaining -= take;
+                if (frameRemaining == 0) {
+                    state = State::FrameType;
+                }
+                break;
+            }
+
+            case State::Raw: {
+                auto available = cursor.contiguous();
+                if (available.empty()) return event;
+                cursor.skip(available.size());
+                event.type = EventType::RawData;
+                event.payload = available;
+                return event;
+            }
+
+            case State::Failed:
+                event.type = EventType::Error;
+                event.error = "Stream decoder already failed";
+                event.errorCode = failedCode;
+                return event;
+            }
+        }
+    }
+
+private:
+    enum class State { StreamType, FrameType, FrameLength, Payload, Data, Skip, Raw, Failed };
+
+    Http3FrameParser parser;
+    State state;
+    uint64_t maxBufferedFrame;
+    bool unidirectional;
+    uint64_t uniStreamType = 0;
+    bool awaitingSettings = false;  // Control stream whose first frame has not been seen yet
+    bool frameSeen = false;         // A frame type has been taken off the stream
+    uint64_t frameType = 0;
+    uint64_t frameRemaining = 0;
+    std::vector<uint8_t> payloadBuffer;
+    uint64_t failedCode = Http3ErrorCode::H3_FRAME_ERROR;
+
+    // Partially received varint
+    uint64_t varintValue = 0;
+    size_t varintHave = 0;
+    size_t varintNeed = 0;
+
+    static bool isBufferedFrame(uint64_t type) {
+        switch (type) {
+        case Http3FrameType::HEADERS:
+        case Http3FrameType::CANCEL_PUSH:
+        case Http3FrameType::SETTINGS:
+        case Http3FrameType::PUSH_PROMISE:
+        case Http3FrameType::GOAWAY:
+        case Http3FrameType::MAX_PUSH_ID:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Fast path at a frame boundary: when a whole frame is already in the chain, take it in
+    // one step instead of going through the byte-at-a-time resumable states. Returns false
+    // to let the slow path resume from the boundary; a frame that produced nothing (ignored
+    // type) leaves event as NeedMoreData.
+    bool nextCompleteFrame(Cursor& cursor, Event& event) {
+        Cursor start = cursor;
+        uint64_t type = 0;
+        if (!Http3FrameParser::decodeVarint(start, type)) {
+            return false;
+        }
+        if (!checkFirstFrame(type, event)) {
+            return true;
+        }
+        if (type == Http3FrameType::WEBTRANSPORT_STREAM) {
+            return false;
+        }
+
+        start = cursor;
+        Http3FrameView<BufferT> frame;
+        if (parser.parseFrame(cursor, frame) != Http3FrameParser::ParseStatus::Ok) {
+            return false;
+        }
+        frameSeen = true;
+
+        bool buffered = isBufferedFrame(type);
+        if (buffered && frame.length > maxBufferedFrame) {
+            fail(event, "Frame exceeds reassembly limit", Http3ErrorCode::H3_EXCESSIVE_LOAD);
+            return true;
+        }
+
+        if (type == Http3FrameType::DATA || buffered) {
+            auto payload = frame.payload.contiguous();
+            if (!payload) {
+                // Complete but straddling buffers: rewind to the payload and let the payload states gather it
+                uint64_t headerSize = cursor.consumed() - start.consumed() - frame.length;
+                cursor = start;
+                cursor.skip(headerSize);
+                frameType = type;
+                frameRemaining = frame.length;
+                payloadBuffer.clear();
+                state = (type == Http3FrameType::DATA) ? State::Data : State::Payload;
+                return true;
+            }
+            event.type = (type == Http3FrameType::DATA) ? EventType::DataChunk : EventType::Frame;
+            event.value = type;
+            event.payload = *payload;
+            event.frameComplete = true;
+        }
+        // Unknown and reserved (GREASE) frame types are dropped whole
+        return true;
+    }
+
+    // H3_MISSING_SETTINGS unless a control stream opens with SETTINGS (RFC 9114 section
+    // 6.2.1); H3_FRAME_UNEXPECTED for WEBTRANSPORT_STREAM anywhere but at the start of a
+    // bidirectional stream, since it turns the rest of the stream into data
+    bool checkFirstFrame(uint64_t type, Event& event) {
+        if (awaitingSettings) {
+            if (type != Http3FrameType::SETTINGS) {
+                fail(event, "Control stream does not start with SETTINGS", Http3ErrorCode::H3_MISSING_SETTINGS);
+                return false;
+            }
+            awaitingSettings = false;
+        }
+        if (type == Http3FrameType::WEBTRANSPORT_STREAM && (unidirectional || frameSeen)) {
+            fail(event, "WEBTRANSPORT_STREAM after the start of the stream", Http3ErrorCode::H3_FRAME_UNEXPECTED);
+            return false;
+        }
+        return true;
+    }
+
+    bool readVarint(Cursor& cursor, uint64_t& value) {
+        uint8_t byte = 0;
+        while (varintHave == 0 || varintHave < varintNeed) {
+            if (!cursor.readByte(byte)) return false;
+            if (varintHave == 0) {
+                varintNeed = Http3Varint::lengthFromFirstByte(byte);
+                varintValue = byte & 0x3F;
+            }
+            else {
+                varintValue = (varintValue << 8) | byte;
+            }
+            ++varintHave;
+        }
+        value = varintValue;
+        varintHave = 0;
+        return true;
+    }
+
+    Event& fail(Event& event, const char* reason, uint64_t errorCode = Http3ErrorCode::H3_FRAME_ERROR) {
+        state = State::Failed;
+        failedCode = errorCode;
+        payloadBuffer.clear();
+        event.type = EventType::Error;
+        event.error = reason;
+        event.errorCode = errorCode;
+        return event;
+    }
+};
+
+// One-pass frame writer over a caller-provided byte region (e.g. a pooled send buffer);
+// nothing is allocated. A payload whose length is unknown up front goes between
+// beginFrame() and endFrame(): the widest length varint the region could need is
+// reserved, and endFrame() back-patches it, shifting the payload down once if the real
+// length encodes shorter. Writes past the end of the region fail and stick, like a stream.
+class Http3FrameWriter {
+public:
+    explicit Http3FrameWriter(std::span<uint8_t> region)
+        : region(region) {}
+
+    bool ok() const { return !overflow; }
+    size_t size() const { return position; }
+    std::span<uint8_t> written() const { return region.first(position); }
+
+    // Unwritten part of the region, for encoders that produce a payload in place; follow with commit()
+    std::span<uint8_t> tail() const { return region.subspan(position); }
+
+    bool commit(size_t count) {
+        if (overflow || count > region.size() - position) return fail();
+        position += count;
+        return true;
+    }
+
+    bool writeByte(uint8_t value) {
+        if (overflow || position == region.size()) return fail();
+        region[position++] = value;
+        return true;
+    }
+
+    bool writeVarint(uint64_t value) {
+        size_t used = overflow ? 0 : Http3Varint::encode(value, tail());
+        if (used == 0) return fail();
+        position += used;
+        return true;
+    }
+
+    bool writeBytes(std::span<const uint8_t> bytes) {
+        if (overflow || bytes.size() > region.size() - position) return fail();
+        if (!bytes.empty()) {
+            std::memcpy(region.data() + position, bytes.data(), bytes.size());
+        }
+        position += bytes.size();
+        return true;
+    }
+
+    // A frame whose payload is already encoded: the length is exact, no back-patch
+    bool appendFrame(uint64_t type, std::span<const uint8_t> payload) {
+        return writeVarint(type) && writeVarint(payload.size()) && writeBytes(payload);
+    }
+
+    bool beginFrame(uint64_t type) {
+        if (frameOpen || !writeVarint(type)) return fail();
+        // The payload cannot outgrow what is left of the region, so this width always suffices
+        lengthOffset = position;
+        lengthReserved = Http3Varint::encodedLength(region.size() - position);
+        if (!commit(lengthReserved)) return false;
+        frameOpen = true;
+        return true;
+    }
+
+    bool endFrame() {
+        if (!frameOpen || overflow) return fail();
+        frameOpen = false;
+
+        size_t payloadStart = lengthOffset + lengthReserved;
+        size_t length = position - payloadStart;
+        size_t lengthSize = Http3Varint::encodedLength(length);
+        if (lengthSize != lengthReserved) {
+            std::memmove(region.data() + lengthOffset + lengthSize, region.data() + payloadStart, length);
+            position -= lengthReserved - lengthSize;
+        }
+        // Sized to the varint so the encoder's 8-byte store cannot reach the payload
+        Http3Varint::encode(length, region.subspan(lengthOffset, lengthSize));
+        return true;
+    }
+
+private:
+    std::span<uint8_t> region;
+    size_t position = 0;
+    size_t lengthOffset = 0;
+    size_t lengthReserved = 0;
+    bool frameOpen = false;
+    bool overflow = false;
+
+    bool fail() {
+        overflow = true;
+        return false;
+    }
+};
+
+// Byte string of fixed capacity built in a constant expression, for blobs that never
+// change - the control stream preamble, canned responses - and so can be sent straight
+// from read-only storage. Writing past Capacity fails to compile.
+template <size_t Capacity>
+class Http3ConstantBytes {
+public:
+    constexpr void push_back(uint8_t value) { bytes[length++] = value; }
+
+    constexpr void writeVarint(uint64_t value) {
+        size_t size = Http3Varint::encodedLength(value);
+        uint8_t lengthClass = static_cast<uint8_t>(std::countr_zero(size) << 6);
+        for (size_t i = size; i-- > 0;) {
+            uint8_t byte = static_cast<uint8_t>(value >> (8 * i));
+            push_back(i == size - 1 ? static_cast<uint8_t>(byte | lengthClass) : byte);
+        }
+    }
+
+    constexpr void writeBytes(std::span<const uint8_t> data) {
+        for (uint8_t byte : data) push_back(byte);
+    }
+
+    constexpr void writeString(std::string_view text) {
+        for (char c : text) push_back(static_cast<uint8_t>(c));
+    }
+
+    constexpr size_t size() const { return length; }
+    constexpr const uint8_t* data() const { return bytes.data(); }
+    constexpr std::span<const uint8_t> span() const { return { bytes.data(), length }; }
+
+    // QUIC_BUFFER-shaped descriptor of the bytes. MsQuic never writes to send buffers, so
+    // the const is cast away; with both objects constexpr the send needs no storage of its own.
+    template <typename BufferT = Http3Buffer>
+    constexpr BufferT buffer() const {
+        BufferT out{};
+        out.Length = static_cast<uint32_t>(length);
+        out.Buffer = const_cast<uint8_t*>(bytes.data());
+        return out;
+    }
+
+private:
+    std::array<uint8_t, Capacity> bytes{};
+    size_t length = 0;
+};
+
+class Http3FrameBuilder {
+public:
+    // Control stream type followed by the SETTINGS frame, encoded at compile time:
+    // static constexpr auto PREAMBLE = Http3FrameBuilder::controlStreamPreamble(SETTINGS);
+    template <size_t Count>
+    static constexpr auto controlStreamPreamble(const Http3Setting (&settings)[Count]) {
+        uint64_t payloadLength = 0;
+        for (const auto& setting : settings) {
+            payloadLength += Http3Varint::encodedLength(setting.id) + Http3Varint::encodedLength(setting.value);
+        }
+
+        Http3ConstantBytes<3 * Http3Varint::MAX_LENGTH + 2 * Count * Http3Varint::MAX_LENGTH> out;
+        out.writeVarint(Http3StreamType::CONTROL);
+        out.writeVarint(Http3FrameType::SETTINGS);
+        out.writeVarint(payloadLength);
+        for (const auto& setting : settings) {
+            out.writeVarint(setting.id);
+            out.writeVarint(setting.value);
+        }
+        return out;
+    }
+
+    static bool writeHeadersFrame(Http3FrameWriter& writer, std::span<const uint8_t> qpackData) {
+        return writer.appendFrame(Http3FrameType::HEADERS, qpackData);
+    }
+
+    static bool writeSettingsFrame(Http3FrameWriter& writer, std::span<const Http3Setting> settings) {
+        writer.beginFrame(Http3FrameType::SETTINGS);
+        for (const auto& setting : settings) {
+            writer.writeVarint(setting.id);
+            writer.writeVarint(setting.value);
+        }
+        return writer.endFrame();
+    }
+
+    static bool writeMaxPushIdFrame(Http3FrameWriter& writer, uint64_t pushId = 0) {
+        writer.beginFrame(Http3FrameType::MAX_PUSH_ID);
+        writer.writeVarint(pushId);
+        return writer.endFrame();
+    }
+};
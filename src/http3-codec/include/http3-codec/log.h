@@ -0,0 +1,464 @@
+// log.h - Asynchronous logger for the codec, the client and the server
+// Shared by the client and the server; no MsQuic dependency.
+// A log call copies its arguments into a fixed-size record in a ring owned by the calling
+// thread and returns; formatting and console I/O happen on a drain thread. Worker threads
+// never take a lock or make a system call to log, and a full ring drops records instead of
+// waiting for the console.
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define HTTP3_LOG_USE_TSC 1
+#endif
+
+// Verbosity is fixed at compile time: a call above HTTP3_LOG_LEVEL is discarded by
+// `if constexpr`, so its arguments are never evaluated and it writes no record. Builds with
+// NDEBUG default to INFO, others to TRACE; define HTTP3_LOG_LEVEL to choose.
+#define HTTP3_LOG_LEVEL_NONE 0
+#define HTTP3_LOG_LEVEL_ERROR 1 // Failures
+#define HTTP3_LOG_LEVEL_INFO 2  // Connection and session lifecycle
+#define HTTP3_LOG_LEVEL_DEBUG 3 // Per-stream and per-event progress
+#define HTTP3_LOG_LEVEL_TRACE 4 // Hex dumps, frame headers and every header field
+
+#ifndef HTTP3_LOG_LEVEL
+#if defined(NDEBUG)
+#define HTTP3_LOG_LEVEL HTTP3_LOG_LEVEL_INFO
+#else
+#define HTTP3_LOG_LEVEL HTTP3_LOG_LEVEL_TRACE
+#endif
+#endif
+
+#define HTTP3_LOG_AT(level, ...) \
+    do { \
+        if constexpr (Http3Log::enabled(level)) { \
+            Http3Log::write(__VA_ARGS__); \
+        } \
+    } while (false)
+
+#define HTTP3_LOG_ERROR(...) HTTP3_LOG_AT(HTTP3_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define HTTP3_LOG_INFO(...) HTTP3_LOG_AT(HTTP3_LOG_LEVEL_INFO, __VA_ARGS__)
+#define HTTP3_LOG_DEBUG(...) HTTP3_LOG_AT(HTTP3_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define HTTP3_LOG_TRACE(...) HTTP3_LOG_AT(HTTP3_LOG_LEVEL_TRACE, __VA_ARGS__)
+
+// Log argument rendered as hexadecimal, without a prefix. A signed value keeps its width, so
+// a failed QUIC_STATUS reads 80410000 and not ffffffff80410000.
+struct Http3LogHex {
+    template <typename T>
+        requires std::is_integral_v<T>
+    constexpr Http3LogHex(T value) : value(static_cast<std::make_unsigned_t<T>>(value)) {}
+
+    uint64_t value;
+};
+
+// Log argument rendered as a hex dump of up to `limit` bytes, "..." marking the rest
+struct Http3LogBytes {
+    std::span<const uint8_t> bytes;
+    size_t limit = 32;
+};
+
+// Format of one log call: a string literal in which every {} stands for the next argument.
+// Records keep only the pointer, and the placeholder count is checked at compile time.
+template <typename... Args>
+struct Http3LogFormat {
+    template <size_t N>
+    consteval Http3LogFormat(const char (&literal)[N]) : text(literal) {
+        size_t placeholders = 0;
+        for (size_t i = 0; i + 1 < N; ++i) {
+            if (literal[i] == '{' && literal[i + 1] == '}') {
+                ++placeholders;
+            }
+        }
+        if (placeholders != sizeof...(Args)) {
+            throw "log format does not match its arguments";
+        }
+    }
+
+    const char* text;
+};
+
+class Http3Log {
+public:
+    static constexpr size_t MAX_ARGS = 8;
+    static constexpr size_t TEXT_SPACE = 160;   // Copied strings and hex dumps of one record
+    static constexpr size_t RING_RECORDS = 4096; // Per logging thread; a power of two
+    static constexpr auto DRAIN_INTERVAL = std::chrono::milliseconds(10);
+
+    // Start the drain thread. Until then, and after stop(), log calls return at once.
+    static void start(std::ostream& out = std::cout) {
+        State& s = state();
+        std::lock_guard lock(s.mutex);
+        if (s.drainThread.joinable()) {
+            return;
+        }
+        s.out = &out;
+        s.startTicks = ticks();
+        s.startTime = std::chrono::steady_clock::now();
+        s.stopping = false;
+        s.drainThread = std::thread(drainLoop);
+        s.running.store(true, std::memory_order_release);
+    }
+
+    // Write out everything logged so far and stop the drain thread. Records a thread is in
+    // the middle of writing may be lost, so stop once the transport's workers are done.
+    static void stop() {
+        State& s = state();
+        {
+            std::lock_guard lock(s.mutex);
+            if (!s.drainThread.joinable()) {
+                return;
+            }
+            s.running.store(false, std::memory_order_release);
+            s.stopping = true;
+        }
+        s.wake.notify_all();
+        s.drainThread.join();
+    }
+
+    // Wait until the drain thread has written out every record logged before the call
+    static void flush() {
+        State& s = state();
+        std::unique_lock lock(s.mutex);
+        if (!s.drainThread.joinable()) {
+            return;
+        }
+        uint64_t target = s.drainRequests + 1;
+        s.drainRequests = target;
+        s.wake.notify_all();
+        s.drained.wait(lock, [&] { return s.drainsDone >= target || s.stopping; });
+    }
+
+    static bool running() { return state().running.load(std::memory_order_relaxed); }
+
+    // Whether calls at `level` are compiled in; guards diagnostics that take more than one
+    // log call, such as a loop over buffers
+    static constexpr bool enabled(int level) { return level <= HTTP3_LOG_LEVEL; }
+
+    // Logs unconditionally; call sites use the HTTP3_LOG_* macros
+    template <typename... Args>
+    static void write(std::type_identity_t<Http3LogFormat<std::decay_t<Args>...>> format, const Args&... args) {
+        static_assert(sizeof...(Args) <= MAX_ARGS, "too many log arguments");
+        if (!running()) {
+            return;
+        }
+        Ring& ring = localRing();
+        uint64_t head = ring.head.load(std::memory_order_relaxed);
+        if (head - ring.tail.load(std::memory_order_acquire) == RING_RECORDS) {
+            ring.dropped.store(ring.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+        Record& record = ring.records[head & (RING_RECORDS - 1)];
+        record.ticks = ticks();
+        record.format = format.text;
+        record.argCount = 0;
+        record.textLength = 0;
+        (capture(record, args), ...);
+        ring.head.store(head + 1, std::memory_order_release);
+    }
+
+private:
+    enum class ArgKind : uint8_t { Unsigned, Signed, Hex, Pointer, Double, Text, Bytes };
+
+    // Text and Bytes arguments live in the record's text area; their value packs the
+    // offset, the stored length and whether the argument was cut short
+    static constexpr uint64_t TRUNCATED = uint64_t{ 1 } << 32;
+
+    struct Record {
+        uint64_t ticks;
+        const char* format;
+        uint64_t values[MAX_ARGS];
+        ArgKind kinds[MAX_ARGS];
+        uint8_t argCount;
+        uint16_t textLength;
+        char text[TEXT_SPACE];
+    };
+
+    // Single-producer, single-consumer: the owning thread advances head, the drain thread tail
+    struct Ring {
+        std::unique_ptr<Record[]> records = std::make_unique<Record[]>(RING_RECORDS);
+        alignas(64) std::atomic<uint64_t> head{ 0 };
+        alignas(64) std::atomic<uint64_t> tail{ 0 };
+        std::atomic<uint64_t> dropped{ 0 };
+        uint64_t droppedReported = 0;          // Drain thread only
+        std::atomic<bool> retired{ false };    // Owning thread has exited
+    };
+
+    struct LocalRing {
+        std::shared_ptr<Ring> ring;
+        ~LocalRing() {
+            if (ring) ring->retired.store(true, std::memory_order_release);
+        }
+    };
+
+    struct State {
+        std::atomic<bool> running{ false };
+        std::mutex mutex;                      // Guards everything below
+        std::condition_variable wake;
+        std::condition_variable drained;
+        std::vector<std::shared_ptr<Ring>> rings;
+        std::thread drainThread;
+        bool stopping = false;
+        uint64_t drainRequests = 0;
+        uint64_t drainsDone = 0;
+        std::ostream* out = &std::cout;
+        uint64_t startTicks = 0;
+        std::chrono::steady_clock::time_point startTime;
+
+        // A program that returns without stop() still gets its last records written out
+        ~State() {
+            if (drainThread.joinable()) {
+                {
+                    std::lock_guard lock(mutex);
+                    running.store(false, std::memory_order_release);
+                    stopping = true;
+                }
+                wake.notify_all();
+                drainThread.join();
+            }
+        }
+    };
+
+    static State& state() {
+        static State s;
+        return s;
+    }
+
+    static uint64_t ticks() {
+#if defined(HTTP3_LOG_USE_TSC)
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+
+    // The thread's ring, registered with the drain thread on the thread's first log call
+    static Ring& localRing() {
+        static thread_local LocalRing local;
+        if (!local.ring) {
+            local.ring = std::make_shared<Ring>();
+            State& s = state();
+            std::lock_guard lock(s.mutex);
+            s.rings.push_back(local.ring);
+        }
+        return *local.ring;
+    }
+
+    template <typename T>
+    static void capture(Record& record, const T& value) {
+        size_t i = record.argCount++;
+        if constexpr (std::is_same_v<T, Http3LogHex>) {
+            record.kinds[i] = ArgKind::Hex;
+            record.values[i] = value.value;
+        }
+        else if constexpr (std::is_same_v<T, Http3LogBytes>) {
+            record.kinds[i] = ArgKind::Bytes;
+            size_t length = std::min(value.bytes.size(), value.limit);
+            record.values[i] = storeText(record, value.bytes.data(), length, value.bytes.size() > length);
+        }
+        else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+            std::string_view text = value;
+            record.kinds[i] = ArgKind::Text;
+            record.values[i] = storeText(record, text.data(), text.size(), false);
+        }
+        else if constexpr (std::is_pointer_v<T>) {
+            record.kinds[i] = ArgKind::Pointer;
+            record.values[i] = reinterpret_cast<uintptr_t>(value);
+        }
+        else if constexpr (std::is_enum_v<T>) {
+            record.kinds[i] = ArgKind::Signed;
+            record.values[i] = static_cast<uint64_t>(static_cast<int64_t>(value));
+        }
+        else if constexpr (std::is_floating_point_v<T>) {
+            record.kinds[i] = ArgKind::Double;
+            record.values[i] = std::bit_cast<uint64_t>(static_cast<double>(value));
+        }
+        else if constexpr (std::is_signed_v<T>) {
+            record.kinds[i] = ArgKind::Signed;
+            record.values[i] = static_cast<uint64_t>(static_cast<int64_t>(value));
+        }
+        else {
+            static_assert(std::is_unsigned_v<T>, "unsupported log argument type");
+            record.kinds[i] = ArgKind::Unsigned;
+            record.values[i] = static_cast<uint64_t>(value);
+        }
+    }
+
+    // Copy as much as fits into the record's text area
+    static uint64_t storeText(Record& record, const void* data, size_t length, bool truncated) {
+        size_t offset = record.textLength;
+        size_t stored = std::min(length, TEXT_SPACE - offset);
+        if (stored > 0) {
+            std::memcpy(record.text + offset, data, stored);
+        }
+        record.textLength = static_cast<uint16_t>(offset + stored);
+        return offset | (stored << 16) | (truncated || stored < length ? TRUNCATED : 0);
+    }
+
+    static void appendHex(std::string& out, uint64_t value) {
+        char digits[16];
+        size_t count = 0;
+        do {
+            digits[count++] = "0123456789abcdef"[value & 0xF];
+            value >>= 4;
+        } while (value != 0);
+        while (count > 0) {
+            out += digits[--count];
+        }
+    }
+
+    static void appendArg(std::string& out, const Record& record, size_t i) {
+        uint64_t value = record.values[i];
+        switch (record.kinds[i]) {
+        case ArgKind::Unsigned:
+            out += std::to_string(value);
+            break;
+        case ArgKind::Signed:
+            out += std::to_string(static_cast<int64_t>(value));
+            break;
+        case ArgKind::Hex:
+            appendHex(out, value);
+            break;
+        case ArgKind::Pointer:
+            out += "0x";
+            appendHex(out, value);
+            break;
+        case ArgKind::Double:
+            out += std::to_string(std::bit_cast<double>(value));
+            break;
+        case ArgKind::Text:
+        case ArgKind::Bytes: {
+            const char* text = record.text + (value & 0xFFFF);
+            size_t length = (value >> 16) & 0xFFFF;
+            if (record.kinds[i] == ArgKind::Text) {
+                out.append(text, length);
+            }
+            else {
+                for (size_t b = 0; b < length; ++b) {
+                    uint8_t byte = static_cast<uint8_t>(text[b]);
+                    if (b > 0) out += ' ';
+                    out += "0123456789abcdef"[byte >> 4];
+                    out += "0123456789abcdef"[byte & 0xF];
+                }
+            }
+            if (value & TRUNCATED) {
+                out += "...";
+            }
+            break;
+        }
+        }
+    }
+
+    static void appendTimestamp(std::string& out, uint64_t recordTicks, uint64_t startTicks, double nsPerTick) {
+        uint64_t elapsed = recordTicks > startTicks ? recordTicks - startTicks : 0;
+        out += "[T+";
+        out += std::to_string(static_cast<uint64_t>(static_cast<double>(elapsed) * nsPerTick / 1e6));
+        out += "ms] ";
+    }
+
+    static void appendRecord(std::string& out, const Record& record) {
+        size_t arg = 0;
+        for (const char* p = record.format; *p != '\0'; ++p) {
+            if (p[0] == '{' && p[1] == '}' && arg < record.argCount) {
+                appendArg(out, record, arg++);
+                ++p;
+            }
+            else {
+                out += *p;
+            }
+        }
+        out += '\n';
+    }
+
+    // Move every complete record out of the rings, interleave the threads by timestamp and
+    // write them out in one go
+    static void drainOnce(std::vector<Record>& batch, std::string& text) {
+        State& s = state();
+        std::vector<std::shared_ptr<Ring>> rings;
+        {
+            std::lock_guard lock(s.mutex);
+            rings = s.rings;
+        }
+
+        batch.clear();
+        uint64_t dropped = 0;
+        for (const auto& ring : rings) {
+            uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            for (; tail != head; ++tail) {
+                batch.push_back(ring->records[tail & (RING_RECORDS - 1)]);
+            }
+            ring->tail.store(tail, std::memory_order_release);
+
+            uint64_t ringDropped = ring->dropped.load(std::memory_order_relaxed);
+            dropped += ringDropped - ring->droppedReported;
+            ring->droppedReported = ringDropped;
+        }
+        std::stable_sort(batch.begin(), batch.end(), [](const Record& a, const Record& b) { return a.ticks < b.ticks; });
+
+        // TSC ticks are converted with the rate measured since start()
+        uint64_t nowTicks = ticks();
+        double elapsedNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - s.startTime).count();
+        double nsPerTick = nowTicks > s.startTicks ? elapsedNs / static_cast<double>(nowTicks - s.startTicks) : 1.0;
+
+        text.clear();
+        for (const Record& record : batch) {
+            appendTimestamp(text, record.ticks, s.startTicks, nsPerTick);
+            appendRecord(text, record);
+        }
+        if (dropped > 0) {
+            appendTimestamp(text, nowTicks, s.startTicks, nsPerTick);
+            text += "[log] " + std::to_string(dropped) + " records dropped, ring full\n";
+        }
+        if (!text.empty()) {
+            s.out->write(text.data(), static_cast<std::streamsize>(text.size()));
+            s.out->flush();
+        }
+
+        // Rings of exited threads go once they are empty
+        std::lock_guard lock(s.mutex);
+        std::erase_if(s.rings, [](const std::shared_ptr<Ring>& ring) {
+            return ring->retired.load(std::memory_order_acquire) &&
+                ring->tail.load(std::memory_order_relaxed) == ring->head.load(std::memory_order_acquire);
+        });
+    }
+
+    static void drainLoop() {
+        State& s = state();
+        std::vector<Record> batch;
+        std::string text;
+        std::unique_lock lock(s.mutex);
+        for (;;) {
+            s.wake.wait_for(lock, DRAIN_INTERVAL, [&] { return s.stopping || s.drainRequests > s.drainsDone; });
+            bool stopping = s.stopping;
+            uint64_t requests = s.drainRequests;
+            lock.unlock();
+            drainOnce(batch, text);
+            lock.lock();
+            s.drainsDone = requests;
+            s.drained.notify_all();
+            if (stopping) {
+                return;
+            }
+        }
+    }
+};
@@ -0,0 +1,1372 @@
+// qpack.h - QPACK static and dynamic tables, field section encoder and decoder (RFC 9204)
+// Shared by the client, the server and the codec benchmarks; no MsQuic dependency.
+#pragma once
+#include "http3-codec/frame.h"
+#include "http3-codec/huffman.h"
+#include "http3-codec/log.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// QPACK static table (RFC 9204 Appendix A)
+struct QpackStaticEntry {
+    std::string_view name;
+    std::string_view value;
+};
+
+constexpr std::array<QpackStaticEntry, 99> QPACK_STATIC_TABLE = { {
+    {":authority", ""},                  // 0
+    {":path", "/"},                      // 1
+    {"age", "0"},                        // 2
+    {"content-disposition", ""},         // 3
+    {"content-length", "0"},             // 4
+    {"cookie", ""},                      // 5
+    {"date", ""},                        // 6
+    {"etag", ""},                        // 7
+    {"if-modified-since", ""},           // 8
+    {"if-none-match", ""},               // 9
+    {"last-modified", ""},               // 10
+    {"link", ""},                        // 11
+    {"location", ""},                    // 12
+    {"referer", ""},                     // 13
+    {"set-cookie", ""},                  // 14
+    {":method", "CONNECT"},              // 15  <- Important for WebTransport
+    {":method", "DELETE"},               // 16
+    {":method", "GET"},                  // 17
+    {":method", "HEAD"},                 // 18
+    {":method", "OPTIONS"},              // 19
+    {":method", "POST"},                 // 20
+    {":method", "PUT"},                  // 21
+    {":scheme", "http"},                 // 22
+    {":scheme", "https"},                // 23
+    {":status", "103"},                  // 24
+    {":status", "200"},                  // 25
+    {":status", "304"},                  // 26
+    {":status", "404"},                  // 27
+    {":status", "503"},                  // 28
+    {"accept", "*/*"},                   // 29
+    {"accept", "application/dns-message"}, // 30
+    {"accept-encoding", "gzip, deflate, br"}, // 31
+    {"accept-ranges", "bytes"},          // 32
+    {"access-control-allow-headers", "cache-control"}, // 33
+    {"access-control-allow-headers", "content-type"}, // 34
+    {"access-control-allow-origin", "*"}, // 35
+    {"cache-control", "max-age=0"},      // 36
+    {"cache-control", "max-age=2592000"}, // 37
+    {"cache-control", "max-age=604800"}, // 38
+    {"cache-control", "no-cache"},       // 39
+    {"cache-control", "no-store"},       // 40
+    {"cache-control", "public, max-age=31536000"}, // 41
+    {"content-encoding", "br"},          // 42
+    {"content-encoding", "gzip"},        // 43
+    {"content-type", "application/dns-message"}, // 44
+    {"content-type", "application/javascript"}, // 45
+    {"content-type", "application/json"}, // 46
+    {"content-type", "application/x-www-form-urlencoded"}, // 47
+    {"content-type", "image/gif"},       // 48
+    {"content-type", "image/jpeg"},      // 49
+    {"content-type", "image/png"},       // 50
+    {"content-type", "text/css"},        // 51
+    {"content-type", "text/html; charset=utf-8"}, // 52
+    {"content-type", "text/plain"},      // 53
+    {"content-type", "text/plain;charset=utf-8"}, // 54
+    {"range", "bytes=0-"},               // 55
+    {"strict-transport-security", "max-age=31536000"}, // 56
+    {"strict-transport-security", "max-age=31536000; includesubdomains"}, // 57
+    {"strict-transport-security", "max-age=31536000; includesubdomains; preload"}, // 58
+    {"vary", "accept-encoding"},         // 59
+    {"vary", "origin"},                  // 60
+    {"x-content-type-options", "nosniff"}, // 61
+    {"x-xss-protection", "1; mode=block"}, // 62
+    {":status", "100"},                  // 63
+    {":status", "204"},                  // 64
+    {":status", "206"},                  // 65
+    {":status", "302"},                  // 66
+    {":status", "400"},                  // 67
+    {":status", "403"},                  // 68
+    {":status", "421"},                  // 69
+    {":status", "425"},                  // 70
+    {":status", "500"},                  // 71
+    {"accept-language", ""},             // 72
+    {"access-control-allow-credentials", "FALSE"}, // 73
+    {"access-control-allow-credentials", "TRUE"}, // 74
+    {"access-control-allow-headers", "*"}, // 75
+    {"access-control-allow-methods", "get"}, // 76
+    {"access-control-allow-methods", "get, post, options"}, // 77
+    {"access-control-allow-methods", "options"}, // 78
+    {"access-control-expose-headers", "content-length"}, // 79
+    {"access-control-request-headers", "content-type"}, // 80
+    {"access-control-request-method", "get"}, // 81
+    {"access-control-request-method", "post"}, // 82
+    {"alt-svc", "clear"},                // 83
+    {"authorization", ""},               // 84
+    {"content-security-policy", "script-src 'none'; object-src 'none'; base-uri 'none'"}, // 85
+    {"early-data", "1"},                 // 86
+    {"expect-ct", ""},                   // 87
+    {"forwarded", ""},                   // 88
+    {"if-range", ""},                    // 89
+    {"origin", ""},                      // 90
+    {"purpose", "prefetch"},             // 91
+    {"server", ""},                      // 92
+    {"timing-allow-origin", "*"},        // 93
+    {"upgrade-insecure-requests", "1"},  // 94
+    {"user-agent", ""},                  // 95
+    {"x-forwarded-for", ""},             // 96
+    {"x-frame-options", "deny"},         // 97
+    {"x-frame-options", "sameorigin"},   // 98
+} };
+
+// Perfect hash over QPACK_STATIC_TABLE for the encoder, built at compile time. FNV-1a runs
+// over the name, then a zero byte and the value, so a single pass gives both the name hash
+// and the name+value hash. With SEED neither 512-slot table has a collision, so a lookup
+// is one hash and at most one comparison per table.
+class QpackStaticIndex {
+public:
+    struct Match {
+        int exact = -1;  // Entry with this name and value
+        int name = -1;   // Lowest entry with this name
+    };
+
+    constexpr QpackStaticIndex() {
+        for (size_t i = 0; i < QPACK_STATIC_TABLE.size(); ++i) {
+            const auto& entry = QPACK_STATIC_TABLE[i];
+            uint32_t nameHash = hash(SEED, entry.name);
+
+            uint8_t& nameSlot = names[slot(nameHash)];
+            if (nameSlot == EMPTY) {
+                nameSlot = static_cast<uint8_t>(i);
+            }
+            else if (QPACK_STATIC_TABLE[nameSlot].name != entry.name) {
+                perfect = false;
+            }
+
+            uint8_t& exactSlot = exact[slot(extend(nameHash, entry.value))];
+            perfect = perfect && exactSlot == EMPTY;
+            exactSlot = static_cast<uint8_t>(i);
+        }
+    }
+
+    constexpr Match match(std::string_view name, std::string_view value) const {
+        Match result;
+        uint32_t nameHash = hash(SEED, name);
+
+        uint8_t nameSlot = names[slot(nameHash)];
+        if (nameSlot == EMPTY || QPACK_STATIC_TABLE[nameSlot].name != name) {
+            return result;  // No entry has this name, so none can match exactly either
+        }
+        result.name = nameSlot;
+
+        uint8_t exactSlot = exact[slot(extend(nameHash, value))];
+        if (exactSlot != EMPTY && QPACK_STATIC_TABLE[exactSlot].name == name && QPACK_STATIC_TABLE[exactSlot].value == value) {
+            result.exact = exactSlot;
+        }
+        return result;
+    }
+
+    constexpr bool isPerfect() const { return perfect; }
+
+private:
+    static constexpr uint32_t SEED = 30268;
+    static constexpr unsigned SLOT_BITS = 9;
+    static constexpr uint8_t EMPTY = 0xFF;
+    static constexpr uint32_t FNV_PRIME = 16777619u;
+
+    static constexpr uint32_t hash(uint32_t h, std::string_view bytes) {
+        for (char c : bytes) {
+            h = (h ^ static_cast<uint8_t>(c)) * FNV_PRIME;
+        }
+        return h;
+    }
+
+    static constexpr uint32_t extend(uint32_t nameHash, std::string_view value) {
+        return hash(nameHash * FNV_PRIME, value);  // Zero separator byte: h ^ 0 == h
+    }
+
+    static constexpr size_t slot(uint32_t h) { return h >> (32 - SLOT_BITS); }
+
+    std::array<uint8_t, 1u << SLOT_BITS> exact = makeEmpty();
+    std::array<uint8_t, 1u << SLOT_BITS> names = makeEmpty();
+    bool perfect = true;
+
+    static constexpr std::array<uint8_t, 1u << SLOT_BITS> makeEmpty() {
+        std::array<uint8_t, 1u << SLOT_BITS> slots{};
+        slots.fill(EMPTY);
+        return slots;
+    }
+};
+
+constexpr QpackStaticIndex QPACK_STATIC_INDEX;
+static_assert(QPACK_STATIC_INDEX.isPerfect(), "QPACK static table hash collides; search for a new SEED");
+static_assert(QPACK_STATIC_INDEX.match(":method", "CONNECT").exact == 15);
+static_assert(QPACK_STATIC_INDEX.match(":status", "418").name == 24);
+
+// QPACK prefixed integers (RFC 9204 section 4.1.1): an N-bit prefix followed by 7-bit
+// continuation bytes
+struct QpackInteger {
+    // out is anything with push_back(uint8_t): a vector, or Http3ConstantBytes at compile time
+    template <typename ByteSink>
+    static constexpr void encode(ByteSink& out, uint64_t value, uint8_t prefixBits, uint8_t prefixPattern = 0) {
+        uint64_t maxPrefix = (1ULL << prefixBits) - 1;
+
+        if (value < maxPrefix) {
+            out.push_back(static_cast<uint8_t>(prefixPattern | value));
+            return;
+        }
+
+        out.push_back(static_cast<uint8_t>(prefixPattern | maxPrefix));
+        value -= maxPrefix;
+        while (value >= 128) {
+            out.push_back(static_cast<uint8_t>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    // Decodes the integer at position and advances past it. Returns nullopt on overflow, or when
+    // the data ends first - then truncated is set, so stream parsers know to wait for more bytes.
+    static std::optional<uint64_t> decode(std::span<const uint8_t> data, size_t& position, uint8_t prefixBits, bool& truncated) {
+        if (position >= data.size()) {
+            truncated = true;
+            return std::nullopt;
+        }
+
+        uint64_t maxPrefix = (1ULL << prefixBits) - 1;
+        uint64_t value = data[position] & static_cast<uint8_t>(maxPrefix);
+        position++;
+
+        if (value < maxPrefix) {
+            return value;
+        }
+
+        // Multi-byte integer
+        for (unsigned shift = 0; position < data.size(); shift += 7) {
+            if (shift > 56) {
+                return std::nullopt; // Overflow protection
+            }
+            uint8_t byte = data[position++];
+            value += static_cast<uint64_t>(byte & 0x7F) << shift;
+
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+
+        truncated = true;
+        return std::nullopt;
+    }
+};
+
+// Field line of a section encoded at compile time; names must be lowercase
+struct QpackConstantField {
+    std::string_view name;
+    std::string_view value;
+};
+
+// HEADERS frames for field sections that never change, such as the server's responses,
+// encoded at compile time. Only static table references and raw literals are used, so the
+// frame is valid whatever dynamic table the peer allows:
+// static constexpr auto OK = QpackConstantSection::headersFrame({ { ":status", "200" } });
+struct QpackConstantSection {
+    template <size_t Capacity = 128, size_t Count>
+    static constexpr auto headersFrame(const QpackConstantField (&fields)[Count]) {
+        Http3ConstantBytes<Capacity> section;
+        section.push_back(0x00);  // Required Insert Count 0
+        section.push_back(0x00);  // Delta Base 0
+        for (const auto& field : fields) {
+            auto match = QPACK_STATIC_INDEX.match(field.name, field.value);
+            if (match.exact >= 0) {
+                QpackInteger::encode(section, static_cast<uint64_t>(match.exact), 6, 0xC0);  // 11xxxxxx Indexed, static
+                continue;
+            }
+            if (match.name >= 0) {
+                QpackInteger::encode(section, static_cast<uint64_t>(match.name), 4, 0x50);  // 0101xxxx Literal with static name
+            }
+            else {
+                QpackInteger::encode(section, field.name.size(), 3, 0x20);  // 0010 0xxx Literal with literal name
+                section.writeString(field.name);
+            }
+            QpackInteger::encode(section, field.value.size(), 7);
+            section.writeString(field.value);
+        }
+
+        Http3ConstantBytes<Capacity + 2 * Http3Varint::MAX_LENGTH> frame;
+        frame.writeVarint(Http3FrameType::HEADERS);
+        frame.writeVarint(section.size());
+        frame.writeBytes(section.span());
+        return frame;
+    }
+};
+
+// An exact static match encodes as one indexed field line: 01 03 00 00 D9
+static_assert(QpackConstantSection::headersFrame({ { ":status", "200" } }).span()[4] == 0xD9);
+
+// QPACK dynamic table (RFC 9204 section 3.2). Entries sit in a power-of-two ring indexed by
+// absolute index, so inserts and evictions never move the entries in between.
+class QpackDynamicTable {
+public:
+    struct Entry {
+        std::string name;
+        std::string value;
+    };
+
+    // Per-entry overhead counted against the capacity (RFC 9204 section 3.2.1)
+    static constexpr uint64_t ENTRY_OVERHEAD = 32;
+
+    // Passed as pinned when nothing is protected from eviction
+    static constexpr uint64_t NO_PIN = std::numeric_limits<uint64_t>::max();
+
+    static uint64_t entrySize(std::string_view name, std::string_view value) {
+        return name.size() + value.size() + ENTRY_OVERHEAD;
+    }
+
+private:
+    std::vector<Entry> ring;
+    uint64_t inserted = 0;        // Insert Count: total entries ever inserted
+    uint64_t dropped = 0;         // Absolute index of the oldest live entry
+    uint64_t used = 0;            // Sum of the live entry sizes
+    uint64_t tableCapacity = 0;
+    uint64_t tableMaxCapacity = 0;
+
+    Entry& slot(uint64_t absolute) { return ring[absolute & (ring.size() - 1)]; }
+    const Entry& slot(uint64_t absolute) const { return ring[absolute & (ring.size() - 1)]; }
+
+    void evictOldest() {
+        Entry& oldest = slot(dropped++);
+        used -= entrySize(oldest.name, oldest.value);
+        oldest = {};
+    }
+
+    void grow() {
+        std::vector<Entry> larger(std::max<size_t>(8, ring.size() * 2));
+        for (uint64_t i = dropped; i < inserted; ++i) {
+            larger[i & (larger.size() - 1)] = std::move(slot(i));
+        }
+        ring.swap(larger);
+    }
+
+    // Whether used can drop to limit by evicting only entries below pinned
+    bool canShrinkTo(uint64_t limit, uint64_t pinned) const {
+        uint64_t remaining = used;
+        for (uint64_t i = dropped; remaining > limit; ++i) {
+            if (i >= pinned) return false;
+            remaining -= entrySize(slot(i).name, slot(i).value);
+        }
+        return true;
+    }
+
+public:
+    // From SETTINGS_QPACK_MAX_TABLE_CAPACITY; fixes MaxEntries for Required Insert Count coding
+    void setMaxCapacity(uint64_t maxCapacity) { tableMaxCapacity = maxCapacity; }
+
+    uint64_t maxCapacity() const { return tableMaxCapacity; }
+    uint64_t maxEntries() const { return tableMaxCapacity / ENTRY_OVERHEAD; }
+    uint64_t capacity() const { return tableCapacity; }
+    uint64_t size() const { return used; }
+    uint64_t insertCount() const { return inserted; }
+    uint64_t droppedCount() const { return dropped; }
+
+    // Fails above the maximum capacity, or if shrinking would evict an entry at or past pinned
+    bool setCapacity(uint64_t newCapacity, uint64_t pinned = NO_PIN) {
+        if (newCapacity > tableMaxCapacity || !canShrinkTo(newCapacity, pinned)) {
+            return false;
+        }
+        while (used > newCapacity) {
+            evictOldest();
+        }
+        tableCapacity = newCapacity;
+        return true;
+    }
+
+    bool canInsert(uint64_t entrySize, uint64_t pinned = NO_PIN) const {
+        return entrySize <= tableCapacity && canShrinkTo(tableCapacity - entrySize, pinned);
+    }
+
+    // Evicts the oldest entries to make room; fails if the entry cannot fit
+    bool insert(std::string name, std::string value, uint64_t pinned = NO_PIN) {
+        uint64_t size = entrySize(name, value);
+        if (!canInsert(size, pinned)) {
+            return false;
+        }
+        while (used + size > tableCapacity) {
+            evictOldest();
+        }
+        if (inserted - dropped == ring.size()) {
+            grow();
+        }
+        slot(inserted++) = { std::move(name), std::move(value) };
+        used += size;
+        return true;
+    }
+
+    // nullptr if the entry was never inserted or has been evicted
+    const Entry* get(uint64_t absolute) const {
+        return (absolute >= dropped && absolute < inserted) ? &slot(absolute) : nullptr;
+    }
+
+    // Newest live entry below before with this name, and this value unless it is nullopt
+    std::optional<uint64_t> find(std::string_view name, std::optional<std::string_view> value, uint64_t before) const {
+        for (uint64_t i = std::min(before, inserted); i > dropped; --i) {
+            const Entry& entry = slot(i - 1);
+            if (entry.name == name && (!value || entry.value == *value)) {
+                return i - 1;
+            }
+        }
+        return std::nullopt;
+    }
+};
+
+// Encodes field sections (RFC 9204 section 4.5). Until the peer advertises a dynamic table
+// only the static table and literals are used, so every section has a zero Required Insert
+// Count. With a dynamic table, headers are also inserted over the encoder stream, and later
+// sections reference them once the decoder has acknowledged the insert - a section never
+// refers to an entry the decoder might not have yet, so it can never block the peer.
+class QpackEncoder {
+public:
+    // Dynamic table capacity used when the peer allows at least this much
+    static constexpr uint64_t DEFAULT_TABLE_CAPACITY = 4096;
+
+private:
+    // The section prefix depends on the entries referenced, so it is written last into room
+    // kept in front of the field lines: two integers of at most ten bytes each
+    static constexpr size_t PREFIX_SPACE = 20;
+
+    // Sections with dynamic references the decoder has not acknowledged yet
+    struct OutstandingSection {
+        uint64_t requiredInsertCount = 0;
+        uint64_t minReference = 0;  // Oldest entry referenced; pinned against eviction
+    };
+
+    std::vector<uint8_t> buffer = std::vector<uint8_t>(PREFIX_SPACE);
+    size_t prefixOffset = PREFIX_SPACE - 2;  // Zero-filled: Required Insert Count 0, Delta Base 0
+
+    QpackDynamicTable table;
+    uint64_t knownReceivedCount = 0;  // Inserts the decoder has acknowledged
+    std::vector<uint8_t> encoderStream;
+    std::vector<uint8_t> decoderStreamBuffer;
+    std::unordered_map<uint64_t, std::deque<OutstandingSection>> outstanding;
+
+    // Section being encoded
+    std::optional<uint64_t> sectionStream;
+    bool sectionRecorded = false;
+    uint64_t sectionBase = 0;
+    uint64_t requiredInsertCount = 0;
+    uint64_t minReference = QpackDynamicTable::NO_PIN;
+
+    void encodeInteger(uint64_t value, uint8_t prefix_bits, uint8_t prefix_pattern = 0) {
+        QpackInteger::encode(buffer, value, prefix_bits, prefix_pattern);
+    }
+
+    // String literal with its Huffman flag just above an N-bit length prefix. Huffman coding
+    // is used only when it is strictly shorter than the raw bytes.
+    static void encodeString(std::vector<uint8_t>& out, std::string_view str, uint8_t prefixBits = 7, uint8_t prefixPattern = 0x00) {
+        size_t huffmanLength = QpackHuffman::encodedLength(str);
+        if (huffmanLength < str.length()) {
+            QpackInteger::encode(out, huffmanLength, prefixBits, static_cast<uint8_t>(prefixPattern | (1u << prefixBits)));
+            size_t offset = out.size();
+            out.resize(offset + huffmanLength);
+            QpackHuffman::encode(str, std::span<uint8_t>(out).subspan(offset));
+        }
+        else {
+            QpackInteger::encode(out, str.length(), prefixBits, prefixPattern);
+            out.insert(out.end(), str.begin(), str.end());
+        }
+    }
+
+    // Lowest absolute index some unacknowledged section still references
+    uint64_t pinnedIndex() const {
+        uint64_t pinned = minReference;
+        for (const auto& [stream, sections] : outstanding) {
+            for (const auto& section : sections) {
+                pinned = std::min(pinned, section.minReference);
+            }
+        }
+        return pinned;
+    }
+
+    // Records a dynamic reference from the current section and rewrites its prefix
+    void reference(uint64_t absolute) {
+        minReference = std::min(minReference, absolute);
+        if (absolute >= requiredInsertCount) {
+            requiredInsertCount = absolute + 1;
+
+            // Encoded Required Insert Count (RFC 9204 section 4.5.1.1); Base never falls below it
+            std::vector<uint8_t> prefix;
+            QpackInteger::encode(prefix, requiredInsertCount % (2 * table.maxEntries()) + 1, 8);
+            QpackInteger::encode(prefix, sectionBase - requiredInsertCount, 7);
+            prefixOffset = PREFIX_SPACE - prefix.size();
+            std::copy(prefix.begin(), prefix.end(), buffer.begin() + prefixOffset);
+        }
+
+        auto& sections = outstanding[*sectionStream];
+        if (!sectionRecorded) {
+            sections.emplace_back();
+            sectionRecorded = true;
+        }
+        sections.back() = { requiredInsertCount, minReference };
+    }
+
+    // Inserts the field over the encoder stream so later sections can reference it
+    void insertEntry(std::string_view name, std::string_view value, int staticNameIndex) {
+        if (table.find(name, value, table.insertCount()) ||
+            !table.insert(std::string(name), std::string(value), pinnedIndex())) {
+            return;
+        }
+
+        if (staticNameIndex >= 0) {
+            // 11xxxxxx - Insert with static Name Reference
+            QpackInteger::encode(encoderStream, staticNameIndex, 6, 0xC0);
+        }
+        else {
+            // 01Hxxxxx - Insert with Literal Name
+            encodeString(encoderStream, name, 5, 0x40);
+        }
+        encodeString(encoderStream, value);
+    }
+
+    bool acknowledgeSection(uint64_t streamId) {
+        auto it = outstanding.find(streamId);
+        if (it == outstanding.end() || it->second.empty()) {
+            return false;
+        }
+        knownReceivedCount = std::max(knownReceivedCount, it->second.front().requiredInsertCount);
+        it->second.pop_front();
+        if (it->second.empty()) {
+            outstanding.erase(it);
+        }
+        return true;
+    }
+
+public:
+    // Starts a section that is not tied to a stream; it uses no dynamic references
+    void clear() {
+        buffer.assign(PREFIX_SPACE, 0);
+        prefixOffset = PREFIX_SPACE - 2;
+        sectionStream.reset();
+        sectionRecorded = false;
+        sectionBase = knownReceivedCount;
+        requiredInsertCount = 0;
+        minReference = QpackDynamicTable::NO_PIN;
+    }
+
+    // Starts the section for a request stream. Dynamic references stay pinned until the
+    // decoder acknowledges the section, so every section begun here must be sent.
+    void beginSection(uint64_t streamId) {
+        clear();
+        sectionStream = streamId;
+    }
+
+    // The peer's SETTINGS_QPACK_MAX_TABLE_CAPACITY; zero keeps the encoder static-only
+    void setPeerMaxTableCapacity(uint64_t maxCapacity) {
+        if (maxCapacity == 0 || table.maxCapacity() != 0) {
+            return;
+        }
+        table.setMaxCapacity(maxCapacity);
+
+        // 001xxxxx - Set Dynamic Table Capacity
+        uint64_t capacity = std::min(maxCapacity, DEFAULT_TABLE_CAPACITY);
+        table.setCapacity(capacity);
+        QpackInteger::encode(encoderStream, capacity, 5, 0x20);
+    }
+
+    void encodeHeader(std::string_view name, std::string_view value) {
+        auto [exact_match, name_match] = QPACK_STATIC_INDEX.match(name, value);
+        if (exact_match >= 0) {
+            // Indexed field line, static table
+            encodeInteger(exact_match, 6, 0xC0);  // 11xxxxxx pattern
+            return;
+        }
+
+        if (table.capacity() > 0) {
+            if (sectionStream) {
+                // Only entries below Base are acknowledged, so the reference cannot block
+                if (auto index = table.find(name, value, sectionBase)) {
+                    reference(*index);
+                    encodeInteger(sectionBase - 1 - *index, 6, 0x80);  // 10xxxxxx pattern
+                    return;
+                }
+            }
+            insertEntry(name, value, name_match);
+        }
+
+        if (name_match >= 0) {
+            // Literal field line with static name reference
+            encodeInteger(name_match, 4, 0x50);  // 0101xxxx pattern
+            encodeString(buffer, value);
+            return;
+        }
+
+        std::optional<uint64_t> dynamic_name;
+        if (sectionStream && table.capacity() > 0) {
+            dynamic_name = table.find(name, std::nullopt, sectionBase);
+        }
+
+        if (dynamic_name) {
+            // Literal field line with dynamic name reference
+            reference(*dynamic_name);
+            encodeInteger(sectionBase - 1 - *dynamic_name, 4, 0x40);  // 0100xxxx pattern
+            encodeString(buffer, value);
+        }
+        else {
+            // Literal field line with literal name
+            encodeString(buffer, name, 3, 0x20);  // 001NHxxx pattern, 3-bit name length
+            encodeString(buffer, value);
+        }
+    }
+
+    std::vector<uint8_t> getEncoded() const { return { buffer.begin() + prefixOffset, buffer.end() }; }
+
+    // The encoded block without copying it; valid until the next encodeHeader() or clear()
+    std::span<const uint8_t> encoded() const { return std::span<const uint8_t>(buffer).subspan(prefixOffset); }
+
+    // Instructions for our encoder stream (type 0x02) not yet cleared. Copy them into the
+    // send, then clearEncoderStreamData(); the buffer keeps its capacity for the next ones.
+    std::span<const uint8_t> pendingEncoderStreamData() const { return encoderStream; }
+    void clearEncoderStreamData() { encoderStream.clear(); }
+
+    // Owning form of the two above, for callers that do not mind the allocation
+    std::vector<uint8_t> takeEncoderStreamData() {
+        std::vector<uint8_t> data(encoderStream.begin(), encoderStream.end());
+        encoderStream.clear();
+        return data;
+    }
+
+    // Applies the peer's decoder stream (RFC 9204 section 4.4). Instructions may be split
+    // across calls. False means QPACK_DECODER_STREAM_ERROR.
+    bool processDecoderStream(std::span<const uint8_t> chunk) {
+        decoderStreamBuffer.insert(decoderStreamBuffer.end(), chunk.begin(), chunk.end());
+        std::span<const uint8_t> pending(decoderStreamBuffer);
+
+        size_t position = 0;
+        size_t consumed = 0;
+        bool ok = true;
+        while (ok && position < pending.size()) {
+            uint8_t firstByte = pending[position];
+            bool truncated = false;
+
+            if ((firstByte & 0x80) != 0) {
+                // 1xxxxxxx - Section Acknowledgment
+                auto streamId = QpackInteger::decode(pending, position, 7, truncated);
+                ok = streamId ? acknowledgeSection(*streamId) : truncated;
+            }
+            else if ((firstByte & 0x40) != 0) {
+                // 01xxxxxx - Stream Cancellation
+                auto streamId = QpackInteger::decode(pending, position, 6, truncated);
+                if (streamId) {
+                    outstanding.erase(*streamId);
+                }
+                ok = streamId || truncated;
+            }
+            else {
+                // 00xxxxxx - Insert Count Increment
+                auto increment = QpackInteger::decode(pending, position, 6, truncated);
+                ok = increment ? (*increment != 0 && *increment <= table.insertCount() - knownReceivedCount) : truncated;
+                if (increment && ok) {
+                    knownReceivedCount += *increment;
+                }
+            }
+
+            if (!ok || truncated) break;
+            consumed = position;
+        }
+
+        decoderStreamBuffer.erase(decoderStreamBuffer.begin(), decoderStreamBuffer.begin() + consumed);
+        return ok;
+    }
+
+    const QpackDynamicTable& dynamicTable() const { return table; }
+};
+
+// Bump allocator for decoded strings that exist nowhere else - Huffman-coded literals. The
+// inline block covers typical requests; bigger sections spill into heap blocks that reset()
+// keeps, so a reused arena stops allocating once it has warmed up.
+class QpackArena {
+public:
+    static constexpr size_t INLINE_SIZE = 1024;
+    static constexpr size_t MIN_BLOCK_SIZE = 4096;
+
+    // Storage that stays put until reset()
+    std::span<char> allocate(size_t size) {
+        while (true) {
+            std::span<char> current = (block == 0) ? std::span<char>(inlineBlock) : std::span<char>(overflow[block - 1]);
+            if (current.size() - used >= size) {
+                used += size;
+                return current.subspan(used - size, size);
+            }
+
+            ++block;
+            used = 0;
+            if (block > overflow.size()) {
+                overflow.emplace_back(std::max(size, MIN_BLOCK_SIZE));
+            }
+            else if (overflow[block - 1].size() < size) {
+                overflow[block - 1] = std::vector<char>(size);  // Not in use since the last reset()
+            }
+        }
+    }
+
+    // Hands back the tail of the most recent allocation beyond its first keep chars
+    void shrinkLast(std::span<char> allocation, size_t keep) { used -= allocation.size() - keep; }
+
+    void reset() {
+        block = 0;
+        used = 0;
+    }
+
+private:
+    std::array<char, INLINE_SIZE> inlineBlock;
+    std::vector<std::vector<char>> overflow;
+    size_t block = 0;   // 0 is inlineBlock, n is overflow[n - 1]
+    size_t used = 0;
+};
+
+// QPACK decoder for field sections plus the peer's encoder stream. The dynamic table is
+// only used after setMaxTableCapacity() with the capacity we advertised in SETTINGS.
+// Sections that reference inserts still in flight on the encoder stream are parked, up to
+// the SETTINGS_QPACK_BLOCKED_STREAMS we advertised, and decoded once the inserts arrive.
+class QpackDecoder {
+public:
+    struct Header {
+        std::string name;
+        std::string value;
+    };
+
+    // Header that points at its bytes instead of owning them; see the arena decodeHeaders()
+    struct HeaderView {
+        std::string_view name;
+        std::string_view value;
+    };
+
+    // Where a field line took its name from, handed to decodeHeaders() visitors so they can
+    // recognize well-known fields by static index instead of comparing strings
+    struct FieldRef {
+        int staticIndex = -1;      // Static table entry that supplied the name, or -1
+        bool staticValue = false;  // The value is that entry's value as well
+    };
+
+    enum class Status {
+        Ok,
+        Blocked,    // Parked until the encoder stream catches up; see takeUnblockedSections()
+        Rejected,   // A visitor stopped decoding; the section itself was well formed so far
+        TooLarge,   // Over setMaxFieldSectionSize(); answer 431 (RFC 9114 section 4.2.2)
+        Error
+    };
+
+    // Sections one stream may have parked at a time: a message has a header section and
+    // at most a trailer section that can arrive before the first is decoded. Each parked
+    // section is a copy of its HEADERS payload, so this bounds what one stream can hold.
+    static constexpr uint32_t MAX_PARKED_SECTIONS = 2;
+
+    // A parked section that processEncoderStream() has since decoded
+    struct UnblockedSection {
+        uint64_t streamId = 0;
+        Status status = Status::Error;
+        std::vector<Header> headers;
+    };
+
+private:
+    struct BlockedSection {
+        uint64_t streamId = 0;
+        std::vector<uint8_t> block;
+    };
+
+    // What a stream has parked: how many sections, and the Required Insert Count the last
+    // one waits for
+    struct ParkedStream {
+        uint32_t sections = 0;
+        uint64_t insertCount = 0;
+    };
+
+    size_t position = 0;
+    std::span<const uint8_t> data;
+    bool truncated = false;
+    QpackArena* stringArena = nullptr;  // Where Huffman-coded literals are decoded to
+
+    // Field section size accounting (RFC 9114 section 4.2.2): what is left of the limit for
+    // the section being decoded, and whether a field line ran past it
+    uint64_t maxFieldSectionSize = std::numeric_limits<uint64_t>::max();
+    uint64_t sectionBudget = std::numeric_limits<uint64_t>::max();
+    bool oversized = false;
+
+    // Backs the owning decodeHeaders() overloads and the encoder stream
+    QpackArena scratch;
+    std::vector<HeaderView> scratchViews;
+
+    QpackDynamicTable table;
+    uint64_t knownReceivedCount = 0;           // Insert count the encoder has been told about
+    std::vector<uint8_t> encoderStreamBuffer;  // Unparsed tail of the peer's encoder stream
+    std::vector<uint8_t> decoderStream;        // Instructions waiting for our decoder stream
+
+    // Parked sections keyed by Required Insert Count, so the table reaching a count
+    // releases a prefix of the map
+    std::multimap<uint64_t, BlockedSection> blocked;
+    std::unordered_map<uint64_t, ParkedStream> parkedStreams;
+    uint64_t maxBlockedStreams = 0;
+    std::vector<UnblockedSection> unblocked;
+
+    // Decode QPACK integer with N-bit prefix
+    std::optional<uint64_t> decodeInteger(uint8_t prefixBits) {
+        return QpackInteger::decode(data, position, prefixBits, truncated);
+    }
+
+    // String literal whose Huffman flag sits just above an N-bit length prefix. Raw literals
+    // point into data; Huffman-coded ones are decoded into stringArena.
+    std::optional<std::string_view> decodeString(uint8_t prefixBits) {
+        if (position >= data.size()) {
+            truncated = true;
+            return std::nullopt;
+        }
+
+        bool huffman = (data[position] & (1u << prefixBits)) != 0;
+        auto length = decodeInteger(prefixBits);
+        if (!length || *length > data.size() - position) {
+            truncated = truncated || length.has_value();
+            return std::nullopt;
+        }
+
+        // Checked before anything is decoded or allocated: a Huffman code is at most 30 bits,
+        // so a literal of n bytes decodes to at least 8n/30 characters
+        uint64_t minimumLength = huffman ? *length * 8 / 30 : *length;
+        if (minimumLength > sectionBudget) {
+            oversized = true;
+            return std::nullopt;
+        }
+
+        auto encoded = data.subspan(position, static_cast<size_t>(*length));
+        position += encoded.size();
+
+        if (!huffman) {
+            return std::string_view(reinterpret_cast<const char*>(encoded.data()), encoded.size());
+        }
+
+        auto storage = stringArena->allocate(QpackHuffman::maxDecodedLength(encoded.size()));
+        auto decoded = QpackHuffman::decode(encoded, storage);
+        if (!decoded) {
+            HTTP3_LOG_ERROR("  [ERROR] Invalid Huffman-coded string");
+            return std::nullopt;
+        }
+        stringArena->shrinkLast(storage, *decoded);
+        return std::string_view(storage.data(), *decoded);
+    }
+
+    static void copyHeaders(const std::vector<HeaderView>& views, std::vector<Header>& headers) {
+        headers.clear();
+        for (const auto& view : views) {
+            headers.push_back({ std::string(view.name), std::string(view.value) });
+        }
+    }
+
+    // Relative index on the encoder stream counts back from the newest entry
+    const QpackDynamicTable::Entry* relativeEntry(uint64_t relative) const {
+        return relative < table.insertCount() ? table.get(table.insertCount() - 1 - relative) : nullptr;
+    }
+
+    // One encoder stream instruction (RFC 9204 section 4.3). On failure truncated tells an
+    // incomplete instruction apart from a malformed one.
+    bool applyEncoderInstruction() {
+        uint8_t firstByte = data[position];
+
+        if ((firstByte & 0x80) != 0) {
+            // 1Txxxxxx - Insert with Name Reference
+            bool isStatic = (firstByte & 0x40) != 0;
+            auto index = decodeInteger(6);
+            auto value = index ? decodeString(7) : std::nullopt;
+            if (!value) return false;
+
+            const QpackDynamicTable::Entry* entry = isStatic ? nullptr : relativeEntry(*index);
+            if (isStatic ? *index >= QPACK_STATIC_TABLE.size() : entry == nullptr) {
+                HTTP3_LOG_ERROR("  [ERROR] Invalid name reference in encoder stream");
+                return false;
+            }
+
+            std::string name(isStatic ? QPACK_STATIC_TABLE[*index].name : std::string_view(entry->name));
+            HTTP3_LOG_TRACE("  [INSERT] Dynamic[{}]: {}={}", table.insertCount(), name, *value);
+            return insert(std::move(name), std::string(*value));
+        }
+        else if ((firstByte & 0x40) != 0) {
+            // 01Hxxxxx - Insert with Literal Name
+            auto name = decodeString(5);
+            auto value = name ? decodeString(7) : std::nullopt;
+            if (!value) return false;
+
+            HTTP3_LOG_TRACE("  [INSERT] Dynamic[{}]: {}={}", table.insertCount(), *name, *value);
+            return insert(std::string(*name), std::string(*value));
+        }
+        else if ((firstByte & 0x20) != 0) {
+            // 001xxxxx - Set Dynamic Table Capacity
+            auto capacity = decodeInteger(5);
+            if (!capacity) return false;
+
+            if (!table.setCapacity(*capacity)) {
+                HTTP3_LOG_ERROR("  [ERROR] Dynamic table capacity {} exceeds {}", *capacity, table.maxCapacity());
+                return false;
+            }
+            HTTP3_LOG_DEBUG("  [CAPACITY] Dynamic table capacity {}", *capacity);
+            return true;
+        }
+        else {
+            // 000xxxxx - Duplicate
+            auto index = decodeInteger(5);
+            if (!index) return false;
+
+            const QpackDynamicTable::Entry* entry = relativeEntry(*index);
+            if (entry == nullptr) {
+                HTTP3_LOG_ERROR("  [ERROR] Invalid duplicate index in encoder stream");
+                return false;
+            }
+            HTTP3_LOG_TRACE("  [DUPLICATE] Dynamic[{}]: {}", table.insertCount(), entry->name);
+            QpackDynamicTable::Entry copy = *entry;
+            return insert(std::move(copy.name), std::move(copy.value));
+        }
+    }
+
+    bool insert(std::string name, std::string value) {
+        if (!table.insert(std::move(name), std::move(value))) {
+            HTTP3_LOG_ERROR("  [ERROR] Entry does not fit the dynamic table");
+            return false;
+        }
+        return true;
+    }
+
+    // Required Insert Count from its encoded form (RFC 9204 section 4.5.1.1)
+    std::optional<uint64_t> decodeRequiredInsertCount(uint64_t encoded) const {
+        if (encoded == 0) return 0;
+
+        uint64_t maxEntries = table.maxEntries();
+        uint64_t fullRange = 2 * maxEntries;
+        if (encoded > fullRange) return std::nullopt;
+
+        uint64_t maxValue = table.insertCount() + maxEntries;
+        uint64_t maxWrapped = (maxValue / fullRange) * fullRange;
+        uint64_t requiredInsertCount = maxWrapped + encoded - 1;
+
+        if (requiredInsertCount > maxValue) {
+            if (requiredInsertCount <= fullRange) return std::nullopt;
+            requiredInsertCount -= fullRange;
+        }
+        if (requiredInsertCount == 0) return std::nullopt;
+        return requiredInsertCount;
+    }
+
+    // Dynamic entry a field line refers to; it must lie below the section's Required Insert Count
+    const QpackDynamicTable::Entry* sectionEntry(uint64_t absolute, uint64_t requiredInsertCount) const {
+        return absolute < requiredInsertCount ? table.get(absolute) : nullptr;
+    }
+
+    // Charges a field line against the section budget; entry overhead as in the dynamic table
+    bool chargeFieldLine(const HeaderView& header) {
+        uint64_t size = header.name.size() + header.value.size() + QpackDynamicTable::ENTRY_OVERHEAD;
+        if (size > sectionBudget) {
+            oversized = true;
+            return false;
+        }
+        sectionBudget -= size;
+        return true;
+    }
+
+    // Field section prefix at the start of data: Required Insert Count, then a signed Delta Base
+    bool decodePrefix(uint64_t& requiredInsertCount, uint64_t& base) {
+        auto encodedInsertCount = decodeInteger(8);
+        bool negativeBase = position < data.size() && (data[position] & 0x80) != 0;
+        auto deltaBase = decodeInteger(7);
+        if (!encodedInsertCount || !deltaBase) {
+            HTTP3_LOG_ERROR("  [ERROR] Truncated field section prefix");
+            return false;
+        }
+
+        auto insertCount = decodeRequiredInsertCount(*encodedInsertCount);
+        if (!insertCount || (negativeBase && *deltaBase >= *insertCount)) {
+            HTTP3_LOG_ERROR("  [ERROR] Invalid field section prefix");
+            return false;
+        }
+        requiredInsertCount = *insertCount;
+        base = negativeBase ? requiredInsertCount - *deltaBase - 1 : requiredInsertCount + *deltaBase;
+        return true;
+    }
+
+    // Hands each field line to visit(header, ref) as soon as it is decoded
+    template <typename Visitor>
+    Status decodeSection(std::span<const uint8_t> qpackData, QpackArena& arena, Visitor& visit, uint64_t& requiredInsertCount) {
+        data = qpackData;
+        position = 0;
+        stringArena = &arena;
+        sectionBudget = maxFieldSectionSize;
+        oversized = false;
+
+        uint64_t base = 0;
+        if (!decodePrefix(requiredInsertCount, base)) {
+            return Status::Error;
+        }
+        if (requiredInsertCount > table.insertCount()) {
+            HTTP3_LOG_DEBUG("  [BLOCKED] Section needs insert count {}, have {}", requiredInsertCount, table.insertCount());
+            return Status::Blocked;
+        }
+
+        while (position < data.size()) {
+            uint8_t firstByte = data[position];
+            HeaderView header;
+            FieldRef ref;
+
+            if ((firstByte & 0x80) != 0) {
+                // 1Txxxxxx - Indexed Field Line
+                bool isStatic = (firstByte & 0x40) != 0;
+                auto index = decodeInteger(6);
+                if (isStatic) {
+                    if (!index || *index >= QPACK_STATIC_TABLE.size()) {
+                        HTTP3_LOG_ERROR("  [ERROR] Invalid static table index");
+                        return sectionError();
+                    }
+
+                    header.name = QPACK_STATIC_TABLE[*index].name;
+                    header.value = QPACK_STATIC_TABLE[*index].value;
+                    ref = { static_cast<int>(*index), true };
+
+                    if (header.value.empty()) {
+                        HTTP3_LOG_TRACE("  [INDEXED] Static[{}]: {}", *index, header.name);
+                    }
+                    else {
+                        HTTP3_LOG_TRACE("  [INDEXED] Static[{}]: {}={}", *index, header.name, header.value);
+                    }
+                }
+                else {
+                    uint64_t absolute = 0;
+                    const QpackDynamicTable::Entry* entry = nullptr;
+                    if (index && *index < base) {
+                        absolute = base - 1 - *index;
+                        entry = sectionEntry(absolute, requiredInsertCount);
+                    }
+                    if (!entry) {
+                        HTTP3_LOG_ERROR("  [ERROR] Invalid dynamic table index");
+                        return sectionError();
+                    }
+
+                    header.name = entry->name;
+                    header.value = entry->value;
+
+                    HTTP3_LOG_TRACE("  [INDEXED] Dynamic[{}]: {}={}", absolute, header.name, header.value);
+                }
+
+            }
+            else if ((firstByte & 0x40) != 0) {
+                // 01NTxxxx - Literal Field Line with Name Reference
+                bool isStatic = (firstByte & 0x10) != 0;
+                auto nameIndex = decodeInteger(4);
+                uint64_t absolute = 0;
+                const QpackDynamicTable::Entry* entry = nullptr;
+                if (!isStatic && nameIndex && *nameIndex < base) {
+                    absolute = base - 1 - *nameIndex;
+                    entry = sectionEntry(absolute, requiredInsertCount);
+                }
+                if (!nameIndex || (isStatic ? *nameIndex >= QPACK_STATIC_TABLE.size() : entry == nullptr)) {
+                    HTTP3_LOG_ERROR("  [ERROR] Invalid name index");
+                    return sectionError();
+                }
+
+                auto value = decodeString(7);
+                if (!value) {
+                    HTTP3_LOG_ERROR("  [ERROR] Failed to decode header value");
+                    return sectionError();
+                }
+
+                header.name = isStatic ? QPACK_STATIC_TABLE[*nameIndex].name : std::string_view(entry->name);
+                header.value = *value;
+                if (isStatic) {
+                    ref.staticIndex = static_cast<int>(*nameIndex);
+                }
+
+                HTTP3_LOG_TRACE("  [LITERAL_INDEXED_NAME] {}[{}]: {}={}", isStatic ? "Static" : "Dynamic",
+                    isStatic ? *nameIndex : absolute, header.name, header.value);
+
+            }
+            else if ((firstByte & 0x20) != 0) {
+                // 001NHxxx - Literal Field Line with Literal Name
+                auto name = decodeString(3);
+                if (!name) {
+                    HTTP3_LOG_ERROR("  [ERROR] Failed to decode header name");
+                    return sectionError();
+                }
+
+                auto value = decodeString(7);
+                if (!value) {
+                    HTTP3_LOG_ERROR("  [ERROR] Failed to decode header value");
+                    return sectionError();
+                }
+
+                header.name = *name;
+                header.value = *value;
+
+                HTTP3_LOG_TRACE("  [LITERAL_LITERAL] {}={}", header.name, header.value);
+
+            }
+            else if ((firstByte & 0x10) != 0) {
+                // 0001xxxx - Indexed Field Line with Post-Base Index
+                auto index = decodeInteger(4);
+                uint64_t absolute = index ? base + *index : 0;
+                const auto* entry = index ? sectionEntry(absolute, requiredInsertCount) : nullptr;
+                if (!entry) {
+                    HTTP3_LOG_ERROR("  [ERROR] Invalid post-base index");
+                    return sectionError();
+                }
+
+                header.name = entry->name;
+                header.value = entry->value;
+
+                HTTP3_LOG_TRACE("  [INDEXED] Dynamic[{}]: {}={}", absolute, header.name, header.value);
+
+            }
+            else {
+                // 0000Nxxx - Literal Field Line with Post-Base Name Reference
+                auto nameIndex = decodeInteger(3);
+                uint64_t absolute = nameIndex ? base + *nameIndex : 0;
+                const auto* entry = nameIndex ? sectionEntry(absolute, requiredInsertCount) : nullptr;
+                if (!entry) {
+                    HTTP3_LOG_ERROR("  [ERROR] Invalid post-base name index");
+                    return sectionError();
+                }
+
+                auto value = decodeString(7);
+                if (!value) {
+                    HTTP3_LOG_ERROR("  [ERROR] Failed to decode header value");
+                    return sectionError();
+                }
+
+                header.name = entry->name;
+                header.value = *value;
+
+                HTTP3_LOG_TRACE("  [LITERAL_INDEXED_NAME] Dynamic[{}]: {}={}", absolute, header.name, header.value);
+            }
+
+            if (!chargeFieldLine(header)) {
+                return sectionError();
+            }
+            if (!visit(header, ref)) {
+                return Status::Rejected;
+            }
+        }
+
+        return Status::Ok;
+    }
+
+    Status sectionError() const {
+        if (oversized) {
+            HTTP3_LOG_ERROR("  [ERROR] Field section exceeds {} bytes", maxFieldSectionSize);
+            return Status::TooLarge;
+        }
+        return Status::Error;
+    }
+
+    // Visitor that collects the field lines for the vector forms of decodeHeaders()
+    struct Collect {
+        std::vector<HeaderView>& headers;
+        bool operator()(const HeaderView& header, FieldRef) {
+            headers.push_back(header);
+            return true;
+        }
+    };
+
+    // Decodes a section of a request stream and queues its Section Acknowledgment. A section
+    // rejected by a visitor or the size limit is acknowledged too: everything it references
+    // has been received.
+    template <typename Visitor>
+    Status decodeAndAcknowledge(uint64_t streamId, std::span<const uint8_t> qpackData, QpackArena& arena, Visitor& visit, uint64_t& requiredInsertCount) {
+        Status status = decodeSection(qpackData, arena, visit, requiredInsertCount);
+        if (status != Status::Error && status != Status::Blocked && requiredInsertCount > 0) {
+            QpackInteger::encode(decoderStream, streamId, 7, 0x80);  // 1xxxxxxx Section Acknowledgment
+            knownReceivedCount = std::max(knownReceivedCount, requiredInsertCount);
+        }
+        return status;
+    }
+
+    // Decodes every parked section the table can now satisfy, oldest Required Insert Count first
+    void resumeUnblocked() {
+        while (!blocked.empty() && blocked.begin()->first <= table.insertCount()) {
+            auto node = blocked.extract(blocked.begin());
+            UnblockedSection section;
+            section.streamId = node.mapped().streamId;
+            auto parked = parkedStreams.find(section.streamId);
+            if (--parked->second.sections == 0) {
+                parkedStreams.erase(parked);
+            }
+            uint64_t requiredInsertCount = 0;
+            HTTP3_LOG_DEBUG("  [UNBLOCKED] Stream {} at insert count {}", section.streamId, table.insertCount());
+            scratch.reset();
+            scratchViews.clear();
+            Collect collect{ scratchViews };
+            section.status = decodeAndAcknowledge(section.streamId, node.mapped().block, scratch, collect, requiredInsertCount);
+            copyHeaders(scratchViews, section.headers);
+            unblocked.push_back(std::move(section));
+        }
+    }
+
+public:
+    // The SETTINGS_QPACK_MAX_TABLE_CAPACITY we advertised; zero rejects all dynamic references
+    void setMaxTableCapacity(uint64_t maxCapacity) { table.setMaxCapacity(maxCapacity); }
+
+    // The SETTINGS_QPACK_BLOCKED_STREAMS we advertised
+    void setMaxBlockedStreams(uint64_t maxStreams) { maxBlockedStreams = maxStreams; }
+
+    // The SETTINGS_MAX_FIELD_SECTION_SIZE we advertised. Sections are measured as they are
+    // decoded - name, value and 32 bytes per field line - and abandoned with
+    // Status::TooLarge before the literal that would overrun the limit is decoded.
+    void setMaxFieldSectionSize(uint64_t maxSize) { maxFieldSectionSize = maxSize; }
+
+    // Decodes a section without acknowledging it; a section that would block fails
+    bool decodeHeaders(std::span<const uint8_t> qpackData, std::vector<Header>& headers) {
+        scratch.reset();
+        bool ok = decodeHeaders(qpackData, scratch, scratchViews);
+        copyHeaders(scratchViews, headers);
+        return ok;
+    }
+
+    // Allocation-free forms of decodeHeaders(). Names and values point into the static
+    // table, the dynamic table, qpackData or - for Huffman-coded literals - arena, so they
+    // are valid until arena is reset, qpackData is released or the encoder stream is next
+    // processed. With headers and arena reused across requests, a typical request does not
+    // touch the heap.
+    bool decodeHeaders(std::span<const uint8_t> qpackData, QpackArena& arena, std::vector<HeaderView>& headers) {
+        headers.clear();
+        Collect collect{ headers };
+        uint64_t requiredInsertCount = 0;
+        return decodeSection(qpackData, arena, collect, requiredInsertCount) == Status::Ok;
+    }
+
+    // Decodes the section of a request stream, queueing the Section Acknowledgment the
+    // encoder needs before it can evict or rely on the entries the section used. A section
+    // ahead of the dynamic table is copied and parked (Status::Blocked); exceeding the
+    // blocked-streams limit, or MAX_PARKED_SECTIONS for one stream, is
+    // QPACK_DECOMPRESSION_FAILED (Status::Error).
+    Status decodeHeaders(uint64_t streamId, std::span<const uint8_t> qpackData, std::vector<Header>& headers) {
+        scratch.reset();
+        Status status = decodeHeaders(streamId, qpackData, scratch, scratchViews);
+        copyHeaders(scratchViews, headers);
+        return status;
+    }
+
+    Status decodeHeaders(uint64_t streamId, std::span<const uint8_t> qpackData, QpackArena& arena, std::vector<HeaderView>& headers) {
+        headers.clear();
+        Status status = decodeHeaders(streamId, qpackData, arena, Collect{ headers });
+        if (status == Status::Blocked) {
+            headers.clear();
+        }
+        return status;
+    }
+
+    // Single-pass form: each field line goes to visitor(const HeaderView&, FieldRef) as soon
+    // as it is decoded, with the lifetimes of the arena form. Returning false stops decoding
+    // and yields Status::Rejected. A parked section comes back through
+    // takeUnblockedSections() as owning headers, without FieldRefs.
+    template <typename Visitor>
+    Status decodeHeaders(uint64_t streamId, std::span<const uint8_t> qpackData, QpackArena& arena, Visitor&& visitor) {
+        // A later section of a stream that is already parked waits behind the earlier one, and
+        // for its own Required Insert Count, which may be the higher of the two
+        auto parked = parkedStreams.find(streamId);
+        bool earlier = parked != parkedStreams.end();
+        uint64_t requiredInsertCount = 0;
+        if (earlier) {
+            if (parked->second.sections >= MAX_PARKED_SECTIONS) {
+                HTTP3_LOG_ERROR("  [ERROR] Stream {} has {} sections blocked already", streamId, parked->second.sections);
+                return Status::Error;
+            }
+            data = qpackData;
+            position = 0;
+            uint64_t base = 0;
+            if (!decodePrefix(requiredInsertCount, base)) {
+                return Status::Error;
+            }
+        }
+        Status status = earlier ? Status::Blocked : decodeAndAcknowledge(streamId, qpackData, arena, visitor, requiredInsertCount);
+        if (status != Status::Blocked) {
+            return status;
+        }
+
+        if (!earlier && parkedStreams.size() >= maxBlockedStreams) {
+            HTTP3_LOG_ERROR("  [ERROR] More than {} blocked streams", maxBlockedStreams);
+            return Status::Error;
+        }
+        ParkedStream& stream = parkedStreams[streamId];
+        stream.insertCount = std::max(requiredInsertCount, stream.insertCount);
+        ++stream.sections;
+        blocked.emplace(stream.insertCount,
+            BlockedSection{ streamId, std::vector<uint8_t>(qpackData.begin(), qpackData.end()) });
+        return Status::Blocked;
+    }
+
+    bool hasBlockedSections(uint64_t streamId) const { return parkedStreams.contains(streamId); }
+
+    // Drops whatever is parked for a stream that was reset or abandoned, and tells the
+    // encoder so it stops pinning the entries the stream's sections reference
+    void cancelStream(uint64_t streamId) {
+        if (parkedStreams.erase(streamId) > 0) {
+            std::erase_if(blocked, [&](const auto& parked) { return parked.second.streamId == streamId; });
+        }
+        if (table.maxCapacity() > 0) {
+            QpackInteger::encode(decoderStream, streamId, 6, 0x40);  // 01xxxxxx Stream Cancellation
+        }
+    }
+
+    // Sections released by processEncoderStream() since the last call, in decoding order
+    std::vector<UnblockedSection> takeUnblockedSections() {
+        std::vector<UnblockedSection> out;
+        out.swap(unblocked);
+        return out;
+    }
+
+    // Applies the peer's encoder stream (type 0x02). Instructions may be split across calls;
+    // the unparsed tail waits for the rest. False means QPACK_ENCODER_STREAM_ERROR.
+    bool processEncoderStream(std::span<const uint8_t> chunk) {
+        encoderStreamBuffer.insert(encoderStreamBuffer.end(), chunk.begin(), chunk.end());
+        data = encoderStreamBuffer;
+        position = 0;
+        stringArena = &scratch;
+        sectionBudget = std::numeric_limits<uint64_t>::max();  // Bounded by the table capacity instead
+
+        size_t consumed = 0;
+        bool ok = true;
+        while (position < data.size()) {
+            truncated = false;
+            scratch.reset();
+            if (!applyEncoderInstruction()) {
+                ok = truncated;
+                break;
+            }
+            consumed = position;
+        }
+        encoderStreamBuffer.erase(encoderStreamBuffer.begin(), encoderStreamBuffer.begin() + consumed);
+
+        // A pending instruction never needs more than one entry plus its integer prefixes
+        if (encoderStreamBuffer.size() > table.maxCapacity() + QpackDynamicTable::ENTRY_OVERHEAD) {
+            HTTP3_LOG_ERROR("  [ERROR] Encoder stream instruction larger than the dynamic table");
+            ok = false;
+        }
+
+        // Acknowledge inserts right away so the encoder may start referencing them
+        if (ok && table.insertCount() > knownReceivedCount) {
+            QpackInteger::encode(decoderStream, table.insertCount() - knownReceivedCount, 6);  // 00xxxxxx Insert Count Increment
+            knownReceivedCount = table.insertCount();
+            resumeUnblocked();
+        }
+        return ok;
+    }
+
+    // Instructions for our decoder stream (type 0x03) not yet cleared. Copy them into the
+    // send, then clearDecoderStreamData(); the buffer keeps its capacity for the next ones.
+    std::span<const uint8_t> pendingDecoderStreamData() const { return decoderStream; }
+    void clearDecoderStreamData() { decoderStream.clear(); }
+
+    // Owning form of the two above, for callers that do not mind the allocation
+    std::vector<uint8_t> takeDecoderStreamData() {
+        std::vector<uint8_t> out(decoderStream.begin(), decoderStream.end());
+        decoderStream.clear();
+        return out;
+    }
+
+    const QpackDynamicTable& dynamicTable() const { return table; }
+};
@@ -0,0 +1,178 @@
+// sendpool.h - Send buffers whose lifetime follows the transport's send completion
+// Shared by the client and the server; no MsQuic dependency.
+#pragma once
+#include "http3-codec/frame.h"
+#include "http3-codec/varint.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <span>
+#include <vector>
+
+template <typename BufferT>
+class Http3SendBufferPool;
+
+// The bytes of one send and the descriptor array handed to the transport. A send keeps
+// pointers to both until it completes - for MsQuic, until SEND_COMPLETE, canceled or not -
+// so neither may live on the caller's stack. Pass the buffer as the send's client context
+// and give it back to Http3SendBufferPool::release() on completion. The storage keeps its
+// capacity across reuse, so a warm pool sends without allocating.
+//
+// A send is a list of segments, gathered by the transport in order:
+// - writer() + commit(), or assign(): bytes copied into the buffer's own storage;
+// - appendHeader(): a few varints (frame type and length, stream type, WEBTRANSPORT_STREAM
+//   signal) encoded into a small fixed area;
+// - appendReference(): the caller's bytes, not copied. They must stay valid until the send
+//   completes.
+// appendFrame() combines the last two, so a large DATA frame costs a few header bytes
+// rather than a copy of its payload.
+template <typename BufferT = Http3Buffer>
+class Http3SendBuffer {
+public:
+    static constexpr size_t MAX_SEGMENTS = 8;
+    static constexpr size_t HEADER_SPACE = 64;
+
+    // Writer over at least `capacity` bytes of storage; finish with commit()
+    Http3FrameWriter writer(size_t capacity) {
+        if (storage.size() < capacity) {
+            storage.resize(capacity);
+        }
+        return Http3FrameWriter(storage);
+    }
+
+    // Storage holds a single segment; commit it once per send
+    bool commit(const Http3FrameWriter& writer) {
+        storageLength = writer.size();
+        return addSegment(storage.data(), storageLength);
+    }
+
+    // Copy bytes that were produced elsewhere
+    bool assign(std::span<const uint8_t> bytes) {
+        Http3FrameWriter out = writer(bytes.size());
+        out.writeBytes(bytes);
+        return commit(out);
+    }
+
+    bool appendHeader(std::initializer_list<uint64_t> varints) {
+        uint8_t* start = header.data() + headerLength;
+        size_t length = 0;
+        for (uint64_t value : varints) {
+            size_t used = Http3Varint::encode(value, std::span<uint8_t>(start + length, header.size() - headerLength - length));
+            if (used == 0) return false;
+            length += used;
+        }
+        if (!addSegment(start, length)) return false;
+        headerLength += length;
+        return true;
+    }
+
+    bool appendReference(std::span<const uint8_t> bytes) {
+        return bytes.empty() || addSegment(const_cast<uint8_t*>(bytes.data()), bytes.size());
+    }
+
+    bool appendFrame(uint64_t type, std::span<const uint8_t> payload) {
+        return appendHeader({ type, payload.size() }) && appendReference(payload);
+    }
+
+    // What writer() + commit() or assign() put into storage
+    std::span<const uint8_t> bytes() const { return { storage.data(), storageLength }; }
+
+    uint64_t totalLength() const {
+        uint64_t total = 0;
+        for (uint32_t i = 0; i < segmentCount; ++i) {
+            total += segments[i].Length;
+        }
+        return total;
+    }
+
+    // Descriptor array for the transport's send call
+    const BufferT* buffers() const { return segments.data(); }
+    uint32_t bufferCount() const { return segmentCount; }
+
+private:
+    friend class Http3SendBufferPool<BufferT>;
+
+    bool addSegment(uint8_t* data, size_t length) {
+        if (segmentCount == MAX_SEGMENTS || length > UINT32_MAX) return false;
+        segments[segmentCount].Buffer = data;
+        segments[segmentCount].Length = static_cast<uint32_t>(length);
+        ++segmentCount;
+        return true;
+    }
+
+    void reset() {
+        segmentCount = 0;
+        storageLength = 0;
+        headerLength = 0;
+    }
+
+    std::vector<uint8_t> storage;
+    size_t storageLength = 0;
+    std::array<uint8_t, HEADER_SPACE> header{};
+    size_t headerLength = 0;
+    std::array<BufferT, MAX_SEGMENTS> segments{};
+    uint32_t segmentCount = 0;
+    Http3SendBuffer* nextFree = nullptr;
+};
+
+// Free lists of send buffers, one per thread, so acquire() and release() never lock. MsQuic
+// completes a send on the worker that owns the connection; a buffer released on another
+// thread than the one that acquired it simply joins that thread's list.
+template <typename BufferT = Http3Buffer>
+class Http3SendBufferPool {
+public:
+    using Buffer = Http3SendBuffer<BufferT>;
+
+    // Buffers beyond this many per thread are freed rather than kept
+    static constexpr size_t MAX_FREE_PER_THREAD = 64;
+
+    static Buffer* acquire() {
+        FreeList& list = local();
+        Buffer* buffer = list.head;
+        if (buffer == nullptr) {
+            return new Buffer();
+        }
+        list.head = buffer->nextFree;
+        --list.count;
+        buffer->nextFree = nullptr;
+        buffer->reset();
+        return buffer;
+    }
+
+    // Accepts the client context of any completed send; sends without one pass nullptr
+    static void release(Buffer* buffer) {
+        if (buffer == nullptr) return;
+        FreeList& list = local();
+        if (list.count >= MAX_FREE_PER_THREAD) {
+            delete buffer;
+            return;
+        }
+        buffer->nextFree = list.head;
+        list.head = buffer;
+        ++list.count;
+    }
+
+    // Buffers waiting on this thread's list
+    static size_t freeCount() { return local().count; }
+
+private:
+    struct FreeList {
+        Buffer* head = nullptr;
+        size_t count = 0;
+
+        ~FreeList() {
+            while (head != nullptr) {
+                Buffer* next = head->nextFree;
+                delete head;
+                head = next;
+            }
+        }
+    };
+
+    static FreeList& local() {
+        static thread_local FreeList list;
+        return list;
+    }
+};
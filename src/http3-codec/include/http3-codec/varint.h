@@ -0,0 +1,145 @@
+// varint.h - QUIC / HTTP/3 variable-length integer codec (RFC 9000 section 16)
+// Shared by the client, the server and the codec benchmarks; no MsQuic dependency.
+#pragma once
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <stdlib.h>
+#endif
+
+class Http3Varint {
+public:
+    static constexpr uint64_t MAX_VALUE = (1ULL << 62) - 1;
+    static constexpr size_t MAX_LENGTH = 8;
+
+    // Encoded length (1, 2, 4 or 8) from the 2-bit prefix of the first byte
+    static constexpr size_t lengthFromFirstByte(uint8_t firstByte) {
+        return size_t{ 1 } << (firstByte >> 6);
+    }
+
+    static constexpr size_t encodedLength(uint64_t value) {
+        return size_t{ 1 } << LENGTH_CLASS[std::bit_width(value)];
+    }
+
+    // Decode the varint at the start of data. Returns the number of bytes consumed,
+    // or 0 if data is too short to hold the whole varint.
+    static size_t decode(std::span<const uint8_t> data, uint64_t& value) {
+        if (data.empty()) return 0;
+
+        uint8_t lengthClass = data[0] >> 6;
+        size_t length = size_t{ 1 } << lengthClass;
+
+        if (data.size() >= MAX_LENGTH) {
+            // Fast path: one unaligned 8-byte load, byte swap, then drop the bytes past the
+            // varint and the 2-bit length prefix
+            value = (loadBigEndian64(data.data()) >> DECODE_SHIFT[lengthClass]) & DECODE_MASK[lengthClass];
+            return length;
+        }
+
+        if (data.size() < length) return 0;
+        value = data[0] & 0x3F;
+        for (size_t i = 1; i < length; ++i) {
+            value = (value << 8) | data[i];
+        }
+        return length;
+    }
+
+    // Decode up to values.size() consecutive varints. Stops early at the end of data or at
+    // a truncated varint. Returns the number of bytes consumed; count receives the number
+    // of values decoded.
+    static size_t decodeBatch(std::span<const uint8_t> data, std::span<uint64_t> values, size_t& count) {
+        size_t offset = 0;
+        count = 0;
+
+        // While at least 8 bytes remain every varint can take the fast path with no bounds checks
+        while (count < values.size() && data.size() - offset >= MAX_LENGTH) {
+            uint8_t lengthClass = data[offset] >> 6;
+            values[count++] = (loadBigEndian64(data.data() + offset) >> DECODE_SHIFT[lengthClass]) & DECODE_MASK[lengthClass];
+            offset += size_t{ 1 } << lengthClass;
+        }
+
+        while (count < values.size()) {
+            size_t used = decode(data.subspan(offset), values[count]);
+            if (used == 0) break;
+            offset += used;
+            ++count;
+        }
+        return offset;
+    }
+
+    // Encode into out. Returns the number of bytes written, or 0 if out is too small or the
+    // value is above MAX_VALUE and so not representable.
+    static size_t encode(uint64_t value, std::span<uint8_t> out) {
+        if (value > MAX_VALUE) return 0;
+        uint8_t lengthClass = LENGTH_CLASS[std::bit_width(value)];
+        size_t length = size_t{ 1 } << lengthClass;
+
+        // Place the prefix above the value, left-align in 64 bits and store big-endian
+        uint64_t encoded = value | (static_cast<uint64_t>(lengthClass) << (length * 8 - 2));
+        uint64_t bigEndian = toBigEndian(encoded << (64 - length * 8));
+
+        if (out.size() >= MAX_LENGTH) {
+            // Fast path: one 8-byte store; the bytes past the varint are scratch
+            std::memcpy(out.data(), &bigEndian, MAX_LENGTH);
+            return length;
+        }
+        if (out.size() < length) return 0;
+
+        // Fixed-size copies compile to single stores; a variable-length memcpy would not
+        switch (lengthClass) {
+        case 0: std::memcpy(out.data(), &bigEndian, 1); break;
+        case 1: std::memcpy(out.data(), &bigEndian, 2); break;
+        case 2: std::memcpy(out.data(), &bigEndian, 4); break;
+        default: std::memcpy(out.data(), &bigEndian, 8); break;
+        }
+        return length;
+    }
+
+    // Append to out; a value above MAX_VALUE appends nothing
+    static void encode(uint64_t value, std::vector<uint8_t>& out) {
+        size_t offset = out.size();
+        out.resize(offset + MAX_LENGTH);
+        out.resize(offset + encode(value, std::span<uint8_t>(out).subspan(offset)));
+    }
+
+    // Big-endian loads and stores shared with the Huffman codec
+    static uint64_t toBigEndian(uint64_t value) {
+        if constexpr (std::endian::native == std::endian::big) {
+            return value;
+        }
+        else {
+#if defined(_MSC_VER)
+            return _byteswap_uint64(value);
+#else
+            return __builtin_bswap64(value);
+#endif
+        }
+    }
+
+    static uint64_t loadBigEndian64(const uint8_t* data) {
+        uint64_t raw;
+        std::memcpy(&raw, data, sizeof(raw));
+        return toBigEndian(raw);
+    }
+
+private:
+    // Length class (0..3) by bit width of the value
+    static constexpr std::array<uint8_t, 65> LENGTH_CLASS = [] {
+        std::array<uint8_t, 65> table = {};
+        for (size_t bits = 0; bits < table.size(); ++bits) {
+            table[bits] = bits <= 6 ? 0 : bits <= 14 ? 1 : bits <= 30 ? 2 : 3;
+        }
+        return table;
+    }();
+
+    static constexpr std::array<uint8_t, 4> DECODE_SHIFT = { 56, 48, 32, 0 };
+    static constexpr std::array<uint64_t, 4> DECODE_MASK = {
+        0x3FULL, 0x3FFFULL, 0x3FFFFFFFULL, 0x3FFFFFFFFFFFFFFFULL
+    };
+};
@@ -0,0 +1,168 @@
+// webtransport.h - Validation of extended CONNECT requests for WebTransport over HTTP/3
+// Shared by the client, the server and the codec benchmarks; no MsQuic dependency.
+#pragma once
+#include "http3-codec/qpack.h"
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The pseudo-headers of an extended CONNECT request. The views have the lifetime of the
+// headers they were taken from.
+struct WebTransportRequest {
+    std::string_view method;
+    std::string_view protocol;
+    std::string_view scheme;
+    std::string_view authority;
+    std::string_view path;
+    bool isWebTransport = false;  // CONNECT with :protocol webtransport
+    bool isValid = false;         // ... with https, :authority and :path as well
+    const char* error = nullptr;  // Why the request is not valid
+};
+
+// Fills a WebTransportRequest field line by field line, usable directly as a
+// QpackDecoder::decodeHeaders() visitor so the pseudo-headers are picked up while the
+// section is decoded. Names the decoder took from the static table are recognized by
+// index; only literal names starting with ':' are compared. Decoding stops at the first
+// field line that rules out a valid WebTransport request (RFC 9114 section 4.3.1).
+class WebTransportRequestParser {
+public:
+    explicit WebTransportRequestParser(WebTransportRequest& request) : request(request) {}
+
+    bool operator()(const QpackDecoder::HeaderView& header, QpackDecoder::FieldRef ref) {
+        Pseudo pseudo = classify(header.name, ref.staticIndex);
+        if (pseudo == Pseudo::NONE) {
+            regularSeen = true;
+            return true;
+        }
+        if (regularSeen) return reject("Pseudo-header after regular header");
+        if (pseudo == Pseudo::UNKNOWN) return reject("Unknown pseudo-header in request");
+
+        std::string_view& field = fieldFor(pseudo);
+        if (field.data() != nullptr) return reject("Duplicate pseudo-header");
+        field = header.value;
+
+        switch (pseudo) {
+        case Pseudo::METHOD:
+            if (!(ref.staticIndex == 15 && ref.staticValue) && header.value != "CONNECT") return reject("Not a CONNECT request");
+            break;
+        case Pseudo::PROTOCOL:
+            if (header.value != "webtransport") return reject("CONNECT request but not WebTransport");
+            break;
+        case Pseudo::SCHEME:
+            if (!(ref.staticIndex == 23 && ref.staticValue) && header.value != "https") return reject("WebTransport requires HTTPS scheme");
+            break;
+        default:
+            break;
+        }
+        return true;
+    }
+
+    // Checks for the pseudo-headers that never showed up; call after the last field line
+    const WebTransportRequest& finish() {
+        if (request.error != nullptr) return request;
+
+        if (request.method.data() == nullptr) {
+            reject("Not a CONNECT request");
+        }
+        else if (request.protocol.data() == nullptr) {
+            reject("CONNECT request but not WebTransport");
+        }
+        else {
+            request.isWebTransport = true;
+            if (request.scheme.data() == nullptr) {
+                reject("WebTransport requires HTTPS scheme");
+            }
+            else if (request.authority.empty()) {
+                reject("WebTransport requires :authority header");
+            }
+            else if (request.path.empty()) {
+                reject("WebTransport requires :path header");
+            }
+            else {
+                request.isValid = true;
+            }
+        }
+        return request;
+    }
+
+    // For headers that did not come through the decoder with a parser attached, such as
+    // sections released by QpackDecoder::takeUnblockedSections()
+    template <typename HeaderList>
+    static WebTransportRequest parse(const HeaderList& headers) {
+        WebTransportRequest request;
+        WebTransportRequestParser parser(request);
+        for (const auto& header : headers) {
+            if (!parser({ header.name, header.value }, {})) break;
+        }
+        parser.finish();
+        return request;
+    }
+
+private:
+    enum class Pseudo { NONE, METHOD, PROTOCOL, SCHEME, AUTHORITY, PATH, UNKNOWN };
+
+    WebTransportRequest& request;
+    bool regularSeen = false;
+
+    static Pseudo classify(std::string_view name, int staticIndex) {
+        if (staticIndex == 0) return Pseudo::AUTHORITY;
+        if (staticIndex == 1) return Pseudo::PATH;
+        if (staticIndex >= 15 && staticIndex <= 21) return Pseudo::METHOD;
+        if (staticIndex >= 22 && staticIndex <= 23) return Pseudo::SCHEME;
+
+        if (name.empty() || name[0] != ':') return Pseudo::NONE;
+        if (staticIndex >= 0) return Pseudo::UNKNOWN;  // :status
+        if (name == ":method") return Pseudo::METHOD;
+        if (name == ":protocol") return Pseudo::PROTOCOL;
+        if (name == ":scheme") return Pseudo::SCHEME;
+        if (name == ":authority") return Pseudo::AUTHORITY;
+        if (name == ":path") return Pseudo::PATH;
+        return Pseudo::UNKNOWN;
+    }
+
+    std::string_view& fieldFor(Pseudo pseudo) {
+        switch (pseudo) {
+        case Pseudo::METHOD: return request.method;
+        case Pseudo::PROTOCOL: return request.protocol;
+        case Pseudo::SCHEME: return request.scheme;
+        case Pseudo::AUTHORITY: return request.authority;
+        default: return request.path;
+        }
+    }
+
+    bool reject(const char* error) {
+        request.error = error;
+        return false;
+    }
+};
+
+// Enhanced WebTransport validator
+class WebTransportValidator {
+public:
+    struct Result {
+        bool isValid = false;
+        bool isWebTransport = false;
+        std::string authority;
+        std::string path;
+        std::string message;
+    };
+
+    // Works on owning headers and on the views of the allocation-free decoder alike
+    template <typename HeaderList>
+    Result validate(const HeaderList& headers) {
+        WebTransportRequest request = WebTransportRequestParser::parse(headers);
+
+        Result result;
+        result.isValid = request.isValid;
+        result.isWebTransport = request.isWebTransport;
+        result.authority = request.authority;
+        result.path = request.path;
+        if (request.isValid) {
+            result.message = "Valid WebTransport request to " + result.authority + result.path;
+        }
+        else {
+            result.message = request.error;
+        }
+        return result;
+    }
+};
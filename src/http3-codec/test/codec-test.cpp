@@ -0,0 +1,558 @@
+// codec-test.cpp - RFC test vectors and decoder edge cases for the codec, run by ctest
+#include "http3-codec/frame.h"
+#include "http3-codec/huffman.h"
+#include "http3-codec/qpack.h"
+#include "http3-codec/sendpool.h"
+#include "http3-codec/varint.h"
+#include "http3-codec/webtransport.h"
+#include <cstdint>
+#include <iostream>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Release builds define NDEBUG, so failures are counted rather than asserted
+static int failures = 0;
+
+#define CHECK(condition)                                                                  \
+    do {                                                                                  \
+        if (!(condition)) {                                                               \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed\n"; \
+            ++failures;                                                                   \
+        }                                                                                 \
+    } while (false)
+
+using Bytes = std::vector<uint8_t>;
+using Headers = std::vector<std::pair<std::string, std::string>>;
+
+static Headers pairs(const std::vector<QpackDecoder::Header>& headers) {
+    Headers out;
+    for (const auto& header : headers) {
+        out.emplace_back(header.name, header.value);
+    }
+    return out;
+}
+
+// RFC 7541 Appendix C.4 and C.6: the Huffman-coded strings of the request and response examples
+static void testHuffmanVectors() {
+    const std::vector<std::pair<std::string, Bytes>> vectors = {
+        { "www.example.com", { 0xf1, 0xe3, 0xc2, 0xe5, 0xf2, 0x3a, 0x6b, 0xa0, 0xab, 0x90, 0xf4, 0xff } },
+        { "no-cache", { 0xa8, 0xeb, 0x10, 0x64, 0x9c, 0xbf } },
+        { "custom-key", { 0x25, 0xa8, 0x49, 0xe9, 0x5b, 0xa9, 0x7d, 0x7f } },
+        { "custom-value", { 0x25, 0xa8, 0x49, 0xe9, 0x5b, 0xb8, 0xe8, 0xb4, 0xbf } },
+        { "302", { 0x64, 0x02 } },
+        { "307", { 0x64, 0x0e, 0xff } },
+        { "private", { 0xae, 0xc3, 0x77, 0x1a, 0x4b } },
+        { "Mon, 21 Oct 2013 20:13:21 GMT", { 0xd0, 0x7a, 0xbe, 0x94, 0x10, 0x54, 0xd4, 0x44, 0xa8, 0x20, 0x05, 0x95,
+            0x04, 0x0b, 0x81, 0x66, 0xe0, 0x82, 0xa6, 0x2d, 0x1b, 0xff } },
+        { "Mon, 21 Oct 2013 20:13:22 GMT", { 0xd0, 0x7a, 0xbe, 0x94, 0x10, 0x54, 0xd4, 0x44, 0xa8, 0x20, 0x05, 0x95,
+            0x04, 0x0b, 0x81, 0x66, 0xe0, 0x84, 0xa6, 0x2d, 0x1b, 0xff } },
+        { "https://www.example.com", { 0x9d, 0x29, 0xad, 0x17, 0x18, 0x63, 0xc7, 0x8f, 0x0b, 0x97, 0xc8, 0xe9,
+            0xae, 0x82, 0xae, 0x43, 0xd3 } },
+        { "gzip", { 0x9b, 0xd9, 0xab } },
+        { "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1", { 0x94, 0xe7, 0x82, 0x1d, 0xd7, 0xf2, 0xe6,
+            0xc7, 0xb3, 0x35, 0xdf, 0xdf, 0xcd, 0x5b, 0x39, 0x60, 0xd5, 0xaf, 0x27, 0x08, 0x7f, 0x36, 0x72, 0xc1,
+            0xab, 0x27, 0x0f, 0xb5, 0x29, 0x1f, 0x95, 0x87, 0x31, 0x60, 0x65, 0xc0, 0x03, 0xed, 0x4e, 0xe5, 0xb1,
+            0x06, 0x3d, 0x50, 0x07 } },
+    };
+
+    for (const auto& [text, encoded] : vectors) {
+        CHECK(QpackHuffman::encodedLength(text) == encoded.size());
+        Bytes out(QpackHuffman::encodedLength(text));
+        CHECK(QpackHuffman::encode(text, out) == encoded.size());
+        CHECK(out == encoded);
+
+        std::string decoded;
+        CHECK(QpackHuffman::decode(encoded, decoded));
+        CHECK(decoded == text);
+    }
+
+    // Padding longer than seven bits, or not all ones, is a decoding error (RFC 7541 section 5.2)
+    std::string decoded;
+    CHECK(!QpackHuffman::decode(Bytes{ 0x64, 0x02, 0xff }, decoded));
+    decoded.clear();
+    CHECK(!QpackHuffman::decode(Bytes{ 0x64, 0x0e, 0xfe }, decoded));
+}
+
+// RFC 9204 Appendix B, applied in order to one decoder. Our decoder acknowledges inserts as
+// soon as they arrive, so its decoder stream carries Insert Count Increments where the
+// examples let a Section Acknowledgment cover them.
+static void testQpackDecoderExamples() {
+    QpackDecoder decoder;
+    decoder.setMaxTableCapacity(220);
+    decoder.setMaxBlockedStreams(1);
+    std::vector<QpackDecoder::Header> headers;
+
+    // B.1 Literal Field Line with Name Reference
+    Bytes b1 = { 0x00, 0x00, 0x51, 0x0b, 0x2f, 0x69, 0x6e, 0x64, 0x65, 0x78, 0x2e, 0x68, 0x74, 0x6d, 0x6c };
+    CHECK(decoder.decodeHeaders(0, b1, headers) == QpackDecoder::Status::Ok);
+    CHECK((pairs(headers) == Headers{ { ":path", "/index.html" } }));
+    CHECK(decoder.takeDecoderStreamData().empty());
+
+    // B.2 Dynamic Table
+    Bytes b2Encoder = { 0x3f, 0xbd, 0x01,
+        0xc0, 0x0f, 0x77, 0x77, 0x77, 0x2e, 0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x2e, 0x63, 0x6f, 0x6d,
+        0xc1, 0x0c, 0x2f, 0x73, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x2f, 0x70, 0x61, 0x74, 0x68 };
+    CHECK(decoder.processEncoderStream(b2Encoder));
+    CHECK(decoder.dynamicTable().capacity() == 220 && decoder.dynamicTable().size() == 106);
+    CHECK((decoder.takeDecoderStreamData() == Bytes{ 0x02 }));
+    CHECK(decoder.decodeHeaders(4, Bytes{ 0x03, 0x81, 0x10, 0x11 }, headers) == QpackDecoder::Status::Ok);
+    CHECK((pairs(headers) == Headers{ { ":authority", "www.example.com" }, { ":path", "/sample/path" } }));
+    CHECK((decoder.takeDecoderStreamData() == Bytes{ 0x84 }));
+
+    // B.3 Speculative Insert
+    Bytes b3Encoder = { 0x4a, 0x63, 0x75, 0x73, 0x74, 0x6f, 0x6d, 0x2d, 0x6b, 0x65, 0x79,
+        0x0c, 0x63, 0x75, 0x73, 0x74, 0x6f, 0x6d, 0x2d, 0x76, 0x61, 0x6c, 0x75, 0x65 };
+    CHECK(decoder.processEncoderStream(b3Encoder));
+    CHECK(decoder.dynamicTable().size() == 160);
+    CHECK((decoder.takeDecoderStreamData() == Bytes{ 0x01 }));
+
+    // B.4 Duplicate Instruction, Stream Cancellation
+    CHECK(decoder.processEncoderStream(Bytes{ 0x02 }));
+    CHECK(decoder.dynamicTable().size() == 217);
+    CHECK((decoder.takeDecoderStreamData() == Bytes{ 0x01 }));
+    CHECK(decoder.decodeHeaders(8, Bytes{ 0x05, 0x00, 0x80, 0xc1, 0x81 }, headers) == QpackDecoder::Status::Ok);
+    CHECK((pairs(headers) == Headers{ { ":authority", "www.example.com" }, { ":path", "/" }, { "custom-key", "custom-value" } }));
+    CHECK((decoder.takeDecoderStreamData() == Bytes{ 0x88 }));
+    decoder.cancelStream(8);
+    CHECK((decoder.takeDecoderStreamData() == Bytes{ 0x48 }));
+
+    // B.5 Dynamic Table Insert, Eviction
+    Bytes b5Encoder = { 0x81, 0x0d, 0x63, 0x75, 0x73, 0x74, 0x6f, 0x6d, 0x2d, 0x76, 0x61, 0x6c, 0x75, 0x65, 0x32 };
+    CHECK(decoder.processEncoderStream(b5Encoder));
+    CHECK((decoder.takeDecoderStreamData() == Bytes{ 0x01 }));
+    const auto& table = decoder.dynamicTable();
+    CHECK(table.insertCount() == 5 && table.droppedCount() == 1 && table.size() == 215);
+    CHECK(table.get(0) == nullptr);
+    CHECK(table.get(4) != nullptr && table.get(4)->name == "custom-key" && table.get(4)->value == "custom-value2");
+}
+
+// The encoder side of RFC 9204 Appendix B: its table capacity instruction matches B.2
+// byte for byte. Its inserts may be Huffman coded, so they are checked by round trip, and
+// a later section references the entries once the decoder has acknowledged them.
+static void testQpackEncoderExamples() {
+    QpackEncoder encoder;
+    QpackDecoder decoder;
+    decoder.setMaxTableCapacity(220);
+    encoder.setPeerMaxTableCapacity(220);
+    Bytes capacity = encoder.takeEncoderStreamData();
+    CHECK((capacity == Bytes{ 0x3f, 0xbd, 0x01 }));
+    CHECK(decoder.processEncoderStream(capacity));
+
+    const Headers request = { { ":authority", "www.example.com" }, { ":path", "/sample/path" } };
+    std::vector<QpackDecoder::Header> headers;
+    size_t sectionSizes[2] = {};
+    uint64_t streamIds[2] = { 4, 8 };
+    for (int i = 0; i < 2; ++i) {
+        encoder.beginSection(streamIds[i]);
+        for (const auto& [name, value] : request) {
+            encoder.encodeHeader(name, value);
+        }
+        Bytes section = encoder.getEncoded();
+        sectionSizes[i] = section.size();
+
+        CHECK(decoder.processEncoderStream(encoder.takeEncoderStreamData()));
+        CHECK(decoder.decodeHeaders(streamIds[i], section, headers) == QpackDecoder::Status::Ok);
+        CHECK(pairs(headers) == request);
+        CHECK(encoder.processDecoderStream(decoder.takeDecoderStreamData()));
+    }
+
+    // The first section carries literals beside the inserts; the second is B.2's two
+    // dynamic references behind a two-byte prefix
+    CHECK(encoder.dynamicTable().insertCount() == 2);
+    CHECK(sectionSizes[1] == 4 && sectionSizes[1] < sectionSizes[0]);
+
+    // A Section Acknowledgment for a stream with nothing outstanding is a decoder stream error
+    CHECK(!encoder.processDecoderStream(Bytes{ 0x84 }));
+}
+
+// A section parked behind an earlier blocked section of the same stream waits for its own
+// Required Insert Count, not the earlier one
+static void testBlockedSectionOrder() {
+    QpackDecoder decoder;
+    decoder.setMaxTableCapacity(220);
+    decoder.setMaxBlockedStreams(4);
+    QpackArena arena;
+    auto visit = [](const QpackDecoder::HeaderView&, QpackDecoder::FieldRef) { return true; };
+
+    // Required Insert Count 1 and 2, each referencing the newest entry
+    CHECK(decoder.decodeHeaders(4, Bytes{ 0x02, 0x00, 0x80 }, arena, visit) == QpackDecoder::Status::Blocked);
+    CHECK(decoder.decodeHeaders(4, Bytes{ 0x03, 0x00, 0x80 }, arena, visit) == QpackDecoder::Status::Blocked);
+
+    CHECK(decoder.processEncoderStream(Bytes{ 0x3f, 0xbd, 0x01, 0x41, 'a', 0x01, '1' }));
+    auto first = decoder.takeUnblockedSections();
+    CHECK(first.size() == 1);
+    if (first.size() == 1) {
+        CHECK(first[0].status == QpackDecoder::Status::Ok);
+        CHECK((pairs(first[0].headers) == Headers{ { "a", "1" } }));
+    }
+
+    CHECK(decoder.processEncoderStream(Bytes{ 0x41, 'b', 0x01, '2' }));
+    auto second = decoder.takeUnblockedSections();
+    CHECK(second.size() == 1);
+    if (second.size() == 1) {
+        CHECK(second[0].status == QpackDecoder::Status::Ok);
+        CHECK((pairs(second[0].headers) == Headers{ { "b", "2" } }));
+    }
+}
+
+// A stream may park a header and a trailer section; a third is QPACK_DECOMPRESSION_FAILED
+// rather than another copy held until the table catches up
+static void testBlockedSectionLimit() {
+    QpackDecoder decoder;
+    decoder.setMaxTableCapacity(220);
+    decoder.setMaxBlockedStreams(4);
+    QpackArena arena;
+    auto visit = [](const QpackDecoder::HeaderView&, QpackDecoder::FieldRef) { return true; };
+
+    CHECK(decoder.decodeHeaders(4, Bytes{ 0x02, 0x00, 0x80 }, arena, visit) == QpackDecoder::Status::Blocked);
+    CHECK(decoder.decodeHeaders(4, Bytes{ 0x02, 0x00, 0x80 }, arena, visit) == QpackDecoder::Status::Blocked);
+    CHECK(decoder.decodeHeaders(4, Bytes{ 0x02, 0x00, 0x80 }, arena, visit) == QpackDecoder::Status::Error);
+
+    // Other streams still count against the blocked-streams limit, one each
+    CHECK(decoder.decodeHeaders(8, Bytes{ 0x02, 0x00, 0x80 }, arena, visit) == QpackDecoder::Status::Blocked);
+    CHECK(decoder.decodeHeaders(12, Bytes{ 0x02, 0x00, 0x80 }, arena, visit) == QpackDecoder::Status::Blocked);
+    CHECK(decoder.decodeHeaders(16, Bytes{ 0x02, 0x00, 0x80 }, arena, visit) == QpackDecoder::Status::Blocked);
+    CHECK(decoder.decodeHeaders(20, Bytes{ 0x02, 0x00, 0x80 }, arena, visit) == QpackDecoder::Status::Error);
+
+    // Releasing the sections frees the stream's slots
+    CHECK(decoder.processEncoderStream(Bytes{ 0x3f, 0xbd, 0x01, 0x41, 'a', 0x01, '1' }));
+    CHECK(decoder.takeUnblockedSections().size() == 5);
+    CHECK(decoder.decodeHeaders(4, Bytes{ 0x03, 0x00, 0x80 }, arena, visit) == QpackDecoder::Status::Blocked);
+    CHECK(decoder.decodeHeaders(4, Bytes{ 0x03, 0x00, 0x80 }, arena, visit) == QpackDecoder::Status::Blocked);
+}
+
+// A field line costs its name, its value and 32 bytes (RFC 9114 section 4.2.2). Over the
+// limit the section is Status::TooLarge, and a literal that alone would overrun what is
+// left is refused before it is decoded.
+static void testFieldSectionLimit() {
+    QpackDecoder decoder;
+    std::vector<QpackDecoder::Header> headers;
+    const Bytes twoGets = { 0x00, 0x00, 0xd1, 0xd1 };  // :method GET twice, 42 bytes each
+
+    decoder.setMaxFieldSectionSize(84);
+    CHECK(decoder.decodeHeaders(0, twoGets, headers) == QpackDecoder::Status::Ok);
+    CHECK(headers.size() == 2);
+    decoder.setMaxFieldSectionSize(83);
+    CHECK(decoder.decodeHeaders(0, twoGets, headers) == QpackDecoder::Status::TooLarge);
+
+    // A 60-byte literal value against a 50-byte limit
+    Bytes literal = { 0x00, 0x00, 0x51, 60 };
+    literal.insert(literal.end(), 60, 'x');
+    decoder.setMaxFieldSectionSize(50);
+    CHECK(decoder.decodeHeaders(0, literal, headers) == QpackDecoder::Status::TooLarge);
+
+    // Each section gets the whole budget again
+    CHECK(decoder.decodeHeaders(0, Bytes{ 0x00, 0x00, 0xd1 }, headers) == QpackDecoder::Status::Ok);
+}
+
+// The request's views point into fields
+static WebTransportRequest parseRequest(const Headers& fields) {
+    std::vector<QpackDecoder::HeaderView> headers;
+    for (const auto& [name, value] : fields) {
+        headers.push_back({ name, value });
+    }
+    return WebTransportRequestParser::parse(headers);
+}
+
+// Extended CONNECT must carry each pseudo-header once, ahead of the regular fields
+// (RFC 9114 section 4.3.1)
+static void testWebTransportRequestParser() {
+    const Headers valid = { { ":method", "CONNECT" }, { ":protocol", "webtransport" }, { ":scheme", "https" },
+        { ":authority", "localhost:4443" }, { ":path", "/webtransport" }, { "origin", "https://localhost" } };
+    WebTransportRequest request = parseRequest(valid);
+    CHECK(request.isValid && request.isWebTransport && request.path == "/webtransport");
+
+    Headers duplicate = valid;
+    duplicate.insert(duplicate.begin() + 4, { ":path", "/other" });
+    request = parseRequest(duplicate);
+    CHECK(!request.isValid && std::string_view(request.error) == "Duplicate pseudo-header");
+
+    Headers outOfOrder = valid;
+    std::swap(outOfOrder[4], outOfOrder[5]);
+    request = parseRequest(outOfOrder);
+    CHECK(!request.isValid && std::string_view(request.error) == "Pseudo-header after regular header");
+
+    Headers unknown = valid;
+    unknown.insert(unknown.begin(), { ":status", "200" });
+    request = parseRequest(unknown);
+    CHECK(!request.isValid && std::string_view(request.error) == "Unknown pseudo-header in request");
+
+    Headers noPath(valid.begin(), valid.begin() + 4);
+    request = parseRequest(noPath);
+    CHECK(request.isWebTransport && !request.isValid && std::string_view(request.error) == "WebTransport requires :path header");
+
+    Headers noProtocol = valid;
+    noProtocol.erase(noProtocol.begin() + 1);
+    request = parseRequest(noProtocol);
+    CHECK(!request.isWebTransport && !request.isValid);
+
+    // As a decoder visitor, a rejected request stops decoding; static names are matched by index
+    QpackEncoder encoder;
+    encoder.beginSection(0);
+    for (const auto& [name, value] : duplicate) {
+        encoder.encodeHeader(name, value);
+    }
+    QpackDecoder decoder;
+    QpackArena arena;
+    WebTransportRequest visited;
+    CHECK(decoder.decodeHeaders(0, encoder.encoded(), arena, WebTransportRequestParser(visited)) == QpackDecoder::Status::Rejected);
+    CHECK(visited.error != nullptr && std::string_view(visited.error) == "Duplicate pseudo-header");
+}
+
+using FrameDecoder = Http3FrameDecoder<>;
+
+// What a decoder made of a stream: frames as "type:payload", a WEBTRANSPORT_STREAM signal
+// as "wt:session", DATA and raw stream bytes concatenated, and the error code if it failed
+struct Decoded {
+    std::vector<std::string> frames;
+    std::string data;
+    uint64_t errorCode = 0;
+
+    bool operator==(const Decoded&) const = default;
+};
+
+// Feeds pieces as separate RECEIVE events. Like MsQuic, bytes the decoder did not consume
+// are delivered again in front of the next piece.
+static Decoded decodePieces(FrameDecoder& decoder, const std::vector<Bytes>& pieces) {
+    Decoded decoded;
+    Bytes pending;
+    for (const auto& piece : pieces) {
+        pending.insert(pending.end(), piece.begin(), piece.end());
+        Http3Buffer buffer{ static_cast<uint32_t>(pending.size()), pending.data() };
+        Http3BufferCursor<> cursor(std::span<const Http3Buffer>(&buffer, 1));
+        for (const auto& event : decoder.events(cursor)) {
+            std::string payload(event.payload.begin(), event.payload.end());
+            switch (event.type) {
+            case FrameDecoder::EventType::Frame:
+                decoded.frames.push_back(std::to_string(event.value) + ":" + payload);
+                break;
+            case FrameDecoder::EventType::WebTransportStream:
+                decoded.frames.push_back("wt:" + std::to_string(event.value));
+                break;
+            case FrameDecoder::EventType::DataChunk:
+            case FrameDecoder::EventType::RawData:
+                decoded.data += payload;
+                break;
+            case FrameDecoder::EventType::Error:
+                decoded.errorCode = event.errorCode;
+                return decoded;
+            default:
+                break;
+            }
+        }
+        pending.erase(pending.begin(), pending.begin() + static_cast<ptrdiff_t>(cursor.consumed()));
+    }
+    return decoded;
+}
+
+// Every split of the stream into two RECEIVE events, and one byte per event, must decode
+// exactly like the stream in one piece
+static void checkEverySplit(const Bytes& stream, bool unidirectional, const Decoded& expected) {
+    for (size_t split = 0; split <= stream.size(); ++split) {
+        FrameDecoder decoder(unidirectional);
+        Bytes head(stream.begin(), stream.begin() + static_cast<ptrdiff_t>(split));
+        Bytes tail(stream.begin() + static_cast<ptrdiff_t>(split), stream.end());
+        if (!(decodePieces(decoder, { head, tail }) == expected)) {
+            std::cerr << "  split at byte " << split << " of " << stream.size() << "\n";
+            CHECK(false);
+        }
+    }
+
+    FrameDecoder decoder(unidirectional);
+    std::vector<Bytes> single;
+    for (uint8_t byte : stream) {
+        single.push_back({ byte });
+    }
+    CHECK(decodePieces(decoder, single) == expected);
+}
+
+static void testFrameDecoderSplits() {
+    // Request stream: HEADERS, a reserved frame type that must be skipped, DATA in two
+    // frames, then trailing HEADERS
+    Bytes request;
+    auto frame = [&](uint64_t type, std::string_view payload) {
+        Http3Varint::encode(type, request);
+        Http3Varint::encode(payload.size(), request);
+        request.insert(request.end(), payload.begin(), payload.end());
+    };
+    frame(Http3FrameType::HEADERS, std::string_view("\x00\x00\xd1", 3));
+    frame(0x21, "reserved");
+    frame(Http3FrameType::DATA, "hello, ");
+    frame(Http3FrameType::DATA, std::string(100, 'x'));
+    frame(Http3FrameType::HEADERS, std::string_view("\x00\x00\xd9", 3));
+
+    Decoded expected;
+    expected.frames = { "1:" + std::string("\x00\x00\xd1", 3), "1:" + std::string("\x00\x00\xd9", 3) };
+    expected.data = "hello, " + std::string(100, 'x');
+    checkEverySplit(request, false, expected);
+
+    // Control stream: type, SETTINGS, then a reserved frame
+    Bytes control = { 0x00, 0x04, 0x04, 0x01, 0x00, 0x07, 0x00, 0x21, 0x01, 0x00 };
+    Decoded settings;
+    settings.frames = { "4:" + std::string("\x01\x00\x07\x00", 4) };
+    checkEverySplit(control, true, settings);
+
+    // A control stream that opens with anything but SETTINGS, even a reserved type
+    Decoded missing;
+    missing.errorCode = Http3ErrorCode::H3_MISSING_SETTINGS;
+    checkEverySplit(Bytes{ 0x00, 0x21, 0x01, 0x00 }, true, missing);
+
+    // WEBTRANSPORT_STREAM turns a bidirectional stream into data, but only as its first frame
+    Decoded webTransport;
+    webTransport.frames = { "wt:4" };
+    webTransport.data = "echo";
+    checkEverySplit(Bytes{ 0x40, 0x41, 0x04, 'e', 'c', 'h', 'o' }, false, webTransport);
+
+    Decoded lateSignal;
+    lateSignal.errorCode = Http3ErrorCode::H3_FRAME_UNEXPECTED;
+    checkEverySplit(Bytes{ 0x21, 0x00, 0x40, 0x41, 0x04, 'x' }, false, lateSignal);
+    lateSignal.frames = { "4:" };
+    checkEverySplit(Bytes{ 0x00, 0x04, 0x00, 0x40, 0x41, 0x04, 'x' }, true, lateSignal);
+
+    // HEADERS longer than the reassembly limit is refused as soon as its length is known
+    Decoded oversized;
+    oversized.errorCode = Http3ErrorCode::H3_EXCESSIVE_LOAD;
+    checkEverySplit(Bytes{ 0x01, 0x80, 0x01, 0x00, 0x01, 0x00 }, false, oversized);
+
+    // A SETTINGS payload that ends inside a value is malformed
+    Http3NegotiatedSettings peerSettings;
+    CHECK(peerSettings.apply(Bytes{ 0x01, 0x40 }) == Http3ErrorCode::H3_FRAME_ERROR);
+}
+
+// RFC 9114 section 7.2.4: a repeated identifier, an HTTP/2 one or a boolean above 1 is
+// H3_SETTINGS_ERROR; unknown identifiers are skipped
+static void testSettingsErrors() {
+    Http3NegotiatedSettings repeated;
+    CHECK(repeated.apply(Bytes{ 0x01, 0x10, 0x01, 0x10 }) == Http3ErrorCode::H3_SETTINGS_ERROR);
+    CHECK(!repeated.received);
+
+    for (uint8_t http2Id = 0x02; http2Id <= 0x05; ++http2Id) {
+        Http3NegotiatedSettings settings;
+        CHECK(settings.apply(Bytes{ http2Id, 0x00 }) == Http3ErrorCode::H3_SETTINGS_ERROR);
+    }
+
+    Http3NegotiatedSettings outOfRange;
+    CHECK(outOfRange.apply(Bytes{ 0x08, 0x02 }) == Http3ErrorCode::H3_SETTINGS_ERROR);
+
+    // Both H3_DATAGRAM codepoints may appear; neither repeats the other
+    Http3NegotiatedSettings settings;
+    CHECK(settings.apply(Bytes{ 0x01, 0x10, 0x21, 0x00, 0x08, 0x01, 0x33, 0x01, 0x80, 0xff, 0xd2, 0x77, 0x01 }) == 0);
+    CHECK(settings.received && settings.qpackMaxTableCapacity == 0x10 && settings.enableConnectProtocol && settings.h3Datagram);
+}
+
+// beginFrame() reserves the length varint for the rest of the region; endFrame() writes the
+// real length and shifts the payload down when it encodes shorter
+static void testFrameWriterBackPatch() {
+    auto writeFrame = [](size_t regionSize, size_t payloadSize) {
+        Bytes region(regionSize);
+        Http3FrameWriter writer(region);
+        bool ok = writer.beginFrame(Http3FrameType::DATA);
+        for (size_t i = 0; i < payloadSize; ++i) {
+            ok = ok && writer.writeByte(static_cast<uint8_t>(i));
+        }
+        ok = ok && writer.endFrame();
+        Bytes frame(writer.written().begin(), writer.written().end());
+        return ok ? frame : Bytes{};
+    };
+    auto expectedFrame = [](size_t payloadSize) {
+        Bytes frame;
+        Http3Varint::encode(Http3FrameType::DATA, frame);
+        Http3Varint::encode(payloadSize, frame);
+        for (size_t i = 0; i < payloadSize; ++i) {
+            frame.push_back(static_cast<uint8_t>(i));
+        }
+        return frame;
+    };
+
+    // Reserved width: 2 bytes for a 100-byte region, 4 for 20000. The payload lengths
+    // straddle the 1-, 2- and 4-byte encodings.
+    const std::vector<std::pair<size_t, size_t>> cases = {
+        { 100, 0 }, { 100, 63 }, { 100, 64 }, { 100, 97 },
+        { 20000, 5 }, { 20000, 16383 }, { 20000, 16384 }, { 20000, 19995 },
+    };
+    for (const auto& [regionSize, payloadSize] : cases) {
+        CHECK(writeFrame(regionSize, payloadSize) == expectedFrame(payloadSize));
+    }
+
+    // Frames written one after another each get their own back-patch
+    Bytes region(200);
+    Http3FrameWriter writer(region);
+    CHECK(writer.beginFrame(Http3FrameType::HEADERS) && writer.writeByte(0xaa) && writer.endFrame());
+    CHECK(writer.beginFrame(Http3FrameType::DATA) && writer.writeBytes(Bytes(70, 0xbb)) && writer.endFrame());
+    Bytes expected = { 0x01, 0x01, 0xaa, 0x00, 0x40, 70 };
+    expected.insert(expected.end(), 70, 0xbb);
+    CHECK((Bytes(writer.written().begin(), writer.written().end()) == expected));
+
+    // Overflow and misuse fail and stick
+    Bytes small(4);
+    Http3FrameWriter tooSmall(small);
+    CHECK(tooSmall.beginFrame(Http3FrameType::DATA) && tooSmall.writeByte(1) && tooSmall.writeByte(2));
+    CHECK(!tooSmall.writeByte(3) && !tooSmall.endFrame() && !tooSmall.ok());
+    Http3FrameWriter unopened(small);
+    CHECK(!unopened.endFrame() && !unopened.ok());
+    Http3FrameWriter nested(region);
+    CHECK(nested.beginFrame(Http3FrameType::DATA) && !nested.beginFrame(Http3FrameType::DATA));
+}
+
+// A send gathers at most MAX_SEGMENTS buffers; past that, appends fail without changing it
+static void testSendBufferSegments() {
+    using SendBuffer = Http3SendBuffer<>;
+    using Pool = Http3SendBufferPool<>;
+    static const uint8_t payload[] = { 'x' };
+
+    SendBuffer* buffer = Pool::acquire();
+    CHECK(buffer->appendReference({}));  // Empty references take no segment
+    for (size_t i = 0; i < SendBuffer::MAX_SEGMENTS; ++i) {
+        CHECK(buffer->appendReference(payload));
+    }
+    CHECK(buffer->bufferCount() == SendBuffer::MAX_SEGMENTS);
+    CHECK(!buffer->appendReference(payload));
+    CHECK(!buffer->appendHeader({ Http3FrameType::DATA }));
+    CHECK(buffer->bufferCount() == SendBuffer::MAX_SEGMENTS && buffer->totalLength() == SendBuffer::MAX_SEGMENTS);
+
+    // A reused buffer starts empty again
+    Pool::release(buffer);
+    buffer = Pool::acquire();
+    CHECK(buffer->bufferCount() == 0);
+    for (size_t i = 0; i < SendBuffer::MAX_SEGMENTS / 2; ++i) {
+        CHECK(buffer->appendFrame(Http3FrameType::DATA, payload));
+    }
+    CHECK(!buffer->appendFrame(Http3FrameType::DATA, payload));
+    Pool::release(buffer);
+}
+
+static void testVarintLimits() {
+    uint8_t out[8] = {};
+    CHECK(Http3Varint::encode(Http3Varint::MAX_VALUE, out) == 8);
+    uint64_t value = 0;
+    CHECK(Http3Varint::decode(out, value) == 8 && value == Http3Varint::MAX_VALUE);
+
+    CHECK(Http3Varint::encode(Http3Varint::MAX_VALUE + 1, out) == 0);
+    Bytes appended;
+    Http3Varint::encode(Http3Varint::MAX_VALUE + 1, appended);
+    CHECK(appended.empty());
+}
+
+int main() {
+    testHuffmanVectors();
+    testQpackDecoderExamples();
+    testQpackEncoderExamples();
+    testBlockedSectionOrder();
+    testBlockedSectionLimit();
+    testFieldSectionLimit();
+    testWebTransportRequestParser();
+    testFrameDecoderSplits();
+    testSettingsErrors();
+    testFrameWriterBackPatch();
+    testSendBufferSegments();
+    testVarintLimits();
+
+    if (failures != 0) {
+        std::cerr << failures << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "All codec tests passed\n";
+    return 0;
+}
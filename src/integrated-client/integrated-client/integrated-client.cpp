@@ -6,325 +6,101 @@
 #include <string>
 #include <string_view>
 #include <array>
-#include <format>
+#include <span>
 #include <cstring>
 #include <chrono>
 #include <thread>
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#include "http3-codec/frame.h"
+#include "http3-codec/log.h"
+#include "http3-codec/qpack.h"
+#include "http3-codec/sendpool.h"
 
 #pragma comment(lib, "msquic.lib")
 #pragma comment(lib, "Ws2_32.lib")
 
-static auto clientStartTime = std::chrono::steady_clock::now();
+// Codec buffer-chain types over MsQuic RECEIVE buffers
+using QuicBufferCursor = Http3BufferCursor<QUIC_BUFFER>;
+using QuicFrameDecoder = Http3FrameDecoder<QUIC_BUFFER>;
+using QuicSendBuffer = Http3SendBuffer<QUIC_BUFFER>;
+using QuicSendBufferPool = Http3SendBufferPool<QUIC_BUFFER>;
 
-static std::string getClientTimestamp() {
-    auto now = std::chrono::steady_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - clientStartTime);
-    return "[T+" + std::to_string(duration.count()) + "ms]";
-}
+// Global variables for MsQuic
+const QUIC_API_TABLE* MsQuic = nullptr;
+HQUIC Registration = nullptr;
+HQUIC Configuration = nullptr;
+HQUIC Connection = nullptr;
+HQUIC ControlStream = nullptr;
+HQUIC ConnectStream = nullptr;
+HQUIC EncoderStream = nullptr;  // Our QPACK streams, opened when they first have instructions to send
+HQUIC DecoderStream = nullptr;
 
-// QPACK Static Table (subset for WebTransport)
-struct QpackStaticEntry {
-    std::string_view name;
-    std::string_view value;
+bool WebTransportEstablished = false;
+uint64_t SessionId = 0;  // Stream ID of the CONNECT request, known once that stream has started
+
+// Target of the CONNECT request, sent once its stream has started and has an ID
+std::string ConnectAuthority;
+std::string ConnectPath;
+
+// What the server's SETTINGS allow, once its control stream has delivered them
+Http3NegotiatedSettings ServerSettings;
+
+// QPACK limits we advertise for the server's encoder. The CONNECT stream is the only one
+// that carries a header section to us, so one blocked stream is enough.
+static constexpr uint64_t CLIENT_QPACK_MAX_TABLE_CAPACITY = 4096;
+static constexpr uint64_t CLIENT_QPACK_BLOCKED_STREAMS = 1;
+static constexpr uint64_t CLIENT_MAX_FIELD_SECTION_SIZE = 16384;
+
+// SETTINGS sent on the client control stream
+static constexpr Http3Setting CLIENT_SETTINGS[] = {
+    { Http3SettingId::ENABLE_WEBTRANSPORT, 1 },
+    { Http3SettingId::MAX_FIELD_SECTION_SIZE, CLIENT_MAX_FIELD_SECTION_SIZE },
+    { Http3SettingId::QPACK_MAX_TABLE_CAPACITY, CLIENT_QPACK_MAX_TABLE_CAPACITY },
+    { Http3SettingId::QPACK_BLOCKED_STREAMS, CLIENT_QPACK_BLOCKED_STREAMS },
 };
 
-constexpr std::array<QpackStaticEntry, 99> QPACK_STATIC_TABLE = { {
-    {"", ""},                                    // 0 - unused
-    {":authority", ""},                          // 1
-    {":path", "/"},                             // 2
-    {":path", "/index.html"},                   // 3
-    {":path", "/index.htm"},                    // 4
-    {":method", "CONNECT"},                     // 5  <- Important for WebTransport
-    {":method", "DELETE"},                      // 6
-    {":method", "GET"},                         // 7
-    {":method", "HEAD"},                        // 8
-    {":method", "OPTIONS"},                     // 9
-    {":method", "POST"},                        // 10
-    {":method", "PUT"},                         // 11
-    {":scheme", "http"},                        // 12
-    {":scheme", "https"},                       // 13
-    {":status", "103"},                         // 14
-    {":status", "200"},                         // 15
-    {":status", "304"},                         // 16
-    {":status", "404"},                         // 17
-    {":status", "503"},                         // 18
-    {":status", "100"},                         // 19
-    {":status", "204"},                         // 20
-    {":status", "206"},                         // 21
-    {":status", "300"},                         // 22
-    {":status", "400"},                         // 23
-    {":status", "403"},                         // 24
-    {":status", "421"},                         // 25
-    {":status", "425"},                         // 26
-    {":status", "500"},                         // 27
-    {"accept-charset", ""},                     // 28
-    {"accept-encoding", "gzip, deflate, br"},  // 29
-    {"accept-language", ""},                    // 30
-    {"accept-ranges", ""},                      // 31
-    {"accept", ""},                             // 32
-    {"access-control-allow-headers", ""},       // 33
-    {"access-control-allow-methods", ""},       // 34
-    {"access-control-allow-origin", ""},        // 35
-    {"age", ""},                                // 36
-    {"allow", ""},                              // 37
-    {"authorization", ""},                      // 38
-    {"cache-control", ""},                      // 39
-    {"content-disposition", ""},                // 40
-    {"content-encoding", ""},                   // 41
-    {"content-language", ""},                   // 42
-    {"content-length", ""},                     // 43
-    {"content-location", ""},                   // 44
-    {"content-range", ""},                      // 45
-    {"content-type", ""},                       // 46
-    {"cookie", ""},                             // 47
-    {"date", ""},                               // 48
-    {"etag", ""},                               // 49
-    {"expect", ""},                             // 50
-    {"expires", ""},                            // 51
-    {"from", ""},                               // 52
-    {"host", ""},                               // 53
-    {"if-match", ""},                           // 54
-    {"if-modified-since", ""},                  // 55
-    {"if-none-match", ""},                      // 56
-    {"if-range", ""},                           // 57
-    {"if-unmodified-since", ""},                // 58
-    {"last-modified", ""},                      // 59
-    {"link", ""},                               // 60
-    {"location", ""},                           // 61
-    {"max-forwards", ""},                       // 62
-    {"proxy-authenticate", ""},                 // 63
-    {"proxy-authorization", ""},                // 64
-    {"range", ""},                              // 65
-    {"referer", ""},                            // 66
-    {"refresh", ""},                            // 67
-    {"retry-after", ""},                        // 68
-    {"server", ""},                             // 69
-    {"set-cookie", ""},                         // 70
-    {"strict-transport-security", ""},          // 71
-    {"transfer-encoding", ""},                  // 72
-    {"user-agent", ""},                         // 73
-    {"vary", ""},                               // 74
-    {"via", ""},                                // 75
-    {"www-authenticate", ""},                   // 76
-    {"accept-encoding", "gzip, deflate"},      // 77
-    {"accept-language", "en"},                  // 78
-    {"cache-control", "max-age=0"},             // 79
-    {"cache-control", "no-cache"},              // 80
-    {"content-encoding", "br"},                 // 81
-    {"content-encoding", "gzip"},               // 82
-    {"content-type", "application/dns-message"}, // 83
-    {"content-type", "application/javascript"}, // 84
-    {"content-type", "application/json"},       // 85
-    {"content-type", "application/octet-stream"}, // 86
-    {"content-type", "text/css"},               // 87
-    {"content-type", "text/html; charset=utf-8"}, // 88
-    {"content-type", "text/plain"},             // 89
-    {"content-type", "text/plain;charset=utf-8"}, // 90
-    {"range", "bytes=0-"},                      // 91
-    {"strict-transport-security", "max-age=31536000"}, // 92
-    {"strict-transport-security", "max-age=31536000; includesubdomains"}, // 93
-    {"strict-transport-security", "max-age=31536000; includesubdomains; preload"}, // 94
-    {"vary", "accept-encoding"},                // 95
-    {"vary", "origin"},                         // 96
-    {"x-content-type-options", "nosniff"},      // 97
-    {"x-xss-protection", "1; mode=block"},      // 98
-} };
-
-class QpackEncoder {
-private:
-    std::vector<uint8_t> buffer;
-
-    void encodeInteger(uint64_t value, uint8_t prefix_bits, uint8_t prefix_pattern = 0) {
-        uint64_t max_prefix = (1ULL << prefix_bits) - 1;
-
-        if (value < max_prefix) {
-            buffer.push_back(static_cast<uint8_t>(prefix_pattern | value));
-        }
-        else {
-            buffer.push_back(static_cast<uint8_t>(prefix_pattern | max_prefix));
-            value -= max_prefix;
-
-            while (value >= 128) {
-                buffer.push_back(static_cast<uint8_t>((value & 0x7F) | 0x80));
-                value >>= 7;
-            }
-            buffer.push_back(static_cast<uint8_t>(value));
-        }
-    }
-
-    void encodeString(std::string_view str, bool huffman = false) {
-        // For simplicity, we'll skip Huffman encoding
-        encodeInteger(str.length(), 7, huffman ? 0x80 : 0x00);
-        buffer.insert(buffer.end(), str.begin(), str.end());
-    }
-
-    int findStaticTableIndex(std::string_view name, std::string_view value) {
-        for (size_t i = 1; i < QPACK_STATIC_TABLE.size(); ++i) {
-            if (QPACK_STATIC_TABLE[i].name == name && QPACK_STATIC_TABLE[i].value == value) {
-                return static_cast<int>(i);
-            }
-        }
-        return -1;
-    }
-
-    int findStaticTableNameIndex(std::string_view name) {
-        for (size_t i = 1; i < QPACK_STATIC_TABLE.size(); ++i) {
-            if (QPACK_STATIC_TABLE[i].name == name) {
-                return static_cast<int>(i);
-            }
-        }
-        return -1;
-    }
-
-public:
-    void clear() { buffer.clear(); }
-
-    void encodeHeader(std::string_view name, std::string_view value) {
-        int exact_match = findStaticTableIndex(name, value);
-        if (exact_match >= 0) {
-            // Static table reference with exact match
-            encodeInteger(exact_match, 6, 0x80);  // 10xxxxxx pattern
-            return;
-        }
-
-        int name_match = findStaticTableNameIndex(name);
-        if (name_match >= 0) {
-            // Static table name reference with literal value
-            encodeInteger(name_match, 6, 0x40);  // 01xxxxxx pattern
-            encodeString(value);
-        }
-        else {
-            // Literal name and value
-            buffer.push_back(0x20);  // 001xxxxx pattern (literal with incremental indexing)
-            encodeString(name);
-            encodeString(value);
-        }
-    }
-
-    std::vector<uint8_t> getEncoded() const { return buffer; }
+// QPACK state of the connection. MsQuic runs the connection's callbacks one at a time on
+// its worker, and only they touch these. The encoder fills the server's dynamic table once
+// its SETTINGS allow one; the decoder applies the server's encoder stream.
+QpackEncoder Encoder;
+QpackDecoder Decoder;
+
+// What a client stream carries
+enum class StreamRole {
+    Control,        // Our control stream with SETTINGS
+    Connect,        // The WebTransport CONNECT request stream
+    QpackEncoder,   // Our QPACK encoder stream
+    QpackDecoder,   // Our QPACK decoder stream
+    Peer,           // A stream the server opened, until its type is known
+    ServerControl,  // The server's control stream
+    ServerEncoder,  // The server's QPACK encoder stream
+    ServerDecoder,  // The server's QPACK decoder stream
+    WebTransport,   // A bidirectional stream of our WebTransport session
 };
 
-class Http3FrameBuilder {
-public:
-    enum Type : uint8_t {
-        DATA = 0x00,
-        HEADERS = 0x01,
-        SETTINGS = 0x04,
-        MAX_PUSH_ID = 0x0D,
-        WEBTRANSPORT_STREAM = 0x41
-    };
-
-    static std::vector<uint8_t> createHeadersFrame(const std::vector<uint8_t>& qpackData) {
-        std::vector<uint8_t> frame;
-
-        // Frame type (HEADERS = 0x01)
-        frame.push_back(HEADERS);
-
-        // Frame length
-        encodeVarint(frame, qpackData.size());
-
-        // QPACK encoded headers
-        frame.insert(frame.end(), qpackData.begin(), qpackData.end());
-
-        return frame;
-    }
-
-    static std::vector<uint8_t> createSettingsFrame() {
-        std::vector<uint8_t> frame;
-
-        // Frame type (SETTINGS = 0x04)
-        frame.push_back(SETTINGS);
-
-        // Build settings payload
-        std::vector<uint8_t> payload;
-
-        // Setting 1: ENABLE_WEBTRANSPORT (0x2b603742) = 1
-        // Setting ID as varint
-        payload.push_back(0x2b);
-        payload.push_back(0x60);
-        payload.push_back(0x37);
-        payload.push_back(0x42);
-        // Value = 1
-        payload.push_back(0x01);
-
-        // Setting 2: MAX_FIELD_SECTION_SIZE (0x06) = 16384 (recommended)
-        payload.push_back(0x06);  // Setting ID
-        payload.push_back(0x80);  // Value = 16384 (as varint: 0x8000 + 0x4000)
-        payload.push_back(0x00);
-        payload.push_back(0x40);
-        payload.push_back(0x00);
-
-        // Setting 3: QPACK_MAX_TABLE_CAPACITY (0x01) = 0 (no dynamic table)
-        payload.push_back(0x01);  // Setting ID
-        payload.push_back(0x00);  // Value = 0
-
-        // Frame length (as varint)
-        encodeVarint(frame, payload.size());
-
-        // Append payload
-        frame.insert(frame.end(), payload.begin(), payload.end());
-
-        std::cout << "[FrameBuilder] Created SETTINGS frame: ";
-        for (size_t i = 0; i < frame.size(); ++i) {
-            std::cout << std::format("{:02x} ", static_cast<int>(frame[i]));
+// Per-stream state and the MsQuic callback context of every stream. The ID is cached once
+// MsQuic assigns it - START_COMPLETE for our streams, PEER_STREAM_STARTED for the server's -
+// so stream events never ask MsQuic for it. Deleted at the stream's SHUTDOWN_COMPLETE.
+struct StreamContext {
+    static constexpr uint64_t UNKNOWN_ID = UINT64_MAX;
+
+    StreamContext(StreamRole role, bool unidirectional, uint64_t id = UNKNOWN_ID)
+        : role(role), unidirectional(unidirectional), id(id), decoder(unidirectional) {
+        // Past the WEBTRANSPORT_STREAM signal we send, both directions carry plain data
+        if (role == StreamRole::WebTransport) {
+            decoder.enterRawMode();
         }
-        std::cout << "\n";
-
-        return frame;
     }
 
-    static std::vector<uint8_t> createMaxPushIdFrame() {
-        std::vector<uint8_t> frame;
-
-        // Frame type
-        frame.push_back(MAX_PUSH_ID);
-
-        // Frame length (1 byte for push ID = 0)
-        frame.push_back(0x01);
+    StreamRole role;
+    bool unidirectional;
+    uint64_t id;
 
-        // Push ID = 0
-        frame.push_back(0x00);
-
-        return frame;
-    }
-
-private:
-    static void encodeVarint(std::vector<uint8_t>& buffer, uint64_t value) {
-        if (value < 64) {
-            buffer.push_back(static_cast<uint8_t>(value));
-        }
-        else if (value < 16384) {
-            buffer.push_back(static_cast<uint8_t>(0x40 | (value >> 8)));
-            buffer.push_back(static_cast<uint8_t>(value & 0xFF));
-        }
-        else if (value < 1073741824) {
-            buffer.push_back(static_cast<uint8_t>(0x80 | (value >> 24)));
-            buffer.push_back(static_cast<uint8_t>((value >> 16) & 0xFF));
-            buffer.push_back(static_cast<uint8_t>((value >> 8) & 0xFF));
-            buffer.push_back(static_cast<uint8_t>(value & 0xFF));
-        }
-        else {
-            // 62-bit encoding for very large values
-            buffer.push_back(static_cast<uint8_t>(0xC0 | (value >> 56)));
-            for (int i = 7; i >= 0; --i) {
-                buffer.push_back(static_cast<uint8_t>((value >> (i * 8)) & 0xFF));
-            }
-        }
-    }
+    // Frames may be split across RECEIVE events, so each stream keeps its own decoder
+    QuicFrameDecoder decoder;
 };
 
-// Global variables for MsQuic
-const QUIC_API_TABLE* MsQuic = nullptr;
-HQUIC Registration = nullptr;
-HQUIC Configuration = nullptr;
-HQUIC Connection = nullptr;
-HQUIC ControlStream = nullptr;
-HQUIC ConnectStream = nullptr;
-
-bool WebTransportEstablished = false;
-
 // Forward declarations
 _IRQL_requires_max_(PASSIVE_LEVEL)
 _Function_class_(QUIC_STREAM_CALLBACK)
@@ -352,282 +128,446 @@ static void DescribeQuicStatus(QUIC_STATUS status, const std::string& message) {
 
 // Fixed SendSettingsFrame with proper error handling and QUIC_SUCCEEDED check
 static void SendSettingsFrame(HQUIC connection) {
-    std::cout << getClientTimestamp() << " === STEP 1: Sending SETTINGS frame on control stream ===" << std::endl;
+    HTTP3_LOG_DEBUG("=== STEP 1: Sending SETTINGS frame on control stream ===");
 
-    // Create HTTP/3 control stream data with STATIC storage to prevent corruption
-    static std::vector<uint8_t> controlStreamData;
-    controlStreamData.clear();  // Clear any previous data
+    // The bytes and their QUIC_BUFFER must outlive the send, so both live in a pooled buffer
+    // that SEND_COMPLETE hands back
+    QuicSendBuffer* sendBuffer = QuicSendBufferPool::acquire();
+    Http3FrameWriter writer = sendBuffer->writer(64);
 
-    std::cout << getClientTimestamp() << " Creating control stream data...\n";
+    HTTP3_LOG_DEBUG("Creating control stream data...");
 
     // FIRST: Add control stream type identifier (0x00 for HTTP/3 control stream)
-    std::cout << getClientTimestamp() << " Adding control stream type identifier (0x00)\n";
-    controlStreamData.push_back(0x00);
+    HTTP3_LOG_DEBUG("Adding control stream type identifier (0x00)");
+    writer.writeVarint(0x00);
 
     // Verify immediately after adding
-    std::cout << getClientTimestamp() << " Verification after adding 0x00: controlStreamData[0] = 0x"
-        << std::hex << (int)controlStreamData[0] << std::dec << std::endl;
-
-    // THEN: Add the SETTINGS frame
-    std::cout << getClientTimestamp() << " Creating SETTINGS frame...\n";
-    auto settingsFrame = Http3FrameBuilder::createSettingsFrame();
+    HTTP3_LOG_TRACE("Verification after adding 0x00: controlStreamData[0] = 0x{}", Http3LogHex{ writer.written()[0] });
 
-    std::cout << getClientTimestamp() << " SETTINGS frame created (" << settingsFrame.size() << " bytes): ";
-    for (size_t i = 0; i < settingsFrame.size(); ++i) {
-        std::cout << std::hex << std::setw(2) << std::setfill('0') << (int)settingsFrame[i] << " ";
+    // THEN: Write the SETTINGS frame straight after it
+    HTTP3_LOG_DEBUG("Creating SETTINGS frame...");
+    if (!Http3FrameBuilder::writeSettingsFrame(writer, CLIENT_SETTINGS)) {
+        HTTP3_LOG_ERROR("ERROR: SETTINGS frame does not fit the control stream buffer");
+        QuicSendBufferPool::release(sendBuffer);
+        return;
     }
-    std::cout << std::dec << std::endl;
-
-    std::cout << getClientTimestamp() << " Inserting SETTINGS frame into control stream data...\n";
-    controlStreamData.insert(controlStreamData.end(), settingsFrame.begin(), settingsFrame.end());
+    sendBuffer->commit(writer);
+    auto controlStreamData = sendBuffer->bytes();
 
     // Debug output - show the complete data we're about to send
-    std::cout << getClientTimestamp() << " Complete control stream data (" << controlStreamData.size() << " bytes):\n";
-    std::cout << getClientTimestamp() << "   ";
-    for (size_t i = 0; i < controlStreamData.size(); ++i) {
-        std::cout << std::hex << std::setw(2) << std::setfill('0') << (int)controlStreamData[i] << " ";
-        if ((i + 1) % 16 == 0) {
-            std::cout << "\n" << getClientTimestamp() << "   ";
-        }
-    }
-    std::cout << std::dec << std::endl;
+    HTTP3_LOG_TRACE("Complete control stream data ({} bytes): {}", controlStreamData.size(), Http3LogBytes{ controlStreamData, 64 });
 
     // Verification: Double-check the first byte is 0x00
     if (!controlStreamData.empty() && controlStreamData[0] != 0x00) {
-        std::cout << getClientTimestamp() << " ERROR: Control stream type corrupted! Expected 0x00, got: 0x"
-            << std::hex << (int)controlStreamData[0] << std::dec << std::endl;
+        HTTP3_LOG_ERROR("ERROR: Control stream type corrupted! Expected 0x00, got: 0x{}", Http3LogHex{ controlStreamData[0] });
+        QuicSendBufferPool::release(sendBuffer);
         return;
     }
     else {
-        std::cout << getClientTimestamp() << " SUCCESS: Control stream type verified as 0x00\n";
+        HTTP3_LOG_DEBUG("SUCCESS: Control stream type verified as 0x00");
     }
 
     // Create UNIDIRECTIONAL control stream (this will be stream ID 2)
-    std::cout << getClientTimestamp() << " Creating unidirectional control stream...\n";
+    HTTP3_LOG_DEBUG("Creating unidirectional control stream...");
+    auto* streamContext = new StreamContext(StreamRole::Control, true);
     QUIC_STATUS status = MsQuic->StreamOpen(
         connection,
         QUIC_STREAM_OPEN_FLAG_UNIDIRECTIONAL,  // Critical: Must be unidirectional
         ClientStreamCallback,
-        reinterpret_cast<void*>(0x1000),  // Special context to identify control stream
+        streamContext,
         &ControlStream
     );
 
     if (QUIC_FAILED(status)) {
-        DescribeQuicStatus(status, getClientTimestamp() + " FAILED to open control stream");
+        DescribeQuicStatus(status, "[Client] FAILED to open control stream");
+        delete streamContext;
+        QuicSendBufferPool::release(sendBuffer);
         return;
     }
 
-    std::cout << getClientTimestamp() << " Control stream created successfully (handle: " << std::hex << ControlStream << std::dec << ")\n";
+    HTTP3_LOG_DEBUG("Control stream created successfully (handle: {})", ControlStream);
 
     // Start the control stream immediately
-    std::cout << getClientTimestamp() << " Starting control stream...\n";
+    HTTP3_LOG_DEBUG("Starting control stream...");
     status = MsQuic->StreamStart(ControlStream, QUIC_STREAM_START_FLAG_IMMEDIATE);
     if (QUIC_FAILED(status)) {
-        DescribeQuicStatus(status, getClientTimestamp() + " FAILED to start control stream");
-        MsQuic->StreamClose(ControlStream);
+        DescribeQuicStatus(status, "[Client] FAILED to start control stream");
+        MsQuic->StreamClose(ControlStream);  // Never started, so no SHUTDOWN_COMPLETE
         ControlStream = nullptr;
+        delete streamContext;
+        QuicSendBufferPool::release(sendBuffer);
         return;
     }
 
-    std::cout << getClientTimestamp() << " Control stream started successfully\n";
+    HTTP3_LOG_DEBUG("Control stream started successfully");
 
     // CRITICAL: Add a longer delay to ensure stream is fully ready
-    std::cout << getClientTimestamp() << " Waiting for stream to be fully ready...\n";
+    HTTP3_LOG_DEBUG("Waiting for stream to be fully ready...");
     std::this_thread::sleep_for(std::chrono::milliseconds(200));  // Increased delay
 
-    // Create buffer with explicit verification just before sending
-    QUIC_BUFFER controlBuf = {};
-    controlBuf.Buffer = controlStreamData.data();
-    controlBuf.Length = static_cast<uint32_t>(controlStreamData.size());
-
     // Final verification of buffer contents before sending
-    std::cout << getClientTimestamp() << " === FINAL BUFFER VERIFICATION BEFORE SEND ===\n";
-    std::cout << getClientTimestamp() << " Buffer address: " << std::hex << (void*)controlBuf.Buffer << std::dec << "\n";
-    std::cout << getClientTimestamp() << " Buffer length: " << controlBuf.Length << "\n";
-    std::cout << getClientTimestamp() << " Static vector address: " << std::hex << (void*)controlStreamData.data() << std::dec << "\n";
-    std::cout << getClientTimestamp() << " Static vector size: " << controlStreamData.size() << "\n";
-
-    // Verify buffer points to static data
-    if (controlBuf.Buffer == controlStreamData.data()) {
-        std::cout << getClientTimestamp() << " SUCCESS: Buffer points to static vector data\n";
-    }
-    else {
-        std::cout << getClientTimestamp() << " ERROR: Buffer does not point to static vector data!\n";
-    }
+    const QUIC_BUFFER& controlBuf = *sendBuffer->buffers();
+    HTTP3_LOG_DEBUG("=== FINAL BUFFER VERIFICATION BEFORE SEND ===");
+    HTTP3_LOG_TRACE("Buffer address: {}", (void*)controlBuf.Buffer);
+    HTTP3_LOG_TRACE("Buffer length: {}", controlBuf.Length);
 
     // Ensure first byte is still 0x00
     if (controlBuf.Length > 0 && controlBuf.Buffer[0] != 0x00) {
-        std::cout << getClientTimestamp() << " CRITICAL: Buffer corrupted just before send! First byte: 0x"
-            << std::hex << (int)controlBuf.Buffer[0] << std::dec << std::endl;
+        HTTP3_LOG_ERROR("CRITICAL: Buffer corrupted just before send! First byte: 0x{}", Http3LogHex{ controlBuf.Buffer[0] });
+        QuicSendBufferPool::release(sendBuffer);
         return;
     }
     else {
-        std::cout << getClientTimestamp() << " SUCCESS: First byte verified as 0x00 just before send\n";
+        HTTP3_LOG_DEBUG("SUCCESS: First byte verified as 0x00 just before send");
     }
 
     // Send the control stream data (stream type + SETTINGS frame)
-    std::cout << getClientTimestamp() << " === CALLING MsQuic->StreamSend ===\n";
-    std::cout << getClientTimestamp() << " Stream: " << std::hex << ControlStream << std::dec << "\n";
-    std::cout << getClientTimestamp() << " Buffer: " << std::hex << (void*)controlBuf.Buffer << std::dec << "\n";
-    std::cout << getClientTimestamp() << " Length: " << controlBuf.Length << "\n";
+    HTTP3_LOG_DEBUG("=== CALLING MsQuic->StreamSend ===");
+    HTTP3_LOG_TRACE("Stream: {}", ControlStream);
+    HTTP3_LOG_TRACE("Buffer: {}", (void*)controlBuf.Buffer);
+    HTTP3_LOG_TRACE("Length: {}", controlBuf.Length);
 
-    status = MsQuic->StreamSend(ControlStream, &controlBuf, 1, QUIC_SEND_FLAG_NONE, nullptr);  // Changed to NONE
+    status = MsQuic->StreamSend(ControlStream, sendBuffer->buffers(), sendBuffer->bufferCount(), QUIC_SEND_FLAG_NONE, sendBuffer);
 
-    std::cout << getClientTimestamp() << " StreamSend returned: 0x" << std::hex << status << std::dec << "\n";
+    HTTP3_LOG_DEBUG("StreamSend returned: 0x{}", Http3LogHex{ status });
 
     // EXPLICIT STATUS ANALYSIS
-    std::cout << getClientTimestamp() << " === STATUS ANALYSIS ===\n";
-    std::cout << getClientTimestamp() << " Raw status value: 0x" << std::hex << status << std::dec << "\n";
-    std::cout << getClientTimestamp() << " Status as signed int: " << (int32_t)status << "\n";
-    std::cout << getClientTimestamp() << " Status as unsigned int: " << (uint32_t)status << "\n";
-
-    // Test different success conditions
-    std::cout << getClientTimestamp() << " QUIC_STATUS_SUCCESS = 0x" << std::hex << QUIC_STATUS_SUCCESS << std::dec << "\n";
-    std::cout << getClientTimestamp() << " QUIC_STATUS_PENDING = 0x" << std::hex << QUIC_STATUS_PENDING << std::dec << "\n";
-
-    // Manual checks
-    bool isSuccess = (status == QUIC_STATUS_SUCCESS);
-    bool isPending = (status == QUIC_STATUS_PENDING);
-    bool isQuicFailed = QUIC_FAILED(status);
-    bool isQuicSucceeded = QUIC_SUCCEEDED(status);
-
-    std::cout << getClientTimestamp() << " status == QUIC_STATUS_SUCCESS: " << (isSuccess ? "TRUE" : "FALSE") << "\n";
-    std::cout << getClientTimestamp() << " status == QUIC_STATUS_PENDING: " << (isPending ? "TRUE" : "FALSE") << "\n";
-    std::cout << getClientTimestamp() << " QUIC_FAILED(status): " << (isQuicFailed ? "TRUE" : "FALSE") << "\n";
-    std::cout << getClientTimestamp() << " QUIC_SUCCEEDED(status): " << (isQuicSucceeded ? "TRUE" : "FALSE") << "\n";
-
-    // Explicit value comparisons
-    if (status == 0x0) {
-        std::cout << getClientTimestamp() << " Status is 0x0 (QUIC_STATUS_SUCCESS)\n";
-    }
-    else if (status == 0x703e5) {
-        std::cout << getClientTimestamp() << " Status is 0x703e5 (the error we've been seeing)\n";
-    }
-    else if (status == QUIC_STATUS_PENDING) {
-        std::cout << getClientTimestamp() << " Status is QUIC_STATUS_PENDING (operation pending)\n";
-    }
-    else {
-        std::cout << getClientTimestamp() << " Status is some other value\n";
+    if constexpr (Http3Log::enabled(HTTP3_LOG_LEVEL_TRACE)) {
+        HTTP3_LOG_TRACE("=== STATUS ANALYSIS ===");
+        HTTP3_LOG_TRACE("Raw status value: 0x{}", Http3LogHex{ status });
+        HTTP3_LOG_TRACE("Status as signed int: {}", (int32_t)status);
+        HTTP3_LOG_TRACE("Status as unsigned int: {}", (uint32_t)status);
+
+        // Test different success conditions
+        HTTP3_LOG_TRACE("QUIC_STATUS_SUCCESS = 0x{}", Http3LogHex{ QUIC_STATUS_SUCCESS });
+        HTTP3_LOG_TRACE("QUIC_STATUS_PENDING = 0x{}", Http3LogHex{ QUIC_STATUS_PENDING });
+
+        // Manual checks
+        bool isSuccess = (status == QUIC_STATUS_SUCCESS);
+        bool isPending = (status == QUIC_STATUS_PENDING);
+        bool isQuicFailed = QUIC_FAILED(status);
+        bool isQuicSucceeded = QUIC_SUCCEEDED(status);
+
+        HTTP3_LOG_TRACE("status == QUIC_STATUS_SUCCESS: {}", isSuccess ? "TRUE" : "FALSE");
+        HTTP3_LOG_TRACE("status == QUIC_STATUS_PENDING: {}", isPending ? "TRUE" : "FALSE");
+        HTTP3_LOG_TRACE("QUIC_FAILED(status): {}", isQuicFailed ? "TRUE" : "FALSE");
+        HTTP3_LOG_TRACE("QUIC_SUCCEEDED(status): {}", isQuicSucceeded ? "TRUE" : "FALSE");
+
+        // Explicit value comparisons
+        if (status == 0x0) {
+            HTTP3_LOG_TRACE("Status is 0x0 (QUIC_STATUS_SUCCESS)");
+        }
+        else if (status == 0x703e5) {
+            HTTP3_LOG_TRACE("Status is 0x703e5 (the error we've been seeing)");
+        }
+        else if (status == QUIC_STATUS_PENDING) {
+            HTTP3_LOG_TRACE("Status is QUIC_STATUS_PENDING (operation pending)");
+        }
+        else {
+            HTTP3_LOG_TRACE("Status is some other value");
+        }
     }
 
     // DEFINITIVE ERROR CHECK
     if (status != QUIC_STATUS_SUCCESS && status != QUIC_STATUS_PENDING) {
-        std::cout << getClientTimestamp() << " === STREAM SEND FAILED ===\n";
-        std::cout << getClientTimestamp() << " ERROR: StreamSend FAILED with status 0x" << std::hex << status << std::dec << "\n";
-        DescribeQuicStatus(status, getClientTimestamp() + " StreamSend failure details");
+        HTTP3_LOG_ERROR("=== STREAM SEND FAILED ===");
+        HTTP3_LOG_ERROR("ERROR: StreamSend FAILED with status 0x{}", Http3LogHex{ status });
+        DescribeQuicStatus(status, "[Client] StreamSend failure details");
 
         // Decode the specific error we're seeing
         if (status == 0x703e5) {
-            std::cout << getClientTimestamp() << " This appears to be a stream-specific error\n";
-            std::cout << getClientTimestamp() << " Possible causes:\n";
-            std::cout << getClientTimestamp() << "   - Stream not fully started\n";
-            std::cout << getClientTimestamp() << "   - Stream already closed\n";
-            std::cout << getClientTimestamp() << "   - Invalid stream state\n";
-            std::cout << getClientTimestamp() << "   - Buffer/data issues\n";
+            HTTP3_LOG_ERROR("This appears to be a stream-specific error");
+            HTTP3_LOG_ERROR("Possible causes:");
+            HTTP3_LOG_ERROR("  - Stream not fully started");
+            HTTP3_LOG_ERROR("  - Stream already closed");
+            HTTP3_LOG_ERROR("  - Invalid stream state");
+            HTTP3_LOG_ERROR("  - Buffer/data issues");
         }
 
-        std::cout << getClientTimestamp() << " FAILED: Control stream SETTINGS send failed!\n";
-        std::cout << getClientTimestamp() << " === SETTINGS SEND FAILED ===\n";
+        HTTP3_LOG_ERROR("FAILED: Control stream SETTINGS send failed!");
+        HTTP3_LOG_ERROR("=== SETTINGS SEND FAILED ===");
+        QuicSendBufferPool::release(sendBuffer);
         return;
     }
     else {
-        std::cout << getClientTimestamp() << " === STREAM SEND SUCCESS ===\n";
+        HTTP3_LOG_DEBUG("=== STREAM SEND SUCCESS ===");
         if (status == QUIC_STATUS_SUCCESS) {
-            std::cout << getClientTimestamp() << " Send completed immediately (synchronous)\n";
+            HTTP3_LOG_DEBUG("Send completed immediately (synchronous)");
         }
         else if (status == QUIC_STATUS_PENDING) {
-            std::cout << getClientTimestamp() << " Send is pending (asynchronous)\n";
+            HTTP3_LOG_DEBUG("Send is pending (asynchronous)");
         }
     }
 
-    std::cout << getClientTimestamp() << " SUCCESS: SETTINGS frame sent successfully (" << controlStreamData.size() << " bytes)\n";
-    std::cout << getClientTimestamp() << " SUCCESS: Control stream (ID 2) established with SETTINGS\n";
-    std::cout << getClientTimestamp() << " === SETTINGS SEND COMPLETE ===\n";
+    HTTP3_LOG_INFO("SUCCESS: SETTINGS frame sent successfully ({} bytes)", controlStreamData.size());
+    HTTP3_LOG_INFO("SUCCESS: Control stream (ID 2) established with SETTINGS");
+    HTTP3_LOG_DEBUG("=== SETTINGS SEND COMPLETE ===");
 }
 
-static void SendWebTransportConnect(HQUIC connection, const std::string& host, const std::string& path) {
-    std::cout << "[Client] Sending WebTransport CONNECT request\n";
+// Send QPACK instructions on one of our QPACK streams, opening it with its stream type on
+// first use. The instructions are a view of the codec's pending buffer, copied straight into
+// a pooled send buffer; the caller clears them only when this returns true, so nothing is
+// lost if the stream fails to open.
+static bool SendQpackInstructions(HQUIC connection, HQUIC& qpackStream, StreamRole role, uint64_t streamType, std::span<const uint8_t> instructions) {
+    if (instructions.empty()) {
+        return false;
+    }
+
+    bool openedStream = false;
+    if (qpackStream == nullptr) {
+        HQUIC stream = nullptr;
+        auto* streamContext = new StreamContext(role, true);
+        QUIC_STATUS status = MsQuic->StreamOpen(connection, QUIC_STREAM_OPEN_FLAG_UNIDIRECTIONAL, ClientStreamCallback, streamContext, &stream);
+        if (QUIC_SUCCEEDED(status)) {
+            status = MsQuic->StreamStart(stream, QUIC_STREAM_START_FLAG_IMMEDIATE);
+            if (QUIC_FAILED(status)) {
+                MsQuic->StreamClose(stream);
+            }
+        }
+        if (QUIC_FAILED(status)) {
+            delete streamContext;
+            DescribeQuicStatus(status, "[Client] Failed to open QPACK stream");
+            return false;
+        }
+        qpackStream = stream;
+        openedStream = true;
+        HTTP3_LOG_DEBUG("QPACK stream type 0x{} opened: {}", Http3LogHex{ streamType }, stream);
+    }
 
-    // Build QPACK encoded headers for WebTransport CONNECT
-    QpackEncoder encoder;
-    encoder.encodeHeader(":method", "CONNECT");
-    encoder.encodeHeader(":protocol", "webtransport");
-    encoder.encodeHeader(":scheme", "https");
-    encoder.encodeHeader(":authority", host);
-    encoder.encodeHeader(":path", path);
+    // The bytes must outlive the send; SEND_COMPLETE returns the buffer to the pool
+    QuicSendBuffer* sendBuffer = QuicSendBufferPool::acquire();
+    Http3FrameWriter writer = sendBuffer->writer(instructions.size() + 1);
+    if (openedStream) {
+        writer.writeVarint(streamType);
+    }
+    writer.writeBytes(instructions);
+    sendBuffer->commit(writer);
 
-    auto qpackData = encoder.getEncoded();
-    // Make headersFrame static or ensure it stays in scope
-    static std::vector<uint8_t> headersFrame = Http3FrameBuilder::createHeadersFrame(qpackData);
+    QUIC_STATUS status = MsQuic->StreamSend(qpackStream, sendBuffer->buffers(), sendBuffer->bufferCount(), QUIC_SEND_FLAG_NONE, sendBuffer);
+    if (QUIC_FAILED(status)) {
+        DescribeQuicStatus(status, "[Client] Failed to send QPACK instructions");
+        QuicSendBufferPool::release(sendBuffer);
+        return false;
+    }
+    HTTP3_LOG_DEBUG("Sent {} bytes of QPACK instructions on stream type 0x{}", writer.size(), Http3LogHex{ streamType });
+    return true;
+}
 
-    // debug -begin
-    std::cout << "[Client] HEADERS frame bytes (" << headersFrame.size() << "): ";
-    size_t maxPrint = (headersFrame.size() < 32) ? headersFrame.size() : 32;
-    for (size_t i = 0; i < maxPrint; ++i) {
-        std::cout << std::format("{:02x} ", static_cast<int>(headersFrame[i]));
+// Dynamic table inserts (and the capacity that precedes them) for the server's decoder
+static void SendEncoderInstructions(HQUIC connection) {
+    if (SendQpackInstructions(connection, EncoderStream, StreamRole::QpackEncoder, Http3StreamType::QPACK_ENCODER, Encoder.pendingEncoderStreamData())) {
+        Encoder.clearEncoderStreamData();
     }
-    if (headersFrame.size() > 32) {
-        std::cout << "... (+" << (headersFrame.size() - 32) << " more)";
+}
+
+// Insert count increments and section acknowledgements for the server's encoder
+static void SendDecoderInstructions(HQUIC connection) {
+    if (SendQpackInstructions(connection, DecoderStream, StreamRole::QpackDecoder, Http3StreamType::QPACK_DECODER, Decoder.pendingDecoderStreamData())) {
+        Decoder.clearDecoderStreamData();
     }
-    std::cout << "\n";
-    // debug -end
+}
 
+// Open the CONNECT stream; START_COMPLETE sends the request on it (SendConnectRequest)
+static void SendWebTransportConnect(HQUIC connection, const std::string& host, const std::string& path) {
+    HTTP3_LOG_DEBUG("[Client] Sending WebTransport CONNECT request");
+    ConnectAuthority = host;
+    ConnectPath = path;
+
+    auto* streamContext = new StreamContext(StreamRole::Connect, false);
     QUIC_STATUS status = MsQuic->StreamOpen(
         connection,
         QUIC_STREAM_OPEN_FLAG_NONE,  // Bidirectional stream
         ClientStreamCallback,        // Properly annotated callback
-        connection,                  // Non-null context (connection handle)
+        streamContext,
         &ConnectStream
     );
 
     if (QUIC_FAILED(status)) {
         DescribeQuicStatus(status, "[Client] Failed to open CONNECT stream");
+        delete streamContext;
         return;
     }
 
     status = MsQuic->StreamStart(ConnectStream, QUIC_STREAM_START_FLAG_IMMEDIATE);
     if (QUIC_FAILED(status)) {
         DescribeQuicStatus(status, "[Client] Failed to start CONNECT stream");
+        MsQuic->StreamClose(ConnectStream);  // Never started, so no SHUTDOWN_COMPLETE
+        ConnectStream = nullptr;
+        delete streamContext;
+        return;
+    }
+
+    HTTP3_LOG_DEBUG("[Client] Connect stream started successfully");
+}
+
+// Send the CONNECT request on its stream. Dynamic references are acknowledged per request
+// stream, so the section is tied to the ID that START_COMPLETE has just reported.
+static void SendConnectRequest(HQUIC connectStream, uint64_t streamId) {
+    Encoder.beginSection(streamId);
+
+    // Build QPACK encoded headers for WebTransport CONNECT
+    Encoder.encodeHeader(":method", "CONNECT");
+    Encoder.encodeHeader(":protocol", "webtransport");
+    Encoder.encodeHeader(":scheme", "https");
+    Encoder.encodeHeader(":authority", ConnectAuthority);
+    Encoder.encodeHeader(":path", ConnectPath);
+
+    // Whatever the section inserted goes out on the encoder stream ahead of the request
+    SendEncoderInstructions(Connection);
+
+    // The frame and its QUIC_BUFFER must outlive the send; SEND_COMPLETE returns them to the pool
+    QuicSendBuffer* sendBuffer = QuicSendBufferPool::acquire();
+    Http3FrameWriter writer = sendBuffer->writer(1024);
+    if (!Http3FrameBuilder::writeHeadersFrame(writer, Encoder.encoded())) {
+        HTTP3_LOG_ERROR("[Client] ERROR: HEADERS frame does not fit the request buffer");
+        QuicSendBufferPool::release(sendBuffer);
+        MsQuic->StreamShutdown(connectStream, QUIC_STREAM_SHUTDOWN_FLAG_ABORT, Http3ErrorCode::H3_REQUEST_CANCELLED);
         return;
     }
+    sendBuffer->commit(writer);
+    auto headersFrame = sendBuffer->bytes();
+
+    // debug -begin
+    HTTP3_LOG_TRACE("[Client] HEADERS frame bytes ({}): {}", headersFrame.size(), Http3LogBytes{ headersFrame });
+    // debug -end
 
-    std::cout << "[Client] Connect stream started successfully\n";
+    const QUIC_BUFFER& headersBuf = *sendBuffer->buffers();
 
-    // Add a small delay to ensure stream is ready
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    HTTP3_LOG_TRACE("[Client] About to send QUIC buffer ({} bytes): {}", headersBuf.Length, Http3LogBytes{ { headersBuf.Buffer, headersBuf.Length } });
 
-    QUIC_BUFFER headersBuf = {};
-    headersBuf.Buffer = headersFrame.data();
-    headersBuf.Length = static_cast<uint32_t>(headersFrame.size());
+    HTTP3_LOG_TRACE("[Client] About to send buffer verification:");
+    HTTP3_LOG_TRACE("[Client] Buffer pointer: {}", (void*)headersBuf.Buffer);
+    HTTP3_LOG_TRACE("[Client] Buffer length: {}", headersBuf.Length);
+    HTTP3_LOG_TRACE("[Client] First 16 bytes of actual buffer: {}", Http3LogBytes{ { headersBuf.Buffer, headersBuf.Length }, 16 });
 
-    std::cout << "[Client] About to send QUIC buffer (" << headersBuf.Length << " bytes): ";
-    maxPrint = (headersBuf.Length < 32) ? headersBuf.Length : 32;
-    for (size_t i = 0; i < maxPrint; ++i) {
-        std::cout << std::format("{:02x} ", static_cast<int>(headersBuf.Buffer[i]));
+    QUIC_STATUS status = MsQuic->StreamSend(connectStream, sendBuffer->buffers(), sendBuffer->bufferCount(), QUIC_SEND_FLAG_NONE, sendBuffer);
+    if (QUIC_FAILED(status)) {
+        DescribeQuicStatus(status, "[Client] Failed to send CONNECT request");
+        QuicSendBufferPool::release(sendBuffer);
     }
-    if (headersBuf.Length > 32) {
-        std::cout << "... (+" << (headersBuf.Length - 32) << " more)";
+    else {
+        HTTP3_LOG_DEBUG("[Client] HEADERS frame send initiated successfully");
     }
-    std::cout << "\n";
 
-    std::cout << "[Client] About to send buffer verification:\n";
-    std::cout << "[Client] Buffer pointer: " << (void*)headersBuf.Buffer << "\n";
-    std::cout << "[Client] Buffer length: " << headersBuf.Length << "\n";
-    std::cout << "[Client] First 16 bytes of actual buffer: ";
-    for (uint32_t i = 0; i < headersBuf.Length && i < 16; ++i) {
-        std::cout << std::format("{:02x} ", static_cast<int>(headersBuf.Buffer[i]));
+    HTTP3_LOG_INFO("[Client] WebTransport CONNECT request sent ({} bytes)", headersFrame.size());
+}
+
+// Record the server's SETTINGS, the first frame on its control stream
+static void ProcessServerSettings(std::span<const uint8_t> payload) {
+    if (ServerSettings.received) {
+        HTTP3_LOG_ERROR("ERROR: Second SETTINGS frame from the server");
+        MsQuic->ConnectionShutdown(Connection, QUIC_CONNECTION_SHUTDOWN_FLAG_NONE, Http3ErrorCode::H3_FRAME_UNEXPECTED);
+        return;
+    }
+    uint64_t error = ServerSettings.apply(payload);
+    if (error != 0) {
+        HTTP3_LOG_ERROR("ERROR: Malformed server SETTINGS, closing with 0x{}", Http3LogHex{ error });
+        MsQuic->ConnectionShutdown(Connection, QUIC_CONNECTION_SHUTDOWN_FLAG_NONE, error);
+        return;
     }
-    std::cout << "\n";
+    HTTP3_LOG_INFO("Server SETTINGS: WebTransport {}, QPACK table {}, blocked streams {}",
+        ServerSettings.webTransportEnabled() ? "enabled" : "disabled", ServerSettings.qpackMaxTableCapacity, ServerSettings.qpackBlockedStreams);
 
-    status = MsQuic->StreamSend(ConnectStream, &headersBuf, 1, QUIC_SEND_FLAG_NONE, nullptr);
-    if (QUIC_FAILED(status)) {
-        DescribeQuicStatus(status, "[Client] Failed to send CONNECT request");
+    // The encoder only references entries the server has acknowledged, so its sections never
+    // block and any SETTINGS_QPACK_BLOCKED_STREAMS, zero included, is respected
+    Encoder.setPeerMaxTableCapacity(ServerSettings.qpackMaxTableCapacity);
+    SendEncoderInstructions(Connection);
+}
+
+// A 200 response to our CONNECT establishes the WebTransport session
+static void AcceptConnectResponse(const std::vector<QpackDecoder::Header>& headers) {
+    std::string_view status;
+    for (const auto& header : headers) {
+        HTTP3_LOG_TRACE("  {}: {}", header.name, header.value);
+        if (header.name == ":status") {
+            status = header.value;
+        }
+    }
+
+    if (status == "200") {
+        HTTP3_LOG_INFO("WebTransport connection established! Got 200 OK");
+        WebTransportEstablished = true;
     }
     else {
-        std::cout << "[Client] HEADERS frame send initiated successfully\n";
+        HTTP3_LOG_INFO("CONNECT refused with status {}", status);
+    }
+}
+
+// Decode the response to our CONNECT against the server's dynamic table
+static void ProcessConnectResponse(uint64_t streamId, std::span<const uint8_t> qpackData) {
+    std::vector<QpackDecoder::Header> headers;
+    auto status = Decoder.decodeHeaders(streamId, qpackData, headers);
+    if (status == QpackDecoder::Status::Blocked) {
+        // Accepted from ProcessUnblockedResponse once the encoder stream catches up
+        HTTP3_LOG_DEBUG("CONNECT response blocked on the QPACK encoder stream");
+        return;
+    }
+    if (status == QpackDecoder::Status::Error) {
+        // A malformed section fails the whole connection (RFC 9204 section 6)
+        HTTP3_LOG_ERROR("ERROR: Failed to decode the CONNECT response");
+        MsQuic->ConnectionShutdown(Connection, QUIC_CONNECTION_SHUTDOWN_FLAG_NONE, Http3ErrorCode::QPACK_DECOMPRESSION_FAILED);
+        return;
     }
 
-    std::cout << "[Client] WebTransport CONNECT request sent (" << headersFrame.size() << " bytes)\n";
+    // Acknowledge the section, used or not, so the server can evict what it referenced
+    SendDecoderInstructions(Connection);
+    if (status == QpackDecoder::Status::TooLarge) {
+        HTTP3_LOG_ERROR("ERROR: CONNECT response exceeds {} bytes", CLIENT_MAX_FIELD_SECTION_SIZE);
+        return;
+    }
+    AcceptConnectResponse(headers);
+}
+
+// Accept a CONNECT response that was waiting on the server's encoder stream
+static void ProcessUnblockedResponse() {
+    for (const auto& section : Decoder.takeUnblockedSections()) {
+        if (section.status == QpackDecoder::Status::Error) {
+            HTTP3_LOG_ERROR("ERROR: Failed to decode the unblocked CONNECT response");
+            MsQuic->ConnectionShutdown(Connection, QUIC_CONNECTION_SHUTDOWN_FLAG_NONE, Http3ErrorCode::QPACK_DECOMPRESSION_FAILED);
+            return;
+        }
+        if (section.status == QpackDecoder::Status::TooLarge) {
+            HTTP3_LOG_ERROR("ERROR: CONNECT response exceeds {} bytes", CLIENT_MAX_FIELD_SECTION_SIZE);
+            continue;
+        }
+        HTTP3_LOG_DEBUG("CONNECT response on stream {} unblocked", section.streamId);
+        AcceptConnectResponse(section.headers);
+    }
+}
+
+// Open a bidirectional stream in the WebTransport session and send payload on it, then FIN.
+// Only the WEBTRANSPORT_STREAM signal is encoded into the pooled buffer; the payload is
+// gathered by reference, so it must stay valid until SEND_COMPLETE.
+static void SendWebTransportStream(HQUIC connection, std::span<const uint8_t> payload) {
+    QuicSendBuffer* sendBuffer = QuicSendBufferPool::acquire();
+    if (!sendBuffer->appendHeader({ Http3FrameType::WEBTRANSPORT_STREAM, SessionId }) || !sendBuffer->appendReference(payload)) {
+        HTTP3_LOG_ERROR("[Client] ERROR: WebTransport stream data does not fit a send buffer");
+        QuicSendBufferPool::release(sendBuffer);
+        return;
+    }
+
+    HQUIC stream = nullptr;
+    auto* streamContext = new StreamContext(StreamRole::WebTransport, false);
+    QUIC_STATUS status = MsQuic->StreamOpen(connection, QUIC_STREAM_OPEN_FLAG_NONE, ClientStreamCallback, streamContext, &stream);
+    if (QUIC_FAILED(status)) {
+        DescribeQuicStatus(status, "[Client] Failed to open WebTransport stream");
+        delete streamContext;
+        QuicSendBufferPool::release(sendBuffer);
+        return;
+    }
+
+    // Started by the send itself, so a stream that fails to send was never started
+    status = MsQuic->StreamSend(stream, sendBuffer->buffers(), sendBuffer->bufferCount(),
+        QUIC_SEND_FLAG_START | QUIC_SEND_FLAG_FIN, sendBuffer);
+    if (QUIC_FAILED(status)) {
+        DescribeQuicStatus(status, "[Client] Failed to send on WebTransport stream");
+        MsQuic->StreamClose(stream);
+        delete streamContext;
+        QuicSendBufferPool::release(sendBuffer);
+        return;
+    }
+
+    HTTP3_LOG_DEBUG("[Client] WebTransport stream opened in session {} with {} segments, {} payload bytes", SessionId, sendBuffer->bufferCount(), payload.size());
 }
 
 _IRQL_requires_max_(PASSIVE_LEVEL)
@@ -639,115 +579,184 @@ ClientStreamCallback(
     _In_opt_ void* Context,
     _Inout_ QUIC_STREAM_EVENT* Event
 ) {
-    // Check if this is the control stream based on context
-    bool isControlStream = (reinterpret_cast<uintptr_t>(Context) == 0x1000);
+    // Every stream carries its own context (see StreamOpen and PEER_STREAM_STARTED)
+    auto& stream = *static_cast<StreamContext*>(Context);
+    bool isControlStream = (stream.role == StreamRole::Control);
 
-    std::cout << getClientTimestamp() << " === CLIENT STREAM CALLBACK ===\n";
-    std::cout << getClientTimestamp() << " Stream: " << std::hex << Stream << std::dec;
-    if (isControlStream) {
-        std::cout << " (CONTROL STREAM)";
-    }
-    else {
-        std::cout << " (DATA STREAM)";
-    }
-    std::cout << "\n";
-    std::cout << getClientTimestamp() << " Event type: " << Event->Type << "\n";
+    HTTP3_LOG_DEBUG("=== CLIENT STREAM CALLBACK ===");
+    HTTP3_LOG_DEBUG("Stream: {} ({})", Stream, isControlStream ? "CONTROL STREAM" : "DATA STREAM");
+    HTTP3_LOG_DEBUG("Event type: {}", Event->Type);
 
     switch (Event->Type) {
-    case QUIC_STREAM_EVENT_RECEIVE: {
-        // Get the actual QUIC stream ID for debugging
-        QUIC_UINT62 streamId = 0;
-        uint32_t bufferLength = sizeof(streamId);
-        MsQuic->GetParam(Stream, QUIC_PARAM_STREAM_ID, &bufferLength, &streamId);
-
-        std::cout << getClientTimestamp() << " RECEIVE event on stream ID " << streamId
-            << " (" << Event->RECEIVE.Buffers->Length << " bytes)\n";
-
-        if (isControlStream) {
-            std::cout << getClientTimestamp() << " Processing control stream response\n";
-
-            // Control stream should receive SETTINGS frame from server
-            std::cout << getClientTimestamp() << " Server control stream response: ";
-            for (uint32_t i = 0; i < Event->RECEIVE.Buffers->Length && i < 16; ++i) {
-                std::cout << std::format("{:02x} ", Event->RECEIVE.Buffers->Buffer[i]);
-            }
-            std::cout << "\n";
-
-            // TODO: Parse server SETTINGS frame here
-            std::cout << getClientTimestamp() << " Server SETTINGS received and processed\n";
+    case QUIC_STREAM_EVENT_START_COMPLETE: {
+        if (QUIC_FAILED(Event->START_COMPLETE.Status)) {
+            DescribeQuicStatus(Event->START_COMPLETE.Status, "[Client] Stream failed to start");
+            break;
         }
-        else {
-            std::cout << getClientTimestamp() << " Processing data stream response\n";
+        stream.id = Event->START_COMPLETE.ID;
+        HTTP3_LOG_DEBUG("Stream started with ID {}", stream.id);
+        if (stream.role == StreamRole::Connect) {
+            SessionId = stream.id;
+            SendConnectRequest(Stream, stream.id);
+        }
+        break;
+    }
 
-            // This is the WebTransport CONNECT response
-            std::string received(
-                reinterpret_cast<char*>(Event->RECEIVE.Buffers->Buffer),
-                Event->RECEIVE.Buffers->Length
-            );
+    case QUIC_STREAM_EVENT_RECEIVE: {
+        HTTP3_LOG_DEBUG("RECEIVE event on stream ID {} ({} buffers, {} bytes)", stream.id, Event->RECEIVE.BufferCount, Event->RECEIVE.TotalBufferLength);
+
+        // Parse straight out of every buffer MsQuic handed us - one receive is often split
+        // over several - and hand back exactly the bytes the decoder took
+        QuicBufferCursor cursor(std::span<const QUIC_BUFFER>(Event->RECEIVE.Buffers, Event->RECEIVE.BufferCount));
+        for (const auto& event : stream.decoder.events(cursor)) {
+            switch (event.type) {
+            case QuicFrameDecoder::EventType::StreamType:
+                if (event.value == Http3StreamType::CONTROL) {
+                    HTTP3_LOG_DEBUG("Server control stream");
+                    stream.role = StreamRole::ServerControl;
+                }
+                else if (event.value == Http3StreamType::QPACK_ENCODER) {
+                    // QPACK instructions are not framed; the rest of the stream goes to the decoder
+                    HTTP3_LOG_DEBUG("Server QPACK encoder stream");
+                    stream.role = StreamRole::ServerEncoder;
+                    stream.decoder.enterRawMode();
+                }
+                else if (event.value == Http3StreamType::QPACK_DECODER) {
+                    HTTP3_LOG_DEBUG("Server QPACK decoder stream");
+                    stream.role = StreamRole::ServerDecoder;
+                    stream.decoder.enterRawMode();
+                }
+                else {
+                    HTTP3_LOG_DEBUG("Ignoring server stream type 0x{}", Http3LogHex{ event.value });
+                    stream.decoder.enterRawMode();
+                }
+                break;
 
-            std::cout << getClientTimestamp() << " Server response: ";
-            for (uint8_t b : received) {
-                std::cout << std::format("{:02x} ", static_cast<uint8_t>(b));
-            }
-            std::cout << "\n";
-
-            // Check if this looks like an HTTP/3 200 OK response
-            if (received.size() >= 3 && static_cast<uint8_t>(received[0]) == 0x01) {
-                std::cout << getClientTimestamp() << " Received HTTP/3 frame, checking for 200 OK...\n";
-                // Simple check for status 200 (QPACK encoded as 0x8F)
-                if (received.find('\x8F') != std::string::npos) {
-                    std::cout << getClientTimestamp() << " WebTransport connection established! Got 200 OK\n";
-                    WebTransportEstablished = true;
+            case QuicFrameDecoder::EventType::Frame:
+                if (stream.role == StreamRole::ServerControl && event.value == Http3FrameType::SETTINGS) {
+                    ProcessServerSettings(event.payload);
+                }
+                else if (stream.role == StreamRole::Connect && event.value == Http3FrameType::HEADERS) {
+                    ProcessConnectResponse(stream.id, event.payload);
+                }
+                else {
+                    HTTP3_LOG_DEBUG("Frame {} ignored", Http3FrameType::name(event.value));
+                }
+                break;
+
+            case QuicFrameDecoder::EventType::DataChunk:
+                HTTP3_LOG_TRACE("DATA chunk ({} bytes)", event.payload.size());
+                break;
+
+            case QuicFrameDecoder::EventType::RawData:
+                if (stream.role == StreamRole::ServerEncoder) {
+                    if (!Decoder.processEncoderStream(event.payload)) {
+                        HTTP3_LOG_ERROR("ERROR: Invalid QPACK encoder stream");
+                        MsQuic->ConnectionShutdown(Connection, QUIC_CONNECTION_SHUTDOWN_FLAG_NONE, Http3ErrorCode::QPACK_ENCODER_STREAM_ERROR);
+                        break;
+                    }
+                    SendDecoderInstructions(Connection);
+                    ProcessUnblockedResponse();
                 }
+                else if (stream.role == StreamRole::ServerDecoder) {
+                    if (!Encoder.processDecoderStream(event.payload)) {
+                        HTTP3_LOG_ERROR("ERROR: Invalid QPACK decoder stream");
+                        MsQuic->ConnectionShutdown(Connection, QUIC_CONNECTION_SHUTDOWN_FLAG_NONE, Http3ErrorCode::QPACK_DECODER_STREAM_ERROR);
+                    }
+                }
+                else if (stream.role == StreamRole::WebTransport) {
+                    HTTP3_LOG_TRACE("Stream data ({} bytes): {}", event.payload.size(),
+                        std::string_view(reinterpret_cast<const char*>(event.payload.data()), event.payload.size()));
+                }
+                else {
+                    HTTP3_LOG_TRACE("Stream data ({} bytes)", event.payload.size());
+                }
+                break;
+
+            case QuicFrameDecoder::EventType::Error:
+                // Errors on the server's control stream, such as H3_MISSING_SETTINGS, close the connection
+                HTTP3_LOG_ERROR("ERROR: Frame decoding failed: {}", event.error);
+                if (stream.role == StreamRole::ServerControl) {
+                    MsQuic->ConnectionShutdown(Connection, QUIC_CONNECTION_SHUTDOWN_FLAG_NONE, event.errorCode);
+                }
+                else {
+                    MsQuic->StreamShutdown(Stream, QUIC_STREAM_SHUTDOWN_FLAG_ABORT, event.errorCode);
+                }
+                break;
+
+            default:
+                break;
             }
         }
 
         // Complete the receive
-        MsQuic->StreamReceiveComplete(Stream, Event->RECEIVE.Buffers->Length);
+        MsQuic->StreamReceiveComplete(Stream, cursor.consumed());
         break;
     }
 
     case QUIC_STREAM_EVENT_SEND_COMPLETE: {
-        QUIC_UINT62 streamId = 0;
-        uint32_t bufferLength = sizeof(streamId);
-        MsQuic->GetParam(Stream, QUIC_PARAM_STREAM_ID, &bufferLength, &streamId);
+        HTTP3_LOG_DEBUG("SEND_COMPLETE on stream ID {}{}{}", stream.id, isControlStream ? " (CONTROL STREAM)" : "",
+            Event->SEND_COMPLETE.Canceled ? " (canceled)" : "");
 
-        std::cout << getClientTimestamp() << " SEND_COMPLETE on stream ID " << streamId;
-        if (isControlStream) {
-            std::cout << " (CONTROL STREAM)";
-        }
-        std::cout << "\n";
+        // Every send carries its pooled buffer, canceled or not
+        QuicSendBufferPool::release(static_cast<QuicSendBuffer*>(Event->SEND_COMPLETE.ClientContext));
         break;
     }
 
     case QUIC_STREAM_EVENT_SHUTDOWN_COMPLETE: {
-        QUIC_UINT62 streamId = 0;
-        uint32_t bufferLength = sizeof(streamId);
-        MsQuic->GetParam(Stream, QUIC_PARAM_STREAM_ID, &bufferLength, &streamId);
-
-        std::cout << getClientTimestamp() << " SHUTDOWN_COMPLETE on stream " << streamId;
+        HTTP3_LOG_DEBUG("SHUTDOWN_COMPLETE on stream {}{}", stream.id, isControlStream ? " (CONTROL STREAM)" : "");
         if (isControlStream) {
-            std::cout << " (CONTROL STREAM)";
             ControlStream = nullptr;  // Clear the global reference
         }
-        std::cout << "\n";
+        else if (stream.role == StreamRole::Connect) {
+            ConnectStream = nullptr;
+        }
+        else if (stream.role == StreamRole::QpackEncoder) {
+            EncoderStream = nullptr;
+        }
+        else if (stream.role == StreamRole::QpackDecoder) {
+            DecoderStream = nullptr;
+        }
 
         MsQuic->StreamClose(Stream);
+        delete &stream;
         break;
     }
 
     default:
-        std::cout << getClientTimestamp() << " Other stream event: " << Event->Type << "\n";
+        HTTP3_LOG_DEBUG("Other stream event: {}", Event->Type);
         break;
     }
 
-    std::cout << getClientTimestamp() << " === CLIENT STREAM CALLBACK END ===\n";
+    HTTP3_LOG_DEBUG("=== CLIENT STREAM CALLBACK END ===");
     return QUIC_STATUS_SUCCESS;
 }
 
+// -profile:<name> picks MsQuic's execution profile; the client has one connection, so the
+// default low_latency suits it, but it can match the server's for comparisons
+struct ExecutionProfileName {
+    std::string_view name;
+    QUIC_EXECUTION_PROFILE profile;
+};
+
+static constexpr ExecutionProfileName EXECUTION_PROFILES[] = {
+    { "low_latency", QUIC_EXECUTION_PROFILE_LOW_LATENCY },
+    { "max_throughput", QUIC_EXECUTION_PROFILE_TYPE_MAX_THROUGHPUT },
+    { "scavenger", QUIC_EXECUTION_PROFILE_TYPE_SCAVENGER },
+    { "real_time", QUIC_EXECUTION_PROFILE_TYPE_REAL_TIME },
+};
+
+static const ExecutionProfileName* FindExecutionProfile(std::string_view name) {
+    for (const auto& profile : EXECUTION_PROFILES) {
+        if (profile.name == name) return &profile;
+    }
+    return nullptr;
+}
+
 int main(int argc, char** argv) {
     std::string serverAddress = "127.0.0.1";
     uint16_t serverPort = 4443;
+    const ExecutionProfileName* profile = &EXECUTION_PROFILES[0];
 
     // Parse command line arguments
     for (int i = 1; i < argc; ++i) {
@@ -758,10 +767,27 @@ int main(int argc, char** argv) {
         else if (arg.starts_with("-port:")) {
             serverPort = static_cast<uint16_t>(std::stoul(std::string(arg.substr(6))));
         }
+        else if (arg.starts_with("-profile:")) {
+            profile = FindExecutionProfile(arg.substr(9));
+            if (profile == nullptr) {
+                std::cerr << "Unknown execution profile: " << arg.substr(9) << "\n";
+                return 1;
+            }
+        }
     }
 
-    std::cout << "=== MsQuic WebTransport Client ===\n";
-    std::cout << "Connecting to: " << serverAddress << ":" << serverPort << "\n\n";
+    // Callbacks log from MsQuic's workers while main waits on them; the logger's drain thread
+    // keeps both in order on the console
+    Http3Log::start();
+
+    // The server's encoder may use what CLIENT_SETTINGS advertise
+    Decoder.setMaxTableCapacity(CLIENT_QPACK_MAX_TABLE_CAPACITY);
+    Decoder.setMaxBlockedStreams(CLIENT_QPACK_BLOCKED_STREAMS);
+    Decoder.setMaxFieldSectionSize(CLIENT_MAX_FIELD_SECTION_SIZE);
+
+    HTTP3_LOG_INFO("=== MsQuic WebTransport Client ===");
+    HTTP3_LOG_INFO("Connecting to: {}:{}", serverAddress, serverPort);
+    HTTP3_LOG_INFO("Execution profile: {}\n", profile->name);
 
     // Initialize MsQuic
     if (QUIC_FAILED(MsQuicOpen2(&MsQuic))) {
@@ -769,7 +795,7 @@ int main(int argc, char** argv) {
         return 1;
     }
 
-    QUIC_REGISTRATION_CONFIG regConfig = { "QuicWebTransportClient", QUIC_EXECUTION_PROFILE_LOW_LATENCY };
+    QUIC_REGISTRATION_CONFIG regConfig = { "QuicWebTransportClient", profile->profile };
     if (QUIC_FAILED(MsQuic->RegistrationOpen(&regConfig, &Registration))) {
         std::cerr << "RegistrationOpen failed\n";
         return 1;
@@ -829,7 +855,7 @@ int main(int argc, char** argv) {
         return 1;
     }
 
-    std::cout << "[Client] Connection started, waiting for WebTransport handshake...\n";
+    HTTP3_LOG_INFO("[Client] Connection started, waiting for WebTransport handshake...");
 
     // Wait for WebTransport establishment
     auto startTime = std::chrono::steady_clock::now();
@@ -839,38 +865,36 @@ int main(int argc, char** argv) {
     }
 
     if (WebTransportEstablished) {
-        std::cout << "\n[SUCCESS] WebTransport connection fully established!\n";
-        std::cout << "Ready to send WebTransport streams and datagrams...\n";
+        HTTP3_LOG_INFO("[SUCCESS] WebTransport connection fully established!");
+        HTTP3_LOG_INFO("Ready to send WebTransport streams and datagrams...");
 
         // Demonstrate sending some test data
         std::this_thread::sleep_for(std::chrono::seconds(1));
 
-        std::string testMessage = "Hello from WebTransport client!";
-        QUIC_BUFFER testBuf = {};
-        testBuf.Buffer = reinterpret_cast<uint8_t*>(testMessage.data());
-        testBuf.Length = static_cast<uint32_t>(testMessage.size());
-
-        if (ConnectStream) {
-            std::cout << "[Client] Sending test message on WebTransport stream...\n";
-            MsQuic->StreamSend(ConnectStream, &testBuf, 1, QUIC_SEND_FLAG_NONE, nullptr);
-        }
+        // A string literal outlives any send, so it can go out by reference
+        static constexpr std::string_view testMessage = "Hello from WebTransport client!";
+        HTTP3_LOG_INFO("[Client] Sending test message on WebTransport stream...");
+        SendWebTransportStream(Connection, { reinterpret_cast<const uint8_t*>(testMessage.data()), testMessage.size() });
 
         // Keep alive for a bit to test bidirectional communication
         std::this_thread::sleep_for(std::chrono::seconds(3));
     }
     else {
-        std::cout << "[FAILED] WebTransport connection failed to establish within timeout\n";
+        HTTP3_LOG_ERROR("[FAILED] WebTransport connection failed to establish within timeout");
     }
 
     // Cleanup
     if (ControlStream) MsQuic->StreamClose(ControlStream);
     if (ConnectStream) MsQuic->StreamClose(ConnectStream);
+    if (EncoderStream) MsQuic->StreamClose(EncoderStream);
+    if (DecoderStream) MsQuic->StreamClose(DecoderStream);
     if (Connection) MsQuic->ConnectionClose(Connection);
     if (Configuration) MsQuic->ConfigurationClose(Configuration);
     if (Registration) MsQuic->RegistrationClose(Registration);
     MsQuicClose(MsQuic);
 
-    std::cout << "\n[Client] Shutdown complete\n";
+    HTTP3_LOG_INFO("[Client] Shutdown complete");
+    Http3Log::stop();
     return 0;
 }
 
@@ -886,73 +910,74 @@ ClientConnectionCallback(
 ) {
     UNREFERENCED_PARAMETER(Context);
 
-    std::cout << getClientTimestamp() << " === CLIENT CONNECTION CALLBACK ===\n";
-    std::cout << getClientTimestamp() << " Event type: " << Event->Type << "\n";
+    HTTP3_LOG_DEBUG("=== CLIENT CONNECTION CALLBACK ===");
+    HTTP3_LOG_DEBUG("Event type: {}", Event->Type);
 
     switch (Event->Type) {
     case QUIC_CONNECTION_EVENT_CONNECTED: {
-        std::cout << getClientTimestamp() << " CONNECTED to server!\n";
-        std::cout << getClientTimestamp() << " Starting HTTP/3 handshake sequence...\n";
+        HTTP3_LOG_INFO("CONNECTED to server!");
+        HTTP3_LOG_DEBUG("Starting HTTP/3 handshake sequence...");
 
         // SAFE: No threading, just reasonable delays
-        std::cout << getClientTimestamp() << " === WAITING FOR SERVER TO BE FULLY READY ===\n";
-        std::cout << getClientTimestamp() << " Waiting 2 seconds for server to complete initialization...\n";
+        HTTP3_LOG_DEBUG("=== WAITING FOR SERVER TO BE FULLY READY ===");
+        HTTP3_LOG_DEBUG("Waiting 2 seconds for server to complete initialization...");
         std::this_thread::sleep_for(std::chrono::milliseconds(2000)); // Keep this - it's not detached threading
 
         // === STEP 1: Send SETTINGS frame on control stream ===
-        std::cout << "\n" << getClientTimestamp() << " === STEP 1: HTTP/3 Control Stream Setup ===\n";
+        HTTP3_LOG_DEBUG("=== STEP 1: HTTP/3 Control Stream Setup ===");
         SendSettingsFrame(Connection);
 
         // === STEP 2: Wait for control stream to be established ===
-        std::cout << "\n" << getClientTimestamp() << " === STEP 2: Waiting for control stream setup ===\n";
+        HTTP3_LOG_DEBUG("=== STEP 2: Waiting for control stream setup ===");
         std::this_thread::sleep_for(std::chrono::milliseconds(1000)); // Keep this - it's not detached threading
 
         // === STEP 3: Send WebTransport CONNECT on bidirectional stream ===
-        std::cout << "\n" << getClientTimestamp() << " === STEP 3: WebTransport CONNECT Request ===\n";
+        HTTP3_LOG_DEBUG("=== STEP 3: WebTransport CONNECT Request ===");
         SendWebTransportConnect(Connection, "localhost:4443", "/webtransport");
 
         break;
     }
     
     case QUIC_CONNECTION_EVENT_PEER_STREAM_STARTED:{
-            std::cout << getClientTimestamp() << " PEER_STREAM_STARTED\n";
+            HTTP3_LOG_DEBUG("PEER_STREAM_STARTED");
 
-            // Get stream ID for debugging
-            QUIC_UINT62 streamId = 0;
+            // Get the stream ID once; the stream's context caches it
+            QUIC_UINT62 streamId = StreamContext::UNKNOWN_ID;
             uint32_t bufferLength = sizeof(streamId);
             QUIC_STATUS idStatus = MsQuic->GetParam(Event->PEER_STREAM_STARTED.Stream, QUIC_PARAM_STREAM_ID, &bufferLength, &streamId);
 
             if (QUIC_SUCCEEDED(idStatus)) {
-                std::cout << getClientTimestamp() << " Server started stream ID: " << streamId << "\n";
+                HTTP3_LOG_DEBUG("Server started stream ID: {}", streamId);
             }
 
             // Check if it's the server's test stream
             if (Event->PEER_STREAM_STARTED.Flags & QUIC_STREAM_OPEN_FLAG_UNIDIRECTIONAL) {
-                std::cout << getClientTimestamp() << " Server created UNIDIRECTIONAL stream (test stream)\n";
+                HTTP3_LOG_DEBUG("Server created UNIDIRECTIONAL stream (test stream)");
             }
             else {
-                std::cout << getClientTimestamp() << " Server created BIDIRECTIONAL stream\n";
+                HTTP3_LOG_DEBUG("Server created BIDIRECTIONAL stream");
             }
 
             // Set callback for server-initiated streams
-            MsQuic->SetCallbackHandler(Event->PEER_STREAM_STARTED.Stream, ClientStreamCallback, nullptr);
+            bool unidirectional = (Event->PEER_STREAM_STARTED.Flags & QUIC_STREAM_OPEN_FLAG_UNIDIRECTIONAL) != 0;
+            MsQuic->SetCallbackHandler(Event->PEER_STREAM_STARTED.Stream, ClientStreamCallback,
+                new StreamContext(StreamRole::Peer, unidirectional, streamId));
             break;
         }
         case QUIC_CONNECTION_EVENT_SHUTDOWN_COMPLETE:{
-            std::cout << getClientTimestamp() << " CONNECTION_SHUTDOWN_COMPLETE\n";
+            HTTP3_LOG_INFO("CONNECTION_SHUTDOWN_COMPLETE");
             MsQuic->ConnectionClose(Connection);
             break;
         }
         case QUIC_CONNECTION_EVENT_DATAGRAM_RECEIVED:{
-            std::cout << getClientTimestamp() << " DATAGRAM_RECEIVED ("
-                << Event->DATAGRAM_RECEIVED.Buffer->Length << " bytes)\n";
+            HTTP3_LOG_DEBUG("DATAGRAM_RECEIVED ({} bytes)", Event->DATAGRAM_RECEIVED.Buffer->Length);
             break;
         }
         default:
-            std::cout << getClientTimestamp() << " Other connection event: " << Event->Type << "\n";
+            HTTP3_LOG_DEBUG("Other connection event: {}", Event->Type);
             break;
     }
 
-    std::cout << getClientTimestamp() << " === CLIENT CONNECTION CALLBACK END ===\n";
+    HTTP3_LOG_DEBUG("=== CLIENT CONNECTION CALLBACK END ===");
     return QUIC_STATUS_SUCCESS;
 }
\ No newline at end of file
@@ -13,498 +13,173 @@
 #include <optional>
 #include <cstring>
 #include <algorithm>
-#include <iomanip>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <wincrypt.h>
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #include <chrono>
 #include <thread>
-#include <unordered_set>    // Required for std::unordered_set
+#include "http3-codec/frame.h"
+#include "http3-codec/log.h"
+#include "http3-codec/qpack.h"
+#include "http3-codec/sendpool.h"
+#include "http3-codec/webtransport.h"
 
 #pragma comment(lib, "msquic.lib")
 #pragma comment(lib, "Crypt32.lib")
 #pragma comment(lib, "Ws2_32.lib")
 
-static auto serverStartTime = std::chrono::steady_clock::now();
+// Codec buffer-chain types over MsQuic RECEIVE buffers
+using QuicBufferCursor = Http3BufferCursor<QUIC_BUFFER>;
+using QuicFrameDecoder = Http3FrameDecoder<QUIC_BUFFER>;
+using QuicSendBuffer = Http3SendBuffer<QUIC_BUFFER>;
+using QuicSendBufferPool = Http3SendBufferPool<QUIC_BUFFER>;
 
-static std::string getTimestamp() {
-    auto now = std::chrono::steady_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - serverStartTime);
-    return "[T+" + std::to_string(duration.count()) + "ms]";
-}
+// Global variables
+const QUIC_API_TABLE* MsQuic = nullptr;
+HQUIC Registration = nullptr;
+HQUIC Configuration = nullptr;
+HQUIC Listener = nullptr;
 
-// QPACK Static Table (simplified for WebTransport)
-struct QpackStaticEntry {
-    std::string_view name;
-    std::string_view value;
+// A WebTransport session, keyed by the stream ID of its CONNECT request
+struct WebTransportSession {
+    HQUIC stream = nullptr;
+    std::string authority;
+    std::string path;
+    bool established = false;  // 200 sent; until then it waits for the client's SETTINGS
 };
 
-constexpr std::array<QpackStaticEntry, 99> QPACK_STATIC_TABLE = { {
-    {"", ""},                     // 0 - unused
-    {":authority", ""},           // 1
-    {":path", "/"},              // 2
-    {":path", "/index.html"},    // 3
-    {":path", "/index.htm"},     // 4
-    {":method", "CONNECT"},      // 5 <- Important for WebTransport
-    {":method", "DELETE"},       // 6
-    {":method", "GET"},          // 7
-    {":method", "HEAD"},         // 8
-    {":method", "OPTIONS"},      // 9
-    {":method", "POST"},         // 10
-    {":method", "PUT"},          // 11
-    {":scheme", "http"},         // 12
-    {":scheme", "https"},        // 13
-    {":status", "103"},          // 14
-    {":status", "200"},          // 15
-    {":status", "304"},          // 16
-    {":status", "404"},          // 17
-    {":status", "503"},          // 18
-    {":status", "100"},          // 19
-    {":status", "204"},          // 20
-    {":status", "206"},          // 21
-    {":status", "300"},          // 22
-    {":status", "400"},          // 23
-    {":status", "403"},          // 24
-    {":status", "421"},          // 25
-    {":status", "425"},          // 26
-    {":status", "500"},          // 27
-    {"accept-charset", ""},      // 28
-    {"accept-encoding", "gzip, deflate, br"},  // 29
-    {"accept-language", ""},     // 30
-    {"accept-ranges", ""},       // 31
-    {"accept", ""},              // 32
-    {"access-control-allow-headers", ""}, // 33
-    {"access-control-allow-methods", ""}, // 34
-    {"access-control-allow-origin", ""},  // 35
-    {"age", ""},                 // 36
-    {"allow", ""},               // 37
-    {"authorization", ""},       // 38
-    {"cache-control", ""},       // 39
-    {"content-disposition", ""}, // 40
-    {"content-encoding", ""},    // 41
-    {"content-language", ""},    // 42
-    {"content-length", ""},      // 43
-    {"content-location", ""},    // 44
-    {"content-range", ""},       // 45
-    {"content-type", ""},        // 46
-    {"cookie", ""},              // 47
-    {"date", ""},                // 48
-    {"etag", ""},                // 49
-    {"expect", ""},              // 50
-    {"expires", ""},             // 51
-    {"from", ""},                // 52
-    {"host", ""},                // 53
-    {"if-match", ""},            // 54
-    {"if-modified-since", ""},   // 55
-    {"if-none-match", ""},       // 56
-    {"if-range", ""},            // 57
-    {"if-unmodified-since", ""}, // 58
-    {"last-modified", ""},       // 59
-    {"link", ""},                // 60
-    {"location", ""},            // 61
-    {"max-forwards", ""},        // 62
-    {"proxy-authenticate", ""},  // 63
-    {"proxy-authorization", ""}, // 64
-    {"range", ""},               // 65
-    {"referer", ""},             // 66
-    {"refresh", ""},             // 67
-    {"retry-after", ""},         // 68
-    {"server", ""},              // 69
-    {"set-cookie", ""},          // 70
-    {"strict-transport-security", ""}, // 71
-    {"transfer-encoding", ""},   // 72
-    {"user-agent", ""},          // 73
-    {"vary", ""},                // 74
-    {"via", ""},                 // 75
-    {"www-authenticate", ""},    // 76
-    {"accept-encoding", "gzip, deflate"}, // 77
-    {"accept-language", "en"},   // 78
-    {"cache-control", "max-age=0"}, // 79
-    {"cache-control", "no-cache"}, // 80
-    {"content-encoding", "br"},  // 81
-    {"content-encoding", "gzip"}, // 82
-    {"content-type", "application/dns-message"}, // 83
-    {"content-type", "application/javascript"}, // 84
-    {"content-type", "application/json"}, // 85
-    {"content-type", "application/octet-stream"}, // 86
-    {"content-type", "text/css"}, // 87
-    {"content-type", "text/html; charset=utf-8"}, // 88
-    {"content-type", "text/plain"}, // 89
-    {"content-type", "text/plain;charset=utf-8"}, // 90
-    {"range", "bytes=0-"},       // 91
-    {"strict-transport-security", "max-age=31536000"}, // 92
-    {"strict-transport-security", "max-age=31536000; includesubdomains"}, // 93
-    {"strict-transport-security", "max-age=31536000; includesubdomains; preload"}, // 94
-    {"vary", "accept-encoding"}, // 95
-    {"vary", "origin"},          // 96
-    {"x-content-type-options", "nosniff"}, // 97
-    {"x-xss-protection", "1; mode=block"}, // 98
-} };
-
-// Enhanced QPACK decoder with proper integer decoding
-class QpackDecoder {
-public:
-    struct Header {
-        std::string name;
-        std::string value;
-    };
-
-private:
-    size_t position = 0;
-    const std::vector<uint8_t>* data = nullptr;
-
-    // Decode QPACK integer with N-bit prefix
-    std::optional<uint64_t> decodeInteger(uint8_t prefixBits) {
-        if (position >= data->size()) return std::nullopt;
-
-        uint64_t maxPrefix = (1ULL << prefixBits) - 1;
-        uint64_t value = (*data)[position] & static_cast<uint8_t>(maxPrefix);
-        position++;
-
-        if (value < maxPrefix) {
-            return value;
-        }
+// Dynamic table we offer the client's QPACK encoder, and how many request streams may
+// wait for its encoder stream at once
+static constexpr uint64_t SERVER_QPACK_MAX_TABLE_CAPACITY = 4096;
+static constexpr uint64_t SERVER_QPACK_BLOCKED_STREAMS = 16;
+static constexpr uint64_t SERVER_MAX_FIELD_SECTION_SIZE = 16384;
 
-        // Multi-byte integer
-        uint64_t multiplier = 1;
-        while (position < data->size()) {
-            uint8_t byte = (*data)[position++];
-            value += (byte & 0x7F) * multiplier;
-            multiplier *= 128;
+// -defer_receive: hold WebTransport stream data in MsQuic's buffers until the application
+// is done with it, instead of completing every receive inside the callback
+static bool DeferReceiveCompletion = false;
 
-            if ((byte & 0x80) == 0) {
-                break;
-            }
-
-            if (multiplier > (UINT64_MAX / 128)) {
-                return std::nullopt; // Overflow protection
-            }
-        }
-
-        return value;
-    }
-
-    std::optional<std::string> decodeString() {
-        if (position >= data->size()) return std::nullopt;
-
-        bool huffman = ((*data)[position] & 0x80) != 0;
-        auto length = decodeInteger(7);
-        if (!length || *length > data->size() - position) {
-            return std::nullopt;
-        }
+// -profile:<name> picks MsQuic's execution profile. max_throughput runs a worker on every
+// core and spreads connections over them, so the server keeps no state that two workers
+// write: connections and streams carry their own, and what outlives them is per worker.
+struct ExecutionProfileName {
+    std::string_view name;
+    QUIC_EXECUTION_PROFILE profile;
+};
 
-        std::string result;
-        if (huffman) {
-            // For now, indicate Huffman encoding but don't decode
-            result = "[HUFFMAN:" + std::to_string(*length) + "bytes]";
-            position += *length;
-        }
-        else {
-            result = std::string(
-                reinterpret_cast<const char*>(data->data() + position),
-                *length
-            );
-            position += *length;
-        }
+static constexpr ExecutionProfileName EXECUTION_PROFILES[] = {
+    { "low_latency", QUIC_EXECUTION_PROFILE_LOW_LATENCY },
+    { "max_throughput", QUIC_EXECUTION_PROFILE_TYPE_MAX_THROUGHPUT },
+    { "scavenger", QUIC_EXECUTION_PROFILE_TYPE_SCAVENGER },
+    { "real_time", QUIC_EXECUTION_PROFILE_TYPE_REAL_TIME },
+};
 
-        return result;
+static const ExecutionProfileName* FindExecutionProfile(std::string_view name) {
+    for (const auto& profile : EXECUTION_PROFILES) {
+        if (profile.name == name) return &profile;
     }
+    return nullptr;
+}
 
-public:
-    bool decodeHeaders(const std::vector<uint8_t>& qpackData, std::vector<Header>& headers) {
-        data = &qpackData;
-        position = 0;
-        headers.clear();
-
-        while (position < data->size()) {
-            uint8_t firstByte = (*data)[position];
-            Header header;
-
-            if ((firstByte & 0x80) != 0) {
-                // 1xxxxxxx - Indexed Header Field
-                auto index = decodeInteger(7);
-                if (!index || *index == 0 || *index >= QPACK_STATIC_TABLE.size()) {
-                    std::cout << "  [ERROR] Invalid static table index: " << (*index) << "\n";
-                    return false;
-                }
-
-                header.name = QPACK_STATIC_TABLE[*index].name;
-                header.value = QPACK_STATIC_TABLE[*index].value;
-
-                std::cout << "  [INDEXED] Static[" << *index << "]: " << header.name;
-                if (!header.value.empty()) {
-                    std::cout << "=" << header.value;
-                }
-                std::cout << "\n";
-
-            }
-            else if ((firstByte & 0x40) != 0) {
-                // 01xxxxxx - Literal Header Field with Incremental Indexing — Indexed Name
-                auto nameIndex = decodeInteger(6);
-                if (!nameIndex || *nameIndex == 0 || *nameIndex >= QPACK_STATIC_TABLE.size()) {
-                    std::cout << "  [ERROR] Invalid name index\n";
-                    return false; // Instead of using *nameIndex
-                }
-
-                auto value = decodeString();
-                if (!value) {
-                    std::cout << "  [ERROR] Failed to decode header value\n";
-                    return false;
-                }
-
-                header.name = QPACK_STATIC_TABLE[*nameIndex].name;
-                header.value = *value;
-
-                std::cout << "  [LITERAL_INDEXED_NAME] Static[" << *nameIndex << "]: " << header.name << "=" << header.value << "\n";
-
-            }
-            else if ((firstByte & 0x20) != 0) {
-                // 001xxxxx - Literal Header Field with Incremental Indexing — Literal Name
-                position++; // Skip the pattern byte
-
-                auto name = decodeString();
-                if (!name) {
-                    std::cout << "  [ERROR] Failed to decode header name\n";
-                    return false;
-                }
-
-                auto value = decodeString();
-                if (!value) {
-                    std::cout << "  [ERROR] Failed to decode header value\n";
-                    return false;
-                }
-
-                header.name = *name;
-                header.value = *value;
-
-                std::cout << "  [LITERAL_LITERAL] " << header.name << "=" << header.value << "\n";
-
-            }
-            else {
-                std::cout << "  [ERROR] Unknown QPACK pattern: 0x" << std::hex << static_cast<int>(firstByte) << std::dec << "\n";
-                return false;
-            }
-
-            headers.push_back(header);
-        }
-
-        return true;
-    }
+// Counters of one MsQuic worker thread. Only that worker writes them, so counting takes no
+// lock and no cache line is shared between cores; main() sums them once MsQuic is closed.
+struct alignas(64) WorkerStats {
+    std::atomic<uint64_t> connections{ 0 };
+    std::atomic<uint64_t> requests{ 0 };
+    std::atomic<uint64_t> sessionsEstablished{ 0 };
+    std::atomic<uint64_t> sessionsClosed{ 0 };
+    std::atomic<uint64_t> receivedBytes{ 0 };
 };
 
-// Proper HTTP/3 frame parser with varint support
-class Http3FrameParser {
-public:
-    struct Frame {
-        uint64_t type = 0;
-        std::vector<uint8_t> payload;
-        bool valid = false;
-        std::string error;
-    };
-
-private:
-    // Decode HTTP/3 variable-length integer
-    static std::pair<uint64_t, size_t> decodeVarint(const std::vector<uint8_t>& data, size_t offset) {
-        if (offset >= data.size()) {
-            return { 0, 0 }; // Error
-        }
-
-        uint8_t firstByte = data[offset];
-        uint8_t prefix = (firstByte & 0xC0) >> 6; // Top 2 bits determine length
-
-        switch (prefix) {
-        case 0: // 00xxxxxx - 6-bit value (0-63)
-            return { firstByte & 0x3F, 1 };
-
-        case 1: // 01xxxxxx - 14-bit value (0-16383)
-            if (offset + 1 >= data.size()) return { 0, 0 };
-            return {
-                ((static_cast<uint64_t>(firstByte & 0x3F) << 8) | data[offset + 1]),
-                2
-            };
-
-        case 2: // 10xxxxxx - 30-bit value (0-1073741823)
-            if (offset + 3 >= data.size()) return { 0, 0 };
-            return {
-                ((static_cast<uint64_t>(firstByte & 0x3F) << 24) |
-                 (static_cast<uint64_t>(data[offset + 1]) << 16) |
-                 (static_cast<uint64_t>(data[offset + 2]) << 8) |
-                 static_cast<uint64_t>(data[offset + 3])),
-                4
-            };
-
-        case 3: // 11xxxxxx - 62-bit value (0-4611686018427387903)
-            if (offset + 7 >= data.size()) return { 0, 0 };
-            uint64_t value = static_cast<uint64_t>(firstByte & 0x3F);
-            for (int i = 1; i < 8; ++i) {
-                value = (value << 8) | static_cast<uint64_t>(data[offset + i]);
-            }
-            return { value, 8 };
-        }
-
-        return { 0, 0 }; // Should never reach here
+static std::mutex WorkerStatsMutex;                          // Guards AllWorkerStats
+static std::vector<std::unique_ptr<WorkerStats>> AllWorkerStats; // Kept until exit for the summary
+
+// The calling worker's counters, registered on its first event
+static WorkerStats& LocalWorkerStats() {
+    static thread_local WorkerStats* stats = nullptr;
+    if (stats == nullptr) {
+        auto owned = std::make_unique<WorkerStats>();
+        stats = owned.get();
+        std::lock_guard lock(WorkerStatsMutex);
+        AllWorkerStats.push_back(std::move(owned));
     }
-public:
-    Frame parseFrame(const std::vector<uint8_t>& data) {
-        Frame frame;
-
-        if (data.empty()) {
-            frame.error = "Empty data";
-            return frame;
-        }
-
-        // Debug: Print raw data (simple version)
-        std::cout << "[parseFrame] Parsing " << data.size() << " bytes: ";
-        size_t printCount = data.size() < 8 ? data.size() : 8;
-        for (size_t i = 0; i < printCount; ++i) {
-            std::cout << std::hex << std::setw(2) << std::setfill('0') << (int)data[i] << " ";
-        }
-        std::cout << std::dec << "\n";
-
-        // Decode frame type (varint)
-        auto [frameType, typeBytes] = decodeVarint(data, 0);
-        if (typeBytes == 0) {
-            frame.error = "Failed to decode frame type";
-            return frame;
-        }
-
-        std::cout << "[parseFrame] Frame type: " << frameType << " (consumed " << typeBytes << " bytes)\n";
-
-        // Decode frame length (varint)
-        auto [frameLength, lengthBytes] = decodeVarint(data, typeBytes);
-        if (lengthBytes == 0) {
-            frame.error = "Failed to decode frame length";
-            return frame;
-        }
-
-        std::cout << "[parseFrame] Frame length: " << frameLength << " (consumed " << lengthBytes << " bytes)\n";
-
-        size_t headerSize = typeBytes + lengthBytes;
-        std::cout << "[parseFrame] Header size: " << headerSize << ", Total data: " << data.size() << ", Required: " << (headerSize + frameLength) << "\n";
-
-        // Validate we have enough data for the payload
-        if (data.size() < headerSize + frameLength) {
-            std::cout << "[parseFrame] ERROR: Insufficient data!\n";
-            frame.error = "Insufficient data for frame payload";
-            return frame;
-        }
-
-        frame.type = frameType;
-        frame.payload.assign(
-            data.begin() + headerSize,
-            data.begin() + headerSize + frameLength
-        );
-        frame.valid = true;
-
-        std::cout << "[parseFrame] Successfully parsed frame type " << frameType << " with " << frame.payload.size() << " byte payload\n";
+    return *stats;
+}
 
-        return frame;
-    }
+// Single writer, so a plain load and store rather than a locked read-modify-write
+static void Count(std::atomic<uint64_t>& counter, uint64_t amount = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
 
-    std::string getFrameTypeName(uint64_t type) {
-        switch (type) {
-        case 0x00: return "DATA";
-        case 0x01: return "HEADERS";
-        case 0x04: return "SETTINGS";
-        case 0x05: return "PUSH_PROMISE";
-        case 0x07: return "GOAWAY";
-        case 0x0D: return "MAX_PUSH_ID";
-        case 0x41: return "WEBTRANSPORT_STREAM";
-        default: return "UNKNOWN(" + std::to_string(type) + ")";
-        }
+// Everything the server knows about one connection. It is the MsQuic callback context of
+// the connection and of all its streams, so lookups are a pointer dereference. MsQuic runs
+// a connection's callbacks one at a time on its worker, so nothing here needs a lock and
+// no state is shared between connections. Created at NEW_CONNECTION, deleted at
+// SHUTDOWN_COMPLETE.
+struct ConnectionContext {
+    explicit ConnectionContext(HQUIC connection) : connection(connection) {
+        decoder.setMaxTableCapacity(SERVER_QPACK_MAX_TABLE_CAPACITY);
+        decoder.setMaxBlockedStreams(SERVER_QPACK_BLOCKED_STREAMS);
+        decoder.setMaxFieldSectionSize(SERVER_MAX_FIELD_SECTION_SIZE);
     }
-};
 
-// Enhanced WebTransport validator
-class WebTransportValidator {
-public:
-    struct Result {
-        bool isValid = false;
-        bool isWebTransport = false;
-        std::string authority;
-        std::string path;
-        std::string message;
-    };
-
-    Result validate(const std::vector<QpackDecoder::Header>& headers) {
-        Result result;
-
-        std::string method, protocol, scheme, authority, path;
-
-        for (const auto& header : headers) {
-            if (header.name == ":method") {
-                method = header.value;
-            }
-            else if (header.name == ":protocol") {
-                protocol = header.value;
-            }
-            else if (header.name == ":scheme") {
-                scheme = header.value;
-            }
-            else if (header.name == ":authority") {
-                authority = header.value;
-            }
-            else if (header.name == ":path") {
-                path = header.value;
-            }
-        }
-
-        result.authority = authority;
-        result.path = path;
-
-        // Check if this is a WebTransport CONNECT request
-        if (method == "CONNECT" && protocol == "webtransport") {
-            result.isWebTransport = true;
-            result.message = "WebTransport CONNECT request detected";
-
-            // Validate required headers for WebTransport
-            if (scheme != "https") {
-                result.message = "WebTransport requires HTTPS scheme, got: " + scheme;
-                return result;
-            }
+    HQUIC connection = nullptr;
+    HQUIC controlStream = nullptr;
 
-            if (authority.empty()) {
-                result.message = "WebTransport requires :authority header";
-                return result;
-            }
+    // The client's encoder stream fills the decoder's dynamic table, and the decoder's
+    // acknowledgements go back on our decoder stream
+    QpackDecoder decoder;
+    HQUIC decoderStream = nullptr;
+    std::unordered_map<uint64_t, HQUIC> blockedRequests; // Stream ID -> request stream parked in the decoder
 
-            if (path.empty()) {
-                result.message = "WebTransport requires :path header";
-                return result;
-            }
+    // The client's SETTINGS decide whether its WebTransport requests are accepted
+    HQUIC peerControlStream = nullptr;
+    Http3NegotiatedSettings peerSettings;
+    std::unordered_map<uint64_t, WebTransportSession> sessions;
 
-            result.isValid = true;
-            result.message = "Valid WebTransport request to " + authority + path;
-        }
-        else {
-            if (method == "CONNECT") {
-                result.message = "CONNECT request but not WebTransport (protocol: " + protocol + ")";
-            }
-            else {
-                result.message = "Not a CONNECT request (method: " + method + ")";
-            }
-        }
-
-        return result;
-    }
+    bool closing = false;  // CloseConnection() was called; nothing more is decoded
 };
 
-// Global variables
-const QUIC_API_TABLE* MsQuic = nullptr;
-HQUIC Registration = nullptr;
-HQUIC Configuration = nullptr;
-HQUIC Listener = nullptr;
-static std::unordered_set<HQUIC> seenStreams;
-
-// Session tracking
-struct WebTransportSession {
-    HQUIC connection = nullptr;
-    std::string authority;
-    std::string path;
-    bool established = false;
+// What a stream carries, known once its first bytes (or our own choice) say so
+enum class StreamRole {
+    Unknown,
+    Request,        // Client bidirectional stream carrying an HTTP/3 request
+    WebTransport,   // Client bidirectional stream opened with WEBTRANSPORT_STREAM
+    Control,
+    QpackEncoder,
+    QpackDecoder,
+    Ignored,        // Unidirectional stream of a type we do not handle
 };
 
-std::unordered_map<HQUIC, WebTransportSession> activeSessions;
+// Per-stream state and the MsQuic callback context of every stream. The ID and direction
+// are cached when the stream starts, so stream events never ask MsQuic for them: the
+// client's streams at PEER_STREAM_STARTED, ours at START_COMPLETE. Deleted at the stream's
+// SHUTDOWN_COMPLETE.
+struct StreamContext {
+    static constexpr uint64_t UNKNOWN_ID = UINT64_MAX;
+    static constexpr uint64_t NO_SESSION = UINT64_MAX;
+
+    StreamContext(ConnectionContext& connection, uint64_t id, bool unidirectional, StreamRole role = StreamRole::Unknown)
+        : connection(connection), id(id), unidirectional(unidirectional), role(role), decoder(unidirectional) {}
+
+    ConnectionContext& connection;
+    uint64_t id;
+    bool unidirectional;
+    StreamRole role;
+    uint64_t sessionId = NO_SESSION;  // CONNECT stream of the WebTransport session this stream belongs to
+    uint32_t headerSections = 0;      // HEADERS frames on a request stream: the request, then trailers
+
+    // Frames may be split across RECEIVE events, so each stream keeps its own decoder
+    QuicFrameDecoder decoder;
+
+    // WebTransport data of the current receive as views into MsQuic's buffers. With
+    // -defer_receive the receive returns QUIC_STATUS_PENDING and they stay borrowed, along
+    // with the byte count to complete, until the application lets go of them.
+    std::vector<QUIC_BUFFER> borrowed;
+    uint64_t borrowedLength = 0;
+};
 
 // Forward declarations
 _IRQL_requires_max_(PASSIVE_LEVEL)
@@ -546,160 +221,159 @@ static bool ParseHexHash(std::string_view hexStr, std::span<uint8_t, 20> outByte
     return true;
 }
 
-static std::vector<uint8_t> createHttp3Response(uint16_t statusCode) {
-    std::vector<uint8_t> response;
+// Close the connection with an HTTP/3 error code. The rest of the RECEIVE that found the
+// error is not decoded, and neither is anything the client sends until MsQuic shuts down.
+static void CloseConnection(ConnectionContext& context, uint64_t errorCode) {
+    context.closing = true;
+    MsQuic->ConnectionShutdown(context.connection, QUIC_CONNECTION_SHUTDOWN_FLAG_NONE, errorCode);
+}
 
-    response.push_back(0x01); // HEADERS frame type
-    response.push_back(0x01); // Length: 1 byte
+// Responses that never change, encoded at compile time. MsQuic holds on to both the
+// QUIC_BUFFER and its bytes until SEND_COMPLETE; here both are static and read-only, so a
+// response costs no allocation and is safe to send from any worker thread.
+static constexpr auto RESPONSE_200 = QpackConstantSection::headersFrame({
+    { ":status", "200" },
+    { "sec-webtransport-http3-draft", "draft02" },
+});
+static constexpr auto RESPONSE_400 = QpackConstantSection::headersFrame({ { ":status", "400" } });
+static constexpr auto RESPONSE_404 = QpackConstantSection::headersFrame({ { ":status", "404" } });
+static constexpr auto RESPONSE_431 = QpackConstantSection::headersFrame({ { ":status", "431" } });
+
+struct CannedResponse {
+    uint16_t statusCode;
+    QUIC_BUFFER buffer;
+};
 
-    if (statusCode == 200) {
-        response.push_back(0x8F); // :status 200 (static table index 15)
-    }
-    else if (statusCode == 400) {
-        response.push_back(0x97); // :status 400 (static table index 23)
-    }
-    else {
-        response.push_back(0x91); // :status 404 (static table index 17)
-    }
+static constexpr CannedResponse CANNED_RESPONSES[] = {
+    { 200, RESPONSE_200.buffer<QUIC_BUFFER>() },
+    { 400, RESPONSE_400.buffer<QUIC_BUFFER>() },
+    { 404, RESPONSE_404.buffer<QUIC_BUFFER>() },
+    { 431, RESPONSE_431.buffer<QUIC_BUFFER>() },
+};
 
-    return response;
+// Send the canned HEADERS frame for statusCode; anything without one is answered 404
+static QUIC_STATUS sendResponse(HQUIC stream, uint16_t statusCode, QUIC_SEND_FLAGS flags) {
+    for (const auto& response : CANNED_RESPONSES) {
+        if (response.statusCode == statusCode) {
+            return MsQuic->StreamSend(stream, &response.buffer, 1, flags, nullptr);
+        }
+    }
+    return sendResponse(stream, 404, flags);
 }
 
-// Helper function to send server SETTINGS frame
-static void sendServerSettings(HQUIC connection) {
-    std::cout << getTimestamp() << " === SENDING SERVER SETTINGS ===" << std::endl;
-    std::cout << getTimestamp() << " Connection handle: " << std::hex << connection << std::dec << std::endl;
+// SETTINGS sent on the server control stream
+static constexpr Http3Setting SERVER_SETTINGS[] = {
+    { Http3SettingId::ENABLE_WEBTRANSPORT, 1 },
+    { Http3SettingId::QPACK_MAX_TABLE_CAPACITY, SERVER_QPACK_MAX_TABLE_CAPACITY },
+    { Http3SettingId::QPACK_BLOCKED_STREAMS, SERVER_QPACK_BLOCKED_STREAMS },
+    { Http3SettingId::MAX_FIELD_SECTION_SIZE, SERVER_MAX_FIELD_SECTION_SIZE },
+};
 
-    // Create server control stream data
-    static std::vector<uint8_t> serverControlData;
-    serverControlData.clear();
+// Control stream type and SETTINGS, encoded once at compile time and shared by every connection
+static constexpr auto SERVER_CONTROL_PREAMBLE = Http3FrameBuilder::controlStreamPreamble(SERVER_SETTINGS);
+static constexpr QUIC_BUFFER SERVER_CONTROL_BUFFER = SERVER_CONTROL_PREAMBLE.buffer<QUIC_BUFFER>();
 
-    // Stream type identifier for control stream
-    serverControlData.push_back(0x00);
+// Helper function to send server SETTINGS frame
+static void sendServerSettings(ConnectionContext& context) {
+    HTTP3_LOG_DEBUG("=== SENDING SERVER SETTINGS ===");
+    HTTP3_LOG_DEBUG("Connection handle: {}", context.connection);
 
-    // Create SETTINGS frame
-    serverControlData.push_back(0x04); // SETTINGS frame type
-    serverControlData.push_back(0x05); // Length = 5 bytes
+    auto serverControlData = SERVER_CONTROL_PREAMBLE.span();
 
-    // ENABLE_WEBTRANSPORT setting
-    serverControlData.push_back(0x2b);
-    serverControlData.push_back(0x60);
-    serverControlData.push_back(0x37);
-    serverControlData.push_back(0x42);
-    serverControlData.push_back(0x01); // Value = 1
-
-    std::cout << getTimestamp() << " Server control data (" << serverControlData.size() << " bytes): ";
-    for (size_t i = 0; i < serverControlData.size(); ++i) {
-        std::cout << std::hex << std::setw(2) << std::setfill('0') << (int)serverControlData[i] << " ";
-    }
-    std::cout << std::dec << std::endl;
+    HTTP3_LOG_TRACE("Server control data ({} bytes): {}", serverControlData.size(), Http3LogBytes{ serverControlData });
 
     // Create server control stream (unidirectional, ID 3)
     HQUIC serverControlStream = nullptr;
+    auto* streamContext = new StreamContext(context, StreamContext::UNKNOWN_ID, true, StreamRole::Control);
     QUIC_STATUS status = MsQuic->StreamOpen(
-        connection,
+        context.connection,
         QUIC_STREAM_OPEN_FLAG_UNIDIRECTIONAL,
         ServerStreamCallback,
-        reinterpret_cast<void*>(0x2000), // Server control stream context
+        streamContext,
         &serverControlStream
     );
 
     if (QUIC_FAILED(status)) {
-        std::cout << getTimestamp() << " ERROR: Failed to create server control stream: 0x" << std::hex << status << std::dec << std::endl;
+        HTTP3_LOG_ERROR("ERROR: Failed to create server control stream: 0x{}", Http3LogHex{ status });
+        delete streamContext;
         return;
     }
 
-    std::cout << getTimestamp() << " Server control stream created: " << std::hex << serverControlStream << std::dec << std::endl;
+    HTTP3_LOG_DEBUG("Server control stream created: {}", serverControlStream);
 
     status = MsQuic->StreamStart(serverControlStream, QUIC_STREAM_START_FLAG_IMMEDIATE);
     if (QUIC_FAILED(status)) {
-        std::cout << getTimestamp() << " ERROR: Failed to start server control stream: 0x" << std::hex << status << std::dec << std::endl;
-        MsQuic->StreamClose(serverControlStream);
+        HTTP3_LOG_ERROR("ERROR: Failed to start server control stream: 0x{}", Http3LogHex{ status });
+        MsQuic->StreamClose(serverControlStream);  // Never started, so no SHUTDOWN_COMPLETE
+        delete streamContext;
         return;
     }
 
-    std::cout << getTimestamp() << " Server control stream started successfully\n";
-
-    QUIC_BUFFER serverBuf = {};
-    serverBuf.Buffer = serverControlData.data();
-    serverBuf.Length = static_cast<uint32_t>(serverControlData.size());
+    HTTP3_LOG_DEBUG("Server control stream started successfully");
+    context.controlStream = serverControlStream;
 
-    std::cout << getTimestamp() << " About to send " << serverBuf.Length << " bytes\n";
+    HTTP3_LOG_DEBUG("About to send {} bytes", SERVER_CONTROL_BUFFER.Length);
 
-    status = MsQuic->StreamSend(serverControlStream, &serverBuf, 1, QUIC_SEND_FLAG_FIN, nullptr);
+    // No FIN: closing the control stream is a connection error (RFC 9114 section 6.2.1)
+    status = MsQuic->StreamSend(serverControlStream, &SERVER_CONTROL_BUFFER, 1, QUIC_SEND_FLAG_NONE, nullptr);
     if (QUIC_FAILED(status)) {
-        std::cout << getTimestamp() << " ERROR: Failed to send server SETTINGS: 0x" << std::hex << status << std::dec << std::endl;
+        HTTP3_LOG_ERROR("ERROR: Failed to send server SETTINGS: 0x{}", Http3LogHex{ status });
     }
     else {
-        std::cout << getTimestamp() << " SUCCESS: Server SETTINGS sent successfully\n";
+        HTTP3_LOG_DEBUG("SUCCESS: Server SETTINGS sent successfully");
     }
 
-    std::cout << getTimestamp() << " === SERVER SETTINGS SEND COMPLETE ===" << std::endl;
+    HTTP3_LOG_DEBUG("=== SERVER SETTINGS SEND COMPLETE ===");
 }
 
-// Helper function to parse SETTINGS payload
-static void parseSettingsPayload(const std::vector<uint8_t>& payload) {
-    std::cout << getTimestamp() << " === PARSING SETTINGS PAYLOAD ===" << std::endl;
-    std::cout << getTimestamp() << " Payload size: " << payload.size() << " bytes\n";
-
-    if (payload.empty()) {
-        std::cout << getTimestamp() << " ERROR: Empty payload\n";
+// Flush pending QPACK decoder instructions (insert count increments, section acknowledgements)
+// on our decoder stream, opening it on first use. They are copied straight into a pooled send
+// buffer and only cleared from the decoder once sent, so a stream that fails to open loses
+// nothing and a warm connection flushes without allocating.
+static void sendDecoderInstructions(ConnectionContext& context) {
+    auto instructions = context.decoder.pendingDecoderStreamData();
+    if (instructions.empty()) {
         return;
     }
 
-    std::cout << getTimestamp() << " Full payload: ";
-    for (size_t i = 0; i < payload.size(); ++i) {
-        std::cout << std::hex << std::setw(2) << std::setfill('0') << (int)payload[i] << " ";
-    }
-    std::cout << std::dec << std::endl;
-
-    size_t pos = 0;
-    int settingCount = 0;
-
-    while (pos < payload.size()) {
-        settingCount++;
-        std::cout << getTimestamp() << " Parsing setting #" << settingCount << " at position " << pos << "\n";
-
-        // Try to read setting ID (simplified varint parsing for debugging)
-        if (pos + 4 < payload.size()) {
-            uint32_t settingId = (payload[pos] << 24) | (payload[pos + 1] << 16) |
-                (payload[pos + 2] << 8) | payload[pos + 3];
-
-            std::cout << getTimestamp() << "   Setting ID bytes: "
-                << std::hex << (int)payload[pos] << " " << (int)payload[pos + 1] << " "
-                << (int)payload[pos + 2] << " " << (int)payload[pos + 3] << std::dec << "\n";
-            std::cout << getTimestamp() << "   Setting ID: 0x" << std::hex << settingId << std::dec << "\n";
-
-            pos += 4;
-
-            if (pos < payload.size()) {
-                uint8_t value = payload[pos++];
-                std::cout << getTimestamp() << "   Setting value: " << (int)value << "\n";
-
-                if (settingId == 0x2b603742) { // ENABLE_WEBTRANSPORT
-                    std::cout << getTimestamp() << "   -> ENABLE_WEBTRANSPORT = " << (int)value << "\n";
-                    if (value == 1) {
-                        std::cout << getTimestamp() << "   -> WebTransport is ENABLED!\n";
-                    }
-                }
-                else {
-                    std::cout << getTimestamp() << "   -> Unknown setting 0x" << std::hex << settingId
-                        << " = " << std::dec << (int)value << "\n";
-                }
-            }
-            else {
-                std::cout << getTimestamp() << "   ERROR: No value byte available\n";
-                break;
+    bool openedStream = false;
+    if (context.decoderStream == nullptr) {
+        HQUIC stream = nullptr;
+        auto* streamContext = new StreamContext(context, StreamContext::UNKNOWN_ID, true, StreamRole::QpackDecoder);
+        QUIC_STATUS status = MsQuic->StreamOpen(context.connection, QUIC_STREAM_OPEN_FLAG_UNIDIRECTIONAL, ServerStreamCallback, streamContext, &stream);
+        if (QUIC_SUCCEEDED(status)) {
+            status = MsQuic->StreamStart(stream, QUIC_STREAM_START_FLAG_IMMEDIATE);
+            if (QUIC_FAILED(status)) {
+                MsQuic->StreamClose(stream);
             }
         }
-        else {
-            std::cout << getTimestamp() << "   ERROR: Not enough bytes for setting ID (need 4, have "
-                << (payload.size() - pos) << ")\n";
-            break;
+        if (QUIC_FAILED(status)) {
+            delete streamContext;
+            HTTP3_LOG_ERROR("ERROR: Failed to open QPACK decoder stream: 0x{}", Http3LogHex{ status });
+            return;
         }
+        context.decoderStream = stream;
+        openedStream = true;
+        HTTP3_LOG_DEBUG("QPACK decoder stream opened: {}", stream);
     }
 
-    std::cout << getTimestamp() << " === SETTINGS PARSING COMPLETE (" << settingCount << " settings) ===" << std::endl;
+    // The bytes must outlive the send; SEND_COMPLETE returns the buffer to the pool
+    QuicSendBuffer* buffer = QuicSendBufferPool::acquire();
+    Http3FrameWriter writer = buffer->writer(instructions.size() + 1);
+    if (openedStream) {
+        writer.writeVarint(Http3StreamType::QPACK_DECODER);
+    }
+    writer.writeBytes(instructions);
+    buffer->commit(writer);
+
+    QUIC_STATUS status = MsQuic->StreamSend(context.decoderStream, buffer->buffers(), buffer->bufferCount(), QUIC_SEND_FLAG_NONE, buffer);
+    if (QUIC_FAILED(status)) {
+        HTTP3_LOG_ERROR("ERROR: Failed to send QPACK decoder instructions: 0x{}", Http3LogHex{ status });
+        QuicSendBufferPool::release(buffer);
+        return;
+    }
+    context.decoder.clearDecoderStreamData();
+    HTTP3_LOG_DEBUG("Sent {} bytes of QPACK decoder instructions", writer.size());
 }
 
 // CRITICAL FIX: Try a different approach - Force stream acceptance
@@ -707,41 +381,290 @@ static void parseSettingsPayload(const std::vector<uint8_t>& payload) {
 
 // DIAGNOSTIC FUNCTION: Add this to help debug the issue
 static void DiagnoseStreamIssue(HQUIC connection) {
-    std::cout << getTimestamp() << " === STREAM ISSUE DIAGNOSIS ===\n";
+    HTTP3_LOG_DEBUG("=== STREAM ISSUE DIAGNOSIS ===");
 
     // Check if this is a known MsQuic issue with specific versions
     uint32_t version[4] = {};
     uint32_t versionSize = sizeof(version);
     if (QUIC_SUCCEEDED(MsQuic->GetParam(nullptr, QUIC_PARAM_GLOBAL_LIBRARY_VERSION, &versionSize, version))) {
-        std::cout << getTimestamp() << " MsQuic version: " << version[0] << "." << version[1] << "." << version[2] << "." << version[3] << "\n";
+        HTTP3_LOG_DEBUG("MsQuic version: {}.{}.{}.{}", version[0], version[1], version[2], version[3]);
     }
 
     // Check connection state
     QUIC_STATISTICS_V2 stats = {};
     uint32_t statsSize = sizeof(stats);
     if (QUIC_SUCCEEDED(MsQuic->GetParam(connection, QUIC_PARAM_CONN_STATISTICS_V2, &statsSize, &stats))) {
-        std::cout << getTimestamp() << " Connection statistics:\n";
-        std::cout << getTimestamp() << "   RecvTotalPackets: " << stats.RecvTotalPackets << "\n";
-        std::cout << getTimestamp() << "   RecvTotalStreamBytes: " << stats.RecvTotalStreamBytes << "\n";
-        std::cout << getTimestamp() << "   SendTotalPackets: " << stats.SendTotalPackets << "\n";
-        std::cout << getTimestamp() << "   SendTotalStreamBytes: " << stats.SendTotalStreamBytes << "\n";
+        HTTP3_LOG_DEBUG("Connection statistics:");
+        HTTP3_LOG_DEBUG("  RecvTotalPackets: {}", stats.RecvTotalPackets);
+        HTTP3_LOG_DEBUG("  RecvTotalStreamBytes: {}", stats.RecvTotalStreamBytes);
+        HTTP3_LOG_DEBUG("  SendTotalPackets: {}", stats.SendTotalPackets);
+        HTTP3_LOG_DEBUG("  SendTotalStreamBytes: {}", stats.SendTotalStreamBytes);
     }
 
     // Check negotiated ALPN
     uint8_t alpnBuffer[16] = {};
     uint32_t alpnSize = sizeof(alpnBuffer);
     if (QUIC_SUCCEEDED(MsQuic->GetParam(connection, QUIC_PARAM_TLS_NEGOTIATED_ALPN, &alpnSize, alpnBuffer))) {
-        std::cout << getTimestamp() << " Negotiated ALPN: ";
-        for (uint32_t i = 0; i < alpnSize; ++i) {
-            std::cout << (char)alpnBuffer[i];
+        HTTP3_LOG_DEBUG("Negotiated ALPN: {}", std::string_view(reinterpret_cast<const char*>(alpnBuffer), alpnSize));
+    }
+
+    HTTP3_LOG_DEBUG("=== END DIAGNOSIS ===");
+}
+
+static void AnswerSession(ConnectionContext& context, uint64_t streamId);
+
+// Apply the client's SETTINGS - the first frame on its control stream - and answer the
+// WebTransport requests that were waiting for them
+static void ProcessSettingsFrame(ConnectionContext& context, std::span<const uint8_t> payload) {
+    HTTP3_LOG_DEBUG("SUCCESS: Found SETTINGS frame (type 0x04, {} bytes)", payload.size());
+
+    if (context.peerSettings.received) {
+        HTTP3_LOG_ERROR("ERROR: Second SETTINGS frame on the control stream");
+        CloseConnection(context, Http3ErrorCode::H3_FRAME_UNEXPECTED);
+        return;
+    }
+    uint64_t error = context.peerSettings.apply(payload);
+    if (error != 0) {
+        HTTP3_LOG_ERROR("ERROR: Malformed SETTINGS frame, closing with 0x{}", Http3LogHex{ error });
+        CloseConnection(context, error);
+        return;
+    }
+
+    const auto& settings = context.peerSettings;
+    HTTP3_LOG_INFO("Client SETTINGS: WebTransport {}, max sessions {}, extended CONNECT {}, datagrams {}",
+        settings.webTransportEnabled() ? "enabled" : "disabled", settings.webTransportMaxSessions,
+        settings.enableConnectProtocol ? "yes" : "no", settings.h3Datagram ? "yes" : "no");
+    if (settings.maxFieldSectionSize == Http3NegotiatedSettings::UNLIMITED) {
+        HTTP3_LOG_INFO("Client SETTINGS: QPACK table {}, blocked streams {}, max field section unlimited",
+            settings.qpackMaxTableCapacity, settings.qpackBlockedStreams);
+    }
+    else {
+        HTTP3_LOG_INFO("Client SETTINGS: QPACK table {}, blocked streams {}, max field section {}",
+            settings.qpackMaxTableCapacity, settings.qpackBlockedStreams, settings.maxFieldSectionSize);
+    }
+
+    // AnswerSession erases the sessions it turns down, so collect the waiting ones first
+    std::vector<uint64_t> waiting;
+    for (const auto& [streamId, session] : context.sessions) {
+        if (!session.established) {
+            waiting.push_back(streamId);
+        }
+    }
+    for (uint64_t streamId : waiting) {
+        HTTP3_LOG_DEBUG("Answering WebTransport request on stream {}", streamId);
+        AnswerSession(context, streamId);
+    }
+}
+
+static void RespondToRequest(ConnectionContext& context, HQUIC stream, uint64_t streamId, const WebTransportRequest& request);
+
+// Answer a request whose header section ran past SERVER_MAX_FIELD_SECTION_SIZE
+static void RejectOversizedRequest(HQUIC stream, uint64_t streamId) {
+    HTTP3_LOG_INFO("Request stream {} header section exceeds {} bytes, answering 431", streamId, SERVER_MAX_FIELD_SECTION_SIZE);
+    sendResponse(stream, 431, QUIC_SEND_FLAG_FIN);
+}
+
+// Decode a request's QPACK header block, validate it and answer on the request stream
+static void ProcessHeadersBlock(ConnectionContext& context, HQUIC stream, uint64_t streamId, std::span<const uint8_t> qpackData) {
+    HTTP3_LOG_TRACE("QPACK data ({} bytes): {}", qpackData.size(), Http3LogBytes{ qpackData, 16 });
+
+    // Decode QPACK headers against the connection's dynamic table, picking the pseudo-headers
+    // up as each field line is decoded. The views point into qpackData and a per-thread
+    // arena, so a typical request decodes without allocating; MsQuic never runs two
+    // callbacks on one worker thread at once.
+    static thread_local QpackArena arena;
+    arena.reset();
+    WebTransportRequest request;
+    WebTransportRequestParser parser(request);
+    auto status = context.decoder.decodeHeaders(streamId, qpackData, arena,
+        [&](const QpackDecoder::HeaderView& header, QpackDecoder::FieldRef ref) {
+            HTTP3_LOG_TRACE("  {}: {}", header.name, header.value);
+            return parser(header, ref);
+        });
+    if (status == QpackDecoder::Status::Blocked) {
+        // Answered from ProcessUnblockedRequests once the encoder stream catches up
+        HTTP3_LOG_DEBUG("Request stream {} blocked on the QPACK encoder stream", streamId);
+        context.blockedRequests[streamId] = stream;
+        return;
+    }
+    if (status == QpackDecoder::Status::Error) {
+        // A malformed section, or one past our SETTINGS_QPACK_BLOCKED_STREAMS (RFC 9204
+        // section 2.1.2), fails the whole connection
+        HTTP3_LOG_ERROR("ERROR: Failed to decode QPACK headers");
+        CloseConnection(context, Http3ErrorCode::QPACK_DECOMPRESSION_FAILED);
+        return;
+    }
+
+    // A request the parser or the size limit cut short is acknowledged all the same
+    sendDecoderInstructions(context);
+    if (status == QpackDecoder::Status::TooLarge) {
+        RejectOversizedRequest(stream, streamId);
+        return;
+    }
+    RespondToRequest(context, stream, streamId, parser.finish());
+}
+
+// Decode the trailer section of a request stream. Nothing in it changes the answer, but
+// it still has to go through the decoder so the encoder sees it acknowledged.
+static void ProcessTrailersBlock(ConnectionContext& context, uint64_t streamId, std::span<const uint8_t> qpackData) {
+    static thread_local QpackArena arena;
+    arena.reset();
+    auto status = context.decoder.decodeHeaders(streamId, qpackData, arena,
+        [](const QpackDecoder::HeaderView& header, QpackDecoder::FieldRef) {
+            HTTP3_LOG_TRACE("  trailer {}: {}", header.name, header.value);
+            return true;
+        });
+    if (status == QpackDecoder::Status::Blocked) {
+        // Not in blockedRequests, so ProcessUnblockedRequests passes over it
+        HTTP3_LOG_DEBUG("Trailers on stream {} blocked on the QPACK encoder stream", streamId);
+        return;
+    }
+    if (status == QpackDecoder::Status::Error) {
+        HTTP3_LOG_ERROR("ERROR: Failed to decode QPACK trailers");
+        CloseConnection(context, Http3ErrorCode::QPACK_DECOMPRESSION_FAILED);
+        return;
+    }
+    HTTP3_LOG_DEBUG("Trailers on stream {} ignored", streamId);
+    sendDecoderInstructions(context);
+}
+
+// Answer requests whose header sections were waiting on the client's encoder stream.
+// Sections of streams with no entry in blockedRequests are trailers and are skipped.
+static void ProcessUnblockedRequests(ConnectionContext& context) {
+    for (const auto& section : context.decoder.takeUnblockedSections()) {
+        auto it = context.blockedRequests.find(section.streamId);
+        if (it == context.blockedRequests.end()) {
+            continue;
+        }
+        HQUIC stream = it->second;
+        context.blockedRequests.erase(it);
+
+        if (section.status == QpackDecoder::Status::TooLarge) {
+            RejectOversizedRequest(stream, section.streamId);
+            continue;
+        }
+        if (section.status != QpackDecoder::Status::Ok) {
+            HTTP3_LOG_ERROR("ERROR: Failed to decode unblocked QPACK headers on stream {}", section.streamId);
+            CloseConnection(context, Http3ErrorCode::QPACK_DECOMPRESSION_FAILED);
+            return;
+        }
+        HTTP3_LOG_DEBUG("Request stream {} unblocked", section.streamId);
+        RespondToRequest(context, stream, section.streamId, WebTransportRequestParser::parse(section.headers));
+    }
+}
+
+// Answer a decoded request on its stream. A valid WebTransport request is only accepted
+// once the client's SETTINGS have shown it supports WebTransport (draft-02 section 3.1).
+static void RespondToRequest(ConnectionContext& context, HQUIC stream, uint64_t streamId, const WebTransportRequest& request) {
+    Count(LocalWorkerStats().requests);
+    if (!request.isValid) {
+        HTTP3_LOG_INFO("Invalid WebTransport request: {}", request.error);
+
+        // Send 400 Bad Request
+        sendResponse(stream, 400, QUIC_SEND_FLAG_FIN);
+        return;
+    }
+
+    HTTP3_LOG_DEBUG("SUCCESS: Valid WebTransport CONNECT request!");
+    HTTP3_LOG_DEBUG("Authority: {}", request.authority);
+    HTTP3_LOG_DEBUG("Path: {}", request.path);
+
+    auto& session = context.sessions[streamId];
+    session.stream = stream;
+    session.authority = request.authority;
+    session.path = request.path;
+
+    if (!context.peerSettings.received) {
+        HTTP3_LOG_DEBUG("Waiting for the client's SETTINGS before answering stream {}", streamId);
+        return;
+    }
+    AnswerSession(context, streamId);
+}
+
+// Accept a session if the client's SETTINGS allow sessions at all; a refused session is forgotten
+static void AnswerSession(ConnectionContext& context, uint64_t streamId) {
+    auto it = context.sessions.find(streamId);
+    if (it == context.sessions.end()) {
+        return;
+    }
+    auto& session = it->second;
+
+    if (!context.peerSettings.webTransportEnabled()) {
+        HTTP3_LOG_INFO("Client SETTINGS do not enable WebTransport, answering 400");
+        sendResponse(session.stream, 400, QUIC_SEND_FLAG_FIN);
+        context.sessions.erase(it);
+        return;
+    }
+
+    // Send HTTP/3 200 OK response
+    QUIC_STATUS sendStatus = sendResponse(session.stream, 200, QUIC_SEND_FLAG_NONE);
+    if (QUIC_SUCCEEDED(sendStatus)) {
+        session.established = true;
+        Count(LocalWorkerStats().sessionsEstablished);
+        HTTP3_LOG_INFO("SUCCESS: Sent HTTP/3 200 OK response!");
+        HTTP3_LOG_INFO("WebTransport session established to {}{}", session.authority, session.path);
+    }
+    else {
+        HTTP3_LOG_ERROR("ERROR: Failed to send 200 OK response");
+    }
+}
+
+// Complete a deferred receive. MsQuic keeps the stream's flow control window closed until
+// now, so a slow consumer slows the peer down rather than piling up copies.
+static void ReleaseReceive(HQUIC stream, StreamContext& context) {
+    HTTP3_LOG_DEBUG("Releasing {} borrowed bytes on stream {}", context.borrowedLength, context.id);
+    MsQuic->StreamReceiveComplete(stream, context.borrowedLength);
+    context.borrowed.clear();
+    context.borrowedLength = 0;
+}
+
+// The application side of a WebTransport stream: echo what the receive brought. Inline,
+// the data is copied into a pooled send buffer and the receive completes right away. With
+// -defer_receive it goes out straight from MsQuic's receive buffers and SEND_COMPLETE
+// releases the receive, so the client can only send as fast as the echo drains. True when
+// the receive has been deferred.
+static bool EchoWebTransportData(HQUIC stream, StreamContext& context, uint64_t consumed) {
+    QUIC_STATUS status = QUIC_STATUS_SUCCESS;
+    if (DeferReceiveCompletion) {
+        context.borrowedLength = consumed;
+        status = MsQuic->StreamSend(stream, context.borrowed.data(), static_cast<uint32_t>(context.borrowed.size()),
+            QUIC_SEND_FLAG_NONE, &context);
+        if (QUIC_SUCCEEDED(status)) {
+            return true;
         }
-        std::cout << "\n";
+        context.borrowedLength = 0;
     }
+    else {
+        size_t length = 0;
+        for (const QUIC_BUFFER& chunk : context.borrowed) {
+            length += chunk.Length;
+        }
+        QuicSendBuffer* buffer = QuicSendBufferPool::acquire();
+        Http3FrameWriter writer = buffer->writer(length);
+        for (const QUIC_BUFFER& chunk : context.borrowed) {
+            writer.writeBytes({ chunk.Buffer, chunk.Length });
+        }
+        buffer->commit(writer);
+        status = MsQuic->StreamSend(stream, buffer->buffers(), buffer->bufferCount(), QUIC_SEND_FLAG_NONE, buffer);
+        if (QUIC_FAILED(status)) {
+            QuicSendBufferPool::release(buffer);
+        }
+    }
+    if (QUIC_FAILED(status)) {
+        HTTP3_LOG_ERROR("ERROR: Failed to echo WebTransport stream data: 0x{}", Http3LogHex{ status });
+    }
+    context.borrowed.clear();
+    return false;
+}
 
-    std::cout << getTimestamp() << " === END DIAGNOSIS ===\n";
+// Reset a WebTransport stream we will not serve, in both directions
+static void ResetWebTransportStream(HQUIC stream, StreamContext& context, uint64_t errorCode) {
+    MsQuic->StreamShutdown(stream, QUIC_STREAM_SHUTDOWN_FLAG_ABORT, errorCode);
+    context.role = StreamRole::Ignored;
+    context.borrowed.clear();
 }
 
-// Enhanced ServerStreamCallback with manual stream detection
+// ServerStreamCallback: dispatches on the role cached in the stream's context
 _IRQL_requires_max_(PASSIVE_LEVEL)
 _Function_class_(QUIC_STREAM_CALLBACK)
 QUIC_STATUS QUIC_API ServerStreamCallback(
@@ -749,252 +672,263 @@ QUIC_STATUS QUIC_API ServerStreamCallback(
     _In_opt_ void* Context,
     _Inout_ QUIC_STREAM_EVENT* Event
 ) {
+    // Every stream carries its own context (see PEER_STREAM_STARTED and StreamOpen)
+    auto& stream = *static_cast<StreamContext*>(Context);
+    auto& context = stream.connection;
+    uint64_t streamId = stream.id;
+
     switch (Event->Type) {
+    case QUIC_STREAM_EVENT_START_COMPLETE: {
+        // Our own streams learn their ID once MsQuic has assigned it
+        stream.id = Event->START_COMPLETE.ID;
+        HTTP3_LOG_DEBUG("Stream {} started with ID {}", Stream, stream.id);
+        break;
+    }
+
     case QUIC_STREAM_EVENT_RECEIVE: {
-        // === MANUAL STREAM DETECTION ===
-        bool isNewStream = (seenStreams.find(Stream) == seenStreams.end());
-        if (isNewStream) {
-            seenStreams.insert(Stream);
-
-            std::cout << "\n" << getTimestamp() << " *** NEW STREAM DETECTED MANUALLY! ***\n";
-            std::cout << getTimestamp() << " === MANUAL PEER_STREAM_STARTED PROCESSING ===\n";
-            std::cout << getTimestamp() << " Stream handle: " << std::hex << Stream << std::dec << "\n";
-
-            // Get the actual QUIC stream ID
-            QUIC_UINT62 streamId = 0;
-            uint32_t bufferLength = sizeof(streamId);
-            QUIC_STATUS status = MsQuic->GetParam(Stream, QUIC_PARAM_STREAM_ID, &bufferLength, &streamId);
-
-            if (QUIC_SUCCEEDED(status)) {
-                std::cout << getTimestamp() << " QUIC stream ID: " << streamId << "\n";
-
-                // Analyze stream type using stream ID patterns
-                std::cout << getTimestamp() << " Stream ID analysis:\n";
-                std::cout << getTimestamp() << "   streamId % 4 = " << (streamId % 4) << "\n";
-
-                if (streamId % 4 == 2) {
-                    std::cout << getTimestamp() << "   -> UNIDIRECTIONAL (client-initiated)\n";
-                    std::cout << getTimestamp() << "   -> This should be the control stream with SETTINGS\n";
-                }
-                else if (streamId % 4 == 0) {
-                    std::cout << getTimestamp() << "   -> BIDIRECTIONAL (client-initiated)\n";
-                    std::cout << getTimestamp() << "   -> This should be the WebTransport CONNECT stream\n";
-                }
-                else if (streamId % 4 == 3) {
-                    std::cout << getTimestamp() << "   -> UNIDIRECTIONAL (server-initiated)\n";
-                }
-                else if (streamId % 4 == 1) {
-                    std::cout << getTimestamp() << "   -> BIDIRECTIONAL (server-initiated)\n";
-                }
-            }
-            else {
-                std::cout << getTimestamp() << " ERROR: Failed to get stream ID\n";
+        // === DETAILED RECEIVE EVENT PROCESSING ===
+        HTTP3_LOG_DEBUG("=== RECEIVE EVENT ON STREAM {} ===", Stream);
+        Count(LocalWorkerStats().receivedBytes, Event->RECEIVE.TotalBufferLength);
+        HTTP3_LOG_TRACE("Buffers: {}, total length: {}", Event->RECEIVE.BufferCount, Event->RECEIVE.TotalBufferLength);
+
+        // Show raw buffer data; MsQuic may split one receive over several buffers
+        if constexpr (Http3Log::enabled(HTTP3_LOG_LEVEL_TRACE)) {
+            for (uint32_t b = 0; b < Event->RECEIVE.BufferCount; ++b) {
+                const QUIC_BUFFER& buffer = Event->RECEIVE.Buffers[b];
+                HTTP3_LOG_TRACE("Raw buffer {} ({} bytes): {}", b, buffer.Length, Http3LogBytes{ { buffer.Buffer, buffer.Length } });
             }
-
-            std::cout << getTimestamp() << " === END MANUAL PEER_STREAM_STARTED PROCESSING ===\n";
         }
 
-        // === DETAILED RECEIVE EVENT PROCESSING ===
-        std::cout << getTimestamp() << " === RECEIVE EVENT ON STREAM " << std::hex << Stream << std::dec << " ===\n";
-        std::cout << getTimestamp() << " Buffer size: " << Event->RECEIVE.Buffers->Length << "\n";
+        // Parse straight out of MsQuic's buffers - they stay valid until the receive is completed
+        QuicBufferCursor cursor(std::span<const QUIC_BUFFER>(Event->RECEIVE.Buffers, Event->RECEIVE.BufferCount));
+        auto& decoder = stream.decoder;
 
-        // Get stream ID for processing
-        QUIC_UINT62 streamId = 0;
-        uint32_t bufferLength = sizeof(streamId);
-        MsQuic->GetParam(Stream, QUIC_PARAM_STREAM_ID, &bufferLength, &streamId);
-
-        // Show raw buffer data
-        std::cout << getTimestamp() << " Raw buffer (" << Event->RECEIVE.Buffers->Length << " bytes): ";
-        for (uint32_t i = 0; i < Event->RECEIVE.Buffers->Length && i < 32; ++i) {
-            std::cout << std::hex << std::setw(2) << std::setfill('0')
-                << (int)Event->RECEIVE.Buffers->Buffer[i] << " ";
+        if (streamId % 4 == 2) {
+            HTTP3_LOG_DEBUG("Processing UNIDIRECTIONAL STREAM (ID {})", streamId);
+        }
+        else if (streamId % 4 == 0) {
+            HTTP3_LOG_DEBUG("Processing BIDIRECTIONAL STREAM (ID {})", streamId);
+        }
+        else {
+            HTTP3_LOG_DEBUG("Other stream type (ID {})", streamId);
         }
-        std::cout << std::dec << "\n";
-
-        // Safely copy the buffer data immediately
-        std::vector<uint8_t> data;
-        data.resize(Event->RECEIVE.Buffers->Length);
-        std::memcpy(data.data(), Event->RECEIVE.Buffers->Buffer, Event->RECEIVE.Buffers->Length);
-
-        // CRITICAL: Complete the receive immediately
-        MsQuic->StreamReceiveComplete(Stream, Event->RECEIVE.Buffers->Length);
-        std::cout << getTimestamp() << " StreamReceiveComplete called\n";
 
-        // Process based on stream type
-        if (streamId % 4 == 2) {
-            // Unidirectional control stream
-            std::cout << getTimestamp() << " Processing CONTROL STREAM (ID " << streamId << ")\n";
+        // Drain every frame in this receive (e.g. SETTINGS followed by GREASE, HEADERS followed by DATA)
+        for (const auto& event : decoder.events(cursor)) {
+            if (context.closing) {
+                break;
+            }
 
-            if (!data.empty() && data[0] == 0x00) {
-                std::cout << getTimestamp() << " SUCCESS: Found control stream type identifier (0x00)\n";
+            switch (event.type) {
+            case QuicFrameDecoder::EventType::StreamType:
+                if (event.value == Http3StreamType::CONTROL) {
+                    HTTP3_LOG_DEBUG("SUCCESS: Found control stream type identifier (0x00)");
+                    if (context.peerControlStream != nullptr) {
+                        HTTP3_LOG_ERROR("ERROR: Second control stream from the client");
+                        CloseConnection(context, Http3ErrorCode::H3_STREAM_CREATION_ERROR);
+                        stream.role = StreamRole::Ignored;
+                        decoder.enterRawMode();
+                        break;
+                    }
+                    context.peerControlStream = Stream;
+                    stream.role = StreamRole::Control;
+                }
+                else if (event.value == Http3StreamType::QPACK_ENCODER) {
+                    // Encoder instructions are not framed; the rest of the stream goes to the QPACK decoder
+                    HTTP3_LOG_DEBUG("Found QPACK encoder stream (0x02)");
+                    stream.role = StreamRole::QpackEncoder;
+                    decoder.enterRawMode();
+                }
+                else if (event.value == Http3StreamType::QPACK_DECODER) {
+                    // Our responses only use the static table, so the client's decoder has nothing to acknowledge
+                    HTTP3_LOG_DEBUG("Found QPACK decoder stream (0x03)");
+                    stream.role = StreamRole::QpackDecoder;
+                    decoder.enterRawMode();
+                }
+                else {
+                    // WebTransport uni streams are not handled yet
+                    HTTP3_LOG_DEBUG("Ignoring unidirectional stream type 0x{}", Http3LogHex{ event.value });
+                    stream.role = StreamRole::Ignored;
+                    decoder.enterRawMode();
+                }
+                break;
 
-                if (data.size() > 1) {
-                    std::vector<uint8_t> frameData(data.begin() + 1, data.end());
-                    std::cout << getTimestamp() << " Frame data (" << frameData.size() << " bytes): ";
-                    for (size_t i = 0; i < frameData.size() && i < 16; ++i) {
-                        std::cout << std::hex << std::setw(2) << std::setfill('0') << (int)frameData[i] << " ";
+            case QuicFrameDecoder::EventType::Frame:
+                if (stream.role == StreamRole::Control) {
+                    // The decoder has already checked that SETTINGS came first; request
+                    // frames never belong here (RFC 9114 section 7.2)
+                    if (event.value == Http3FrameType::SETTINGS) {
+                        ProcessSettingsFrame(context, event.payload);
                     }
-                    std::cout << std::dec << "\n";
-
-                    // Parse HTTP/3 SETTINGS frame
-                    if (frameData.size() >= 2 && frameData[0] == 0x04) {
-                        std::cout << getTimestamp() << " SUCCESS: Found SETTINGS frame (type 0x04)\n";
-                        std::cout << getTimestamp() << " Frame length: " << (int)frameData[1] << "\n";
-
-                        if (frameData.size() >= 7) {
-                            // Check for ENABLE_WEBTRANSPORT setting
-                            bool foundWebTransport = false;
-                            for (size_t i = 2; i < frameData.size() - 4; ++i) {
-                                if (frameData[i] == 0x2b && frameData[i + 1] == 0x60 &&
-                                    frameData[i + 2] == 0x37 && frameData[i + 3] == 0x42) {
-                                    std::cout << getTimestamp() << " SUCCESS: Found ENABLE_WEBTRANSPORT setting!\n";
-                                    if (i + 4 < frameData.size()) {
-                                        std::cout << getTimestamp() << " WebTransport enabled: " << (int)frameData[i + 4] << "\n";
-                                        foundWebTransport = true;
-                                    }
-                                    break;
-                                }
-                            }
-
-                            if (foundWebTransport) {
-                                std::cout << getTimestamp() << " SUCCESS: Control stream SETTINGS processed successfully!\n";
-                                std::cout << getTimestamp() << " WebTransport is now enabled on this connection!\n";
-
-                                // TODO: Send server SETTINGS response here
-                                std::cout << getTimestamp() << " Should send server SETTINGS response...\n";
-                            }
-                        }
+                    else if (event.value == Http3FrameType::HEADERS || event.value == Http3FrameType::PUSH_PROMISE) {
+                        HTTP3_LOG_ERROR("ERROR: {} frame on the control stream", Http3FrameType::name(event.value));
+                        CloseConnection(context, Http3ErrorCode::H3_FRAME_UNEXPECTED);
+                    }
+                    else {
+                        HTTP3_LOG_DEBUG("Control frame {} ignored", Http3FrameType::name(event.value));
                     }
                 }
-            }
-            else {
-                std::cout << getTimestamp() << " ERROR: Control stream type incorrect or missing\n";
-                std::cout << getTimestamp() << " Expected 0x00, got: 0x" << std::hex << (data.empty() ? 0 : data[0]) << std::dec << "\n";
-            }
-
-        }
-        else if (streamId % 4 == 0) {
-            // Bidirectional request stream
-            std::cout << getTimestamp() << " Processing BIDIRECTIONAL STREAM (ID " << streamId << ")\n";
-
-            if (!data.empty() && data[0] == 0x01) {
-                std::cout << getTimestamp() << " Found HTTP/3 HEADERS frame (type 0x01)\n";
-
-                // Parse the HEADERS frame
-                if (data.size() >= 3) {
-                    std::cout << getTimestamp() << " Frame length indicator: 0x" << std::hex << (int)data[1] << std::dec << "\n";
-
-                    // Extract QPACK data (skip frame type and length)
-                    std::vector<uint8_t> qpackData;
-                    if (data[1] < 64) {
-                        // Single byte length
-                        uint8_t frameLength = data[1];
-                        if (data.size() >= 2 + frameLength) {
-                            qpackData.assign(data.begin() + 2, data.begin() + 2 + frameLength);
+                else if (stream.role == StreamRole::Request && event.value == Http3FrameType::HEADERS) {
+                    // The first HEADERS frame is the request and the second its trailers;
+                    // nothing may follow the trailers (RFC 9114 section 4.1)
+                    HTTP3_LOG_DEBUG("Found HTTP/3 HEADERS frame (type 0x01, {} bytes)", event.payload.size());
+                    ++stream.headerSections;
+                    if (stream.headerSections == 1) {
+                        if (!event.payload.empty()) {
+                            ProcessHeadersBlock(context, Stream, streamId, event.payload);
                         }
                     }
+                    else if (stream.headerSections == 2) {
+                        ProcessTrailersBlock(context, streamId, event.payload);
+                    }
                     else {
-                        // Multi-byte length - simplified for this case
-                        std::cout << getTimestamp() << " Multi-byte frame length detected\n";
-                        if (data.size() > 2) {
-                            qpackData.assign(data.begin() + 2, data.end());
-                        }
+                        HTTP3_LOG_ERROR("ERROR: HEADERS frame after the trailers on stream {}", streamId);
+                        CloseConnection(context, Http3ErrorCode::H3_FRAME_UNEXPECTED);
                     }
+                }
+                else {
+                    HTTP3_LOG_DEBUG("Unexpected frame type: 0x{}", Http3LogHex{ event.value });
+                }
+                break;
 
-                    if (!qpackData.empty()) {
-                        std::cout << getTimestamp() << " QPACK data (" << qpackData.size() << " bytes): ";
-                        for (size_t i = 0; i < qpackData.size() && i < 16; ++i) {
-                            std::cout << std::hex << std::setw(2) << std::setfill('0') << (int)qpackData[i] << " ";
-                        }
-                        std::cout << std::dec << "\n";
-
-                        // Decode QPACK headers
-                        QpackDecoder decoder;
-                        std::vector<QpackDecoder::Header> headers;
-                        if (decoder.decodeHeaders(qpackData, headers)) {
-                            std::cout << getTimestamp() << " SUCCESS: Decoded " << headers.size() << " headers:\n";
-                            for (const auto& header : headers) {
-                                std::cout << getTimestamp() << "   " << header.name << ": " << header.value << "\n";
-                            }
-
-                            // Validate WebTransport request
-                            WebTransportValidator validator;
-                            auto result = validator.validate(headers);
-
-                            if (result.isWebTransport) {
-                                std::cout << getTimestamp() << " SUCCESS: Valid WebTransport CONNECT request!\n";
-                                std::cout << getTimestamp() << " Authority: " << result.authority << "\n";
-                                std::cout << getTimestamp() << " Path: " << result.path << "\n";
-
-                                // Send HTTP/3 200 OK response
-                                auto response = createHttp3Response(200);
-                                QUIC_BUFFER responseBuf = {};
-                                responseBuf.Buffer = response.data();
-                                responseBuf.Length = static_cast<uint32_t>(response.size());
-
-                                QUIC_STATUS sendStatus = MsQuic->StreamSend(Stream, &responseBuf, 1, QUIC_SEND_FLAG_NONE, nullptr);
-                                if (QUIC_SUCCEEDED(sendStatus)) {
-                                    std::cout << getTimestamp() << " SUCCESS: Sent HTTP/3 200 OK response!\n";
-                                    std::cout << getTimestamp() << " WebTransport connection established!\n";
-                                }
-                                else {
-                                    std::cout << getTimestamp() << " ERROR: Failed to send 200 OK response\n";
-                                }
-                            }
-                            else {
-                                std::cout << getTimestamp() << " Invalid WebTransport request: " << result.message << "\n";
-
-                                // Send 400 Bad Request
-                                auto response = createHttp3Response(400);
-                                QUIC_BUFFER responseBuf = {};
-                                responseBuf.Buffer = response.data();
-                                responseBuf.Length = static_cast<uint32_t>(response.size());
-                                MsQuic->StreamSend(Stream, &responseBuf, 1, QUIC_SEND_FLAG_FIN, nullptr);
-                            }
-                        }
-                        else {
-                            std::cout << getTimestamp() << " ERROR: Failed to decode QPACK headers\n";
-                        }
-                    }
+            case QuicFrameDecoder::EventType::DataChunk:
+                HTTP3_LOG_TRACE("DATA chunk ({} bytes{})", event.payload.size(), event.frameComplete ? ", frame complete" : "");
+                if (stream.role == StreamRole::Control) {
+                    HTTP3_LOG_ERROR("ERROR: DATA frame on the control stream");
+                    CloseConnection(context, Http3ErrorCode::H3_FRAME_UNEXPECTED);
                 }
+                else if (stream.role == StreamRole::Request && stream.headerSections != 1) {
+                    // DATA belongs between the request and its trailers
+                    HTTP3_LOG_ERROR("ERROR: DATA frame {} on stream {}", stream.headerSections == 0 ? "before the request" : "after the trailers", streamId);
+                    CloseConnection(context, Http3ErrorCode::H3_FRAME_UNEXPECTED);
+                }
+                break;
+
+            case QuicFrameDecoder::EventType::WebTransportStream: {
+                // Streams of a session we have not accepted are not buffered until it is
+                HTTP3_LOG_DEBUG("WebTransport bidirectional stream for session {}", event.value);
+                auto session = context.sessions.find(event.value);
+                if (session == context.sessions.end() || !session->second.established) {
+                    HTTP3_LOG_INFO("No established WebTransport session {}, resetting stream {}", event.value, streamId);
+                    ResetWebTransportStream(Stream, stream, Http3ErrorCode::H3_REQUEST_REJECTED);
+                    break;
+                }
+                stream.role = StreamRole::WebTransport;
+                stream.sessionId = event.value;
+                break;
             }
-            else {
-                std::cout << getTimestamp() << " Unexpected frame type: 0x" << std::hex << (data.empty() ? 0 : data[0]) << std::dec << "\n";
+
+            case QuicFrameDecoder::EventType::RawData:
+                HTTP3_LOG_TRACE("Stream data ({} bytes)", event.payload.size());
+                if (stream.role == StreamRole::QpackEncoder) {
+                    if (!context.decoder.processEncoderStream(event.payload)) {
+                        HTTP3_LOG_ERROR("ERROR: Invalid QPACK encoder stream");
+                        CloseConnection(context, Http3ErrorCode::QPACK_ENCODER_STREAM_ERROR);
+                        break;
+                    }
+                    sendDecoderInstructions(context);
+                    ProcessUnblockedRequests(context);
+                }
+                else if (stream.role == StreamRole::WebTransport) {
+                    // The session may have ended with its CONNECT stream since this stream opened
+                    if (!context.sessions.contains(stream.sessionId)) {
+                        HTTP3_LOG_INFO("WebTransport session {} is gone, resetting stream {}", stream.sessionId, streamId);
+                        ResetWebTransportStream(Stream, stream, Http3ErrorCode::H3_REQUEST_CANCELLED);
+                        break;
+                    }
+                    // Raw data always points into MsQuic's buffers, so it can be borrowed as is
+                    stream.borrowed.push_back({ static_cast<uint32_t>(event.payload.size()), const_cast<uint8_t*>(event.payload.data()) });
+                }
+                break;
+
+            case QuicFrameDecoder::EventType::Error:
+                // H3_FRAME_ERROR for a malformed frame, H3_EXCESSIVE_LOAD past the reassembly limit,
+                // H3_MISSING_SETTINGS for a control stream that opens with anything else,
+                // H3_FRAME_UNEXPECTED for a misplaced WEBTRANSPORT_STREAM. The control stream
+                // cannot be lost, and a frame out of place is a connection error, so those
+                // close the connection.
+                HTTP3_LOG_ERROR("ERROR: Frame decoding failed: {}", event.error);
+                if (stream.role == StreamRole::Control || event.errorCode == Http3ErrorCode::H3_FRAME_UNEXPECTED) {
+                    CloseConnection(context, event.errorCode);
+                }
+                else {
+                    MsQuic->StreamShutdown(Stream, QUIC_STREAM_SHUTDOWN_FLAG_ABORT, event.errorCode);
+                }
+                break;
+
+            default:
+                break;
             }
         }
-        else {
-            std::cout << getTimestamp() << " Other stream type (ID " << streamId << ")\n";
+
+        // Frame views point into MsQuic's buffers, so only hand them back once we are done,
+        // and only as many bytes as the decoder took: all of them unless it failed or the
+        // connection is closing, in which case the rest will never be read
+        uint64_t consumed = cursor.consumed();
+        if (!stream.borrowed.empty() && EchoWebTransportData(Stream, stream, consumed)) {
+            HTTP3_LOG_DEBUG("Receive of {} bytes deferred until the echo completes", consumed);
+            HTTP3_LOG_DEBUG("=== END RECEIVE EVENT ===\n");
+            return QUIC_STATUS_PENDING;
         }
+        MsQuic->StreamReceiveComplete(Stream, consumed);
+        HTTP3_LOG_DEBUG("StreamReceiveComplete called ({} of {} bytes)", consumed, Event->RECEIVE.TotalBufferLength);
 
-        std::cout << getTimestamp() << " === END RECEIVE EVENT ===\n\n";
+        HTTP3_LOG_DEBUG("=== END RECEIVE EVENT ===\n");
         break;
     }
 
     case QUIC_STREAM_EVENT_SEND_COMPLETE: {
-        QUIC_UINT62 streamId = 0;
-        uint32_t bufferLength = sizeof(streamId);
-        MsQuic->GetParam(Stream, QUIC_PARAM_STREAM_ID, &bufferLength, &streamId);
+        HTTP3_LOG_DEBUG("SEND_COMPLETE on stream ID {}", streamId);
 
-        std::cout << getTimestamp() << " SEND_COMPLETE on stream ID " << streamId << "\n";
+        // An echo of borrowed data carries the stream's own context, pooled sends their
+        // buffer, and the static responses and SETTINGS nothing
+        if (Event->SEND_COMPLETE.ClientContext == &stream) {
+            ReleaseReceive(Stream, stream);
+        }
+        else {
+            QuicSendBufferPool::release(static_cast<QuicSendBuffer*>(Event->SEND_COMPLETE.ClientContext));
+        }
         break;
     }
 
-    case QUIC_STREAM_EVENT_SHUTDOWN_COMPLETE: {
-        QUIC_UINT62 streamId = 0;
-        uint32_t bufferLength = sizeof(streamId);
-        MsQuic->GetParam(Stream, QUIC_PARAM_STREAM_ID, &bufferLength, &streamId);
+    case QUIC_STREAM_EVENT_PEER_SEND_SHUTDOWN: {
+        // The client has finished its side of a WebTransport stream, so finish the echo too;
+        // the FIN follows whatever echo is still queued
+        HTTP3_LOG_DEBUG("PEER_SEND_SHUTDOWN on stream {}", streamId);
+        if (stream.role == StreamRole::WebTransport) {
+            MsQuic->StreamShutdown(Stream, QUIC_STREAM_SHUTDOWN_FLAG_GRACEFUL, 0);
+        }
+        break;
+    }
 
-        std::cout << getTimestamp() << " SHUTDOWN_COMPLETE on stream " << streamId << "\n";
+    case QUIC_STREAM_EVENT_SHUTDOWN_COMPLETE: {
+        HTTP3_LOG_DEBUG("SHUTDOWN_COMPLETE on stream {}", streamId);
 
-        // Remove from seen streams
-        seenStreams.erase(Stream);
+        // The session ends with its CONNECT stream, and a request or trailers still parked in
+        // the QPACK decoder will never be decoded
+        if (auto session = context.sessions.find(streamId); session != context.sessions.end()) {
+            if (session->second.established) {
+                Count(LocalWorkerStats().sessionsClosed);
+            }
+            context.sessions.erase(session);
+            HTTP3_LOG_INFO("WebTransport session on stream {} closed", streamId);
+        }
+        context.blockedRequests.erase(streamId);
+        if (context.decoder.hasBlockedSections(streamId)) {
+            context.decoder.cancelStream(streamId);
+            sendDecoderInstructions(context);
+        }
+        if (Stream == context.peerControlStream) context.peerControlStream = nullptr;
+        if (Stream == context.controlStream) context.controlStream = nullptr;
+        if (Stream == context.decoderStream) context.decoderStream = nullptr;
 
         MsQuic->StreamClose(Stream);
+        delete &stream;
         break;
     }
 
     default:
-        std::cout << getTimestamp() << " Other stream event: " << Event->Type << "\n";
+        HTTP3_LOG_DEBUG("Other stream event: {}", Event->Type);
         break;
     }
 
@@ -1010,53 +944,52 @@ QUIC_STATUS QUIC_API ServerConnectionCallback(
     _In_opt_ void* Context,
     _Inout_ QUIC_CONNECTION_EVENT* Event
 ) {
-    UNREFERENCED_PARAMETER(Context);
+    auto* context = static_cast<ConnectionContext*>(Context);
 
-    std::cout << getTimestamp() << " === SERVER CONNECTION CALLBACK ===\n";
-    std::cout << getTimestamp() << " Connection: " << std::hex << Connection << std::dec << "\n";
-    std::cout << getTimestamp() << " Event type: " << Event->Type << "\n";
+    HTTP3_LOG_DEBUG("=== SERVER CONNECTION CALLBACK ===");
+    HTTP3_LOG_DEBUG("Connection: {}", Connection);
+    HTTP3_LOG_DEBUG("Event type: {}", Event->Type);
 
     // COMPREHENSIVE EVENT TYPE ANALYSIS
-    std::cout << getTimestamp() << " Event type analysis:\n";
+    HTTP3_LOG_TRACE("Event type analysis:");
     switch (Event->Type) {
-    case 0: std::cout << getTimestamp() << "   Type 0 = QUIC_CONNECTION_EVENT_CONNECTED\n"; break;
-    case 1: std::cout << getTimestamp() << "   Type 1 = QUIC_CONNECTION_EVENT_SHUTDOWN_INITIATED_BY_TRANSPORT\n"; break;
-    case 2: std::cout << getTimestamp() << "   Type 2 = QUIC_CONNECTION_EVENT_SHUTDOWN_INITIATED_BY_PEER\n"; break;
-    case 3: std::cout << getTimestamp() << "   Type 3 = QUIC_CONNECTION_EVENT_SHUTDOWN_COMPLETE\n"; break;
-    case 4: std::cout << getTimestamp() << "   Type 4 = QUIC_CONNECTION_EVENT_LOCAL_ADDRESS_CHANGED\n"; break;
-    case 5: std::cout << getTimestamp() << "   Type 5 = QUIC_CONNECTION_EVENT_PEER_ADDRESS_CHANGED\n"; break;
-    case 6: std::cout << getTimestamp() << "   Type 6 = QUIC_CONNECTION_EVENT_PEER_STREAM_STARTED *** THIS IS WHAT WE WANT ***\n"; break;
-    case 7: std::cout << getTimestamp() << "   Type 7 = QUIC_CONNECTION_EVENT_STREAMS_AVAILABLE\n"; break;
-    case 8: std::cout << getTimestamp() << "   Type 8 = QUIC_CONNECTION_EVENT_PEER_NEEDS_STREAMS\n"; break;
-    case 9: std::cout << getTimestamp() << "   Type 9 = QUIC_CONNECTION_EVENT_IDEAL_PROCESSOR_CHANGED\n"; break;
-    case 10: std::cout << getTimestamp() << "   Type 10 = QUIC_CONNECTION_EVENT_DATAGRAM_STATE_CHANGED\n"; break;
-    case 11: std::cout << getTimestamp() << "   Type 11 = QUIC_CONNECTION_EVENT_DATAGRAM_RECEIVED\n"; break;
-    case 12: std::cout << getTimestamp() << "   Type 12 = QUIC_CONNECTION_EVENT_DATAGRAM_SEND_STATE_CHANGED\n"; break;
-    case 13: std::cout << getTimestamp() << "   Type 13 = QUIC_CONNECTION_EVENT_RESUMED\n"; break;
-    case 14: std::cout << getTimestamp() << "   Type 14 = QUIC_CONNECTION_EVENT_RESUMPTION_TICKET_RECEIVED\n"; break;
-    case 15: std::cout << getTimestamp() << "   Type 15 = QUIC_CONNECTION_EVENT_PEER_CERTIFICATE_RECEIVED\n"; break;
-    default: std::cout << getTimestamp() << "   Type " << Event->Type << " = UNKNOWN EVENT\n"; break;
+    case 0: HTTP3_LOG_TRACE("  Type 0 = QUIC_CONNECTION_EVENT_CONNECTED"); break;
+    case 1: HTTP3_LOG_TRACE("  Type 1 = QUIC_CONNECTION_EVENT_SHUTDOWN_INITIATED_BY_TRANSPORT"); break;
+    case 2: HTTP3_LOG_TRACE("  Type 2 = QUIC_CONNECTION_EVENT_SHUTDOWN_INITIATED_BY_PEER"); break;
+    case 3: HTTP3_LOG_TRACE("  Type 3 = QUIC_CONNECTION_EVENT_SHUTDOWN_COMPLETE"); break;
+    case 4: HTTP3_LOG_TRACE("  Type 4 = QUIC_CONNECTION_EVENT_LOCAL_ADDRESS_CHANGED"); break;
+    case 5: HTTP3_LOG_TRACE("  Type 5 = QUIC_CONNECTION_EVENT_PEER_ADDRESS_CHANGED"); break;
+    case 6: HTTP3_LOG_TRACE("  Type 6 = QUIC_CONNECTION_EVENT_PEER_STREAM_STARTED *** THIS IS WHAT WE WANT ***"); break;
+    case 7: HTTP3_LOG_TRACE("  Type 7 = QUIC_CONNECTION_EVENT_STREAMS_AVAILABLE"); break;
+    case 8: HTTP3_LOG_TRACE("  Type 8 = QUIC_CONNECTION_EVENT_PEER_NEEDS_STREAMS"); break;
+    case 9: HTTP3_LOG_TRACE("  Type 9 = QUIC_CONNECTION_EVENT_IDEAL_PROCESSOR_CHANGED"); break;
+    case 10: HTTP3_LOG_TRACE("  Type 10 = QUIC_CONNECTION_EVENT_DATAGRAM_STATE_CHANGED"); break;
+    case 11: HTTP3_LOG_TRACE("  Type 11 = QUIC_CONNECTION_EVENT_DATAGRAM_RECEIVED"); break;
+    case 12: HTTP3_LOG_TRACE("  Type 12 = QUIC_CONNECTION_EVENT_DATAGRAM_SEND_STATE_CHANGED"); break;
+    case 13: HTTP3_LOG_TRACE("  Type 13 = QUIC_CONNECTION_EVENT_RESUMED"); break;
+    case 14: HTTP3_LOG_TRACE("  Type 14 = QUIC_CONNECTION_EVENT_RESUMPTION_TICKET_RECEIVED"); break;
+    case 15: HTTP3_LOG_TRACE("  Type 15 = QUIC_CONNECTION_EVENT_PEER_CERTIFICATE_RECEIVED"); break;
+    default: HTTP3_LOG_TRACE("  Type {} = UNKNOWN EVENT", Event->Type); break;
     }
 
     switch (Event->Type) {
     case QUIC_CONNECTION_EVENT_CONNECTED: {
-        std::cout << getTimestamp() << " QUIC_CONNECTION_EVENT_CONNECTED\n";
-        std::cout << getTimestamp() << " Client connected successfully!\n";
+        HTTP3_LOG_DEBUG("QUIC_CONNECTION_EVENT_CONNECTED");
+        HTTP3_LOG_INFO("Client connected successfully!");
 
         // Basic connection info - NO THREADING
         uint8_t alpnBuffer[16] = {};
         uint32_t alpnSize = sizeof(alpnBuffer);
         if (QUIC_SUCCEEDED(MsQuic->GetParam(Connection, QUIC_PARAM_TLS_NEGOTIATED_ALPN, &alpnSize, alpnBuffer))) {
-            std::cout << getTimestamp() << " Negotiated ALPN: ";
-            for (uint32_t i = 0; i < alpnSize; ++i) {
-                std::cout << (char)alpnBuffer[i];
-            }
-            std::cout << "\n";
+            HTTP3_LOG_DEBUG("Negotiated ALPN: {}", std::string_view(reinterpret_cast<const char*>(alpnBuffer), alpnSize));
         }
 
-        std::cout << getTimestamp() << " Connection is ready for streams\n";
-        std::cout << getTimestamp() << " === WAITING FOR CLIENT STREAMS (SAFE MODE) ===\n";
-        std::cout << getTimestamp() << " Will monitor for PEER_STREAM_STARTED events (type 6)...\n";
+        // Our SETTINGS advertise the QPACK dynamic table the client may use
+        sendServerSettings(*context);
+
+        HTTP3_LOG_DEBUG("Connection is ready for streams");
+        HTTP3_LOG_DEBUG("=== WAITING FOR CLIENT STREAMS (SAFE MODE) ===");
+        HTTP3_LOG_DEBUG("Will monitor for PEER_STREAM_STARTED events (type 6)...");
 
         // NO THREADING - NO ForceStreamAcceptance() call
         // Just wait for normal MsQuic events
@@ -1065,136 +998,144 @@ QUIC_STATUS QUIC_API ServerConnectionCallback(
     }
 
     case QUIC_CONNECTION_EVENT_SHUTDOWN_INITIATED_BY_TRANSPORT: {
-        std::cout << getTimestamp() << " QUIC_CONNECTION_EVENT_SHUTDOWN_INITIATED_BY_TRANSPORT\n";
-        std::cout << getTimestamp() << " Transport initiated shutdown!\n";
-        std::cout << getTimestamp() << " Status: 0x" << std::hex << Event->SHUTDOWN_INITIATED_BY_TRANSPORT.Status << std::dec << "\n";
-        std::cout << getTimestamp() << " Error code: " << Event->SHUTDOWN_INITIATED_BY_TRANSPORT.ErrorCode << "\n";
+        HTTP3_LOG_DEBUG("QUIC_CONNECTION_EVENT_SHUTDOWN_INITIATED_BY_TRANSPORT");
+        HTTP3_LOG_INFO("Transport initiated shutdown!");
+        HTTP3_LOG_INFO("Status: 0x{}", Http3LogHex{ Event->SHUTDOWN_INITIATED_BY_TRANSPORT.Status });
+        HTTP3_LOG_INFO("Error code: {}", Event->SHUTDOWN_INITIATED_BY_TRANSPORT.ErrorCode);
         break;
     }
 
     case QUIC_CONNECTION_EVENT_SHUTDOWN_INITIATED_BY_PEER: {
-        std::cout << getTimestamp() << " QUIC_CONNECTION_EVENT_SHUTDOWN_INITIATED_BY_PEER\n";
-        std::cout << getTimestamp() << " Peer initiated shutdown\n";
-        std::cout << getTimestamp() << " Error code: " << Event->SHUTDOWN_INITIATED_BY_PEER.ErrorCode << "\n";
+        HTTP3_LOG_DEBUG("QUIC_CONNECTION_EVENT_SHUTDOWN_INITIATED_BY_PEER");
+        HTTP3_LOG_INFO("Peer initiated shutdown");
+        HTTP3_LOG_INFO("Error code: {}", Event->SHUTDOWN_INITIATED_BY_PEER.ErrorCode);
         break;
     }
 
     case QUIC_CONNECTION_EVENT_PEER_STREAM_STARTED: {
-        std::cout << getTimestamp() << " *** CRITICAL: PEER_STREAM_STARTED EVENT DETECTED! ***\n";
-        std::cout << getTimestamp() << " === PEER_STREAM_STARTED EVENT ===\n";
-        std::cout << getTimestamp() << " Client started stream " << std::hex
-            << Event->PEER_STREAM_STARTED.Stream << std::dec << "\n";
+        HTTP3_LOG_DEBUG("*** CRITICAL: PEER_STREAM_STARTED EVENT DETECTED! ***");
+        HTTP3_LOG_DEBUG("=== PEER_STREAM_STARTED EVENT ===");
+        HTTP3_LOG_DEBUG("Client started stream {}", Event->PEER_STREAM_STARTED.Stream);
+
+        // Check stream flags. A unidirectional stream's role is only known once its type
+        // prefix arrives; a bidirectional one starts out as a request.
+        bool unidirectional = (Event->PEER_STREAM_STARTED.Flags & QUIC_STREAM_OPEN_FLAG_UNIDIRECTIONAL) != 0;
 
-        // Get the QUIC stream ID immediately
-        QUIC_UINT62 streamId = 0;
+        // Get the QUIC stream ID once; the stream's context caches it for every later event
+        QUIC_UINT62 streamId = StreamContext::UNKNOWN_ID;
         uint32_t bufferLength = sizeof(streamId);
         QUIC_STATUS idStatus = MsQuic->GetParam(Event->PEER_STREAM_STARTED.Stream, QUIC_PARAM_STREAM_ID, &bufferLength, &streamId);
+        if (QUIC_FAILED(idStatus)) {
+            // Sessions, blocked sections and acknowledgements are all keyed by the ID, so a
+            // stream without one is refused. The context only lives to close the stream at
+            // SHUTDOWN_COMPLETE.
+            HTTP3_LOG_ERROR("Failed to get stream ID: 0x{}, aborting the stream", Http3LogHex{ idStatus });
+            auto* streamContext = new StreamContext(*context, StreamContext::UNKNOWN_ID, unidirectional, StreamRole::Ignored);
+            streamContext->decoder.enterRawMode();
+            MsQuic->SetCallbackHandler(Event->PEER_STREAM_STARTED.Stream, ServerStreamCallback, streamContext);
+            MsQuic->StreamShutdown(Event->PEER_STREAM_STARTED.Stream, QUIC_STREAM_SHUTDOWN_FLAG_ABORT, Http3ErrorCode::H3_INTERNAL_ERROR);
+            break;
+        }
+        HTTP3_LOG_DEBUG("Stream ID: {}", streamId);
 
-        if (QUIC_SUCCEEDED(idStatus)) {
-            std::cout << getTimestamp() << " Stream ID: " << streamId << "\n";
-
-            // Analyze stream type
-            if (streamId % 4 == 2) {
-                std::cout << getTimestamp() << " -> UNIDIRECTIONAL stream (client-initiated)\n";
-                std::cout << getTimestamp() << " -> This should be the control stream with SETTINGS\n";
-            }
-            else if (streamId % 4 == 0) {
-                std::cout << getTimestamp() << " -> BIDIRECTIONAL stream (client-initiated)\n";
-                std::cout << getTimestamp() << " -> This should be the WebTransport CONNECT stream\n";
-            }
+        // Analyze stream type
+        if (streamId % 4 == 2) {
+            HTTP3_LOG_DEBUG("-> UNIDIRECTIONAL stream (client-initiated)");
+            HTTP3_LOG_DEBUG("-> This should be the control stream with SETTINGS");
         }
-        else {
-            std::cout << getTimestamp() << " Failed to get stream ID\n";
+        else if (streamId % 4 == 0) {
+            HTTP3_LOG_DEBUG("-> BIDIRECTIONAL stream (client-initiated)");
+            HTTP3_LOG_DEBUG("-> This should be the WebTransport CONNECT stream");
         }
 
-        // Check stream flags
-        if (Event->PEER_STREAM_STARTED.Flags & QUIC_STREAM_OPEN_FLAG_UNIDIRECTIONAL) {
-            std::cout << getTimestamp() << " UNIDIRECTIONAL stream detected\n";
-            std::cout << getTimestamp() << " Setting callback handler for unidirectional stream\n";
-            MsQuic->SetCallbackHandler(Event->PEER_STREAM_STARTED.Stream, ServerStreamCallback, Connection);
-            std::cout << getTimestamp() << " Unidirectional stream ready for receive events\n";
+        auto* streamContext = new StreamContext(*context, streamId, unidirectional,
+            unidirectional ? StreamRole::Unknown : StreamRole::Request);
+
+        if (unidirectional) {
+            HTTP3_LOG_DEBUG("UNIDIRECTIONAL stream detected");
+            HTTP3_LOG_DEBUG("Setting callback handler for unidirectional stream");
+            MsQuic->SetCallbackHandler(Event->PEER_STREAM_STARTED.Stream, ServerStreamCallback, streamContext);
+            HTTP3_LOG_DEBUG("Unidirectional stream ready for receive events");
         }
         else {
-            std::cout << getTimestamp() << " BIDIRECTIONAL stream detected\n";
+            HTTP3_LOG_DEBUG("BIDIRECTIONAL stream detected");
 
             // Enable receive for bidirectional streams
             QUIC_STATUS enableStatus = MsQuic->StreamReceiveSetEnabled(Event->PEER_STREAM_STARTED.Stream, TRUE);
             if (QUIC_FAILED(enableStatus)) {
-                std::cout << getTimestamp() << " Failed to enable receive on bidirectional stream\n";
+                HTTP3_LOG_ERROR("Failed to enable receive on bidirectional stream");
             }
             else {
-                std::cout << getTimestamp() << " Successfully enabled receive on bidirectional stream\n";
+                HTTP3_LOG_DEBUG("Successfully enabled receive on bidirectional stream");
             }
 
             // Set callback handler
-            MsQuic->SetCallbackHandler(Event->PEER_STREAM_STARTED.Stream, ServerStreamCallback, Connection);
+            MsQuic->SetCallbackHandler(Event->PEER_STREAM_STARTED.Stream, ServerStreamCallback, streamContext);
         }
 
-        std::cout << getTimestamp() << " Stream callback handler set successfully\n";
-        std::cout << getTimestamp() << " === PEER_STREAM_STARTED COMPLETE ===\n";
+        HTTP3_LOG_DEBUG("Stream callback handler set successfully");
+        HTTP3_LOG_DEBUG("=== PEER_STREAM_STARTED COMPLETE ===");
         break;
     }
 
     case QUIC_CONNECTION_EVENT_SHUTDOWN_COMPLETE: {
-        std::cout << getTimestamp() << " QUIC_CONNECTION_EVENT_SHUTDOWN_COMPLETE\n";
-        std::cout << getTimestamp() << " Handshake completed: " << (Event->SHUTDOWN_COMPLETE.HandshakeCompleted ? "YES" : "NO") << "\n";
-        std::cout << getTimestamp() << " Peer acknowledged: " << (Event->SHUTDOWN_COMPLETE.PeerAcknowledgedShutdown ? "YES" : "NO") << "\n";
-        std::cout << getTimestamp() << " App close in progress: " << (Event->SHUTDOWN_COMPLETE.AppCloseInProgress ? "YES" : "NO") << "\n";
-
-        auto it = activeSessions.find(Connection);
-        if (it != activeSessions.end()) {
-            std::cout << getTimestamp() << " Cleaning up WebTransport session\n";
-            activeSessions.erase(it);
-        }
+        HTTP3_LOG_DEBUG("QUIC_CONNECTION_EVENT_SHUTDOWN_COMPLETE");
+        HTTP3_LOG_DEBUG("Handshake completed: {}", Event->SHUTDOWN_COMPLETE.HandshakeCompleted ? "YES" : "NO");
+        HTTP3_LOG_DEBUG("Peer acknowledged: {}", Event->SHUTDOWN_COMPLETE.PeerAcknowledgedShutdown ? "YES" : "NO");
+        HTTP3_LOG_DEBUG("App close in progress: {}", Event->SHUTDOWN_COMPLETE.AppCloseInProgress ? "YES" : "NO");
 
-        std::cout << getTimestamp() << " Closing connection handle\n";
+        // Every stream has shut down by now, so nothing refers to the context any more
+        HTTP3_LOG_DEBUG("Closing connection handle");
         MsQuic->ConnectionClose(Connection);
+        delete context;
         break;
     }
 
     case QUIC_CONNECTION_EVENT_STREAMS_AVAILABLE: {
-        std::cout << getTimestamp() << " QUIC_CONNECTION_EVENT_STREAMS_AVAILABLE\n";
-        std::cout << getTimestamp() << " Bidirectional streams available: " << Event->STREAMS_AVAILABLE.BidirectionalCount << "\n";
-        std::cout << getTimestamp() << " Unidirectional streams available: " << Event->STREAMS_AVAILABLE.UnidirectionalCount << "\n";
+        HTTP3_LOG_DEBUG("QUIC_CONNECTION_EVENT_STREAMS_AVAILABLE");
+        HTTP3_LOG_DEBUG("Bidirectional streams available: {}", Event->STREAMS_AVAILABLE.BidirectionalCount);
+        HTTP3_LOG_DEBUG("Unidirectional streams available: {}", Event->STREAMS_AVAILABLE.UnidirectionalCount);
         break;
     }
 
     case QUIC_CONNECTION_EVENT_PEER_NEEDS_STREAMS: {
-        std::cout << getTimestamp() << " QUIC_CONNECTION_EVENT_PEER_NEEDS_STREAMS\n";
-        std::cout << getTimestamp() << " Peer needs bidirectional streams: " << (Event->PEER_NEEDS_STREAMS.Bidirectional ? "YES" : "NO") << "\n";
+        HTTP3_LOG_DEBUG("QUIC_CONNECTION_EVENT_PEER_NEEDS_STREAMS");
+        HTTP3_LOG_DEBUG("Peer needs bidirectional streams: {}", Event->PEER_NEEDS_STREAMS.Bidirectional ? "YES" : "NO");
         break;
     }
 
     case QUIC_CONNECTION_EVENT_DATAGRAM_RECEIVED: {
-        std::cout << getTimestamp() << " QUIC_CONNECTION_EVENT_DATAGRAM_RECEIVED\n";
-        std::cout << getTimestamp() << " Received datagram (" << Event->DATAGRAM_RECEIVED.Buffer->Length << " bytes)\n";
+        HTTP3_LOG_DEBUG("QUIC_CONNECTION_EVENT_DATAGRAM_RECEIVED");
+        HTTP3_LOG_DEBUG("Received datagram ({} bytes)", Event->DATAGRAM_RECEIVED.Buffer->Length);
         break;
     }
 
     case QUIC_CONNECTION_EVENT_IDEAL_PROCESSOR_CHANGED: {
-        std::cout << getTimestamp() << " QUIC_CONNECTION_EVENT_IDEAL_PROCESSOR_CHANGED\n";
+        HTTP3_LOG_DEBUG("QUIC_CONNECTION_EVENT_IDEAL_PROCESSOR_CHANGED");
+        HTTP3_LOG_DEBUG("Ideal processor {}, partition {}", Event->IDEAL_PROCESSOR_CHANGED.IdealProcessor,
+            Event->IDEAL_PROCESSOR_CHANGED.PartitionIndex);
         break;
     }
 
     case QUIC_CONNECTION_EVENT_LOCAL_ADDRESS_CHANGED: {
-        std::cout << getTimestamp() << " QUIC_CONNECTION_EVENT_LOCAL_ADDRESS_CHANGED\n";
+        HTTP3_LOG_DEBUG("QUIC_CONNECTION_EVENT_LOCAL_ADDRESS_CHANGED");
         break;
     }
 
     case QUIC_CONNECTION_EVENT_PEER_ADDRESS_CHANGED: {
-        std::cout << getTimestamp() << " QUIC_CONNECTION_EVENT_PEER_ADDRESS_CHANGED\n";
+        HTTP3_LOG_DEBUG("QUIC_CONNECTION_EVENT_PEER_ADDRESS_CHANGED");
         break;
     }
 
     default: {
-        std::cout << getTimestamp() << " *** UNKNOWN/UNHANDLED CONNECTION EVENT: " << Event->Type << " ***\n";
-        std::cout << getTimestamp() << " This event is not being processed!\n";
-        std::cout << getTimestamp() << " Check if this should be PEER_STREAM_STARTED (type 6)\n";
+        HTTP3_LOG_DEBUG("*** UNKNOWN/UNHANDLED CONNECTION EVENT: {} ***", Event->Type);
+        HTTP3_LOG_DEBUG("This event is not being processed!");
+        HTTP3_LOG_DEBUG("Check if this should be PEER_STREAM_STARTED (type 6)");
         break;
     }
     }
 
-    std::cout << getTimestamp() << " === SERVER CONNECTION CALLBACK END ===\n";
+    HTTP3_LOG_DEBUG("=== SERVER CONNECTION CALLBACK END ===");
     return QUIC_STATUS_SUCCESS;
 }
 
@@ -1209,24 +1150,26 @@ QUIC_STATUS QUIC_API ServerListenerCallback(
     UNREFERENCED_PARAMETER(Context);
     UNREFERENCED_PARAMETER(Listener);
 
-    std::cout << getTimestamp() << " === SERVER LISTENER CALLBACK ===\n";
-    std::cout << getTimestamp() << " Event type: " << Event->Type << "\n";
+    HTTP3_LOG_DEBUG("=== SERVER LISTENER CALLBACK ===");
+    HTTP3_LOG_DEBUG("Event type: {}", Event->Type);
 
     if (Event->Type == QUIC_LISTENER_EVENT_NEW_CONNECTION) {
-        std::cout << getTimestamp() << " QUIC_LISTENER_EVENT_NEW_CONNECTION\n";
-        std::cout << getTimestamp() << " New connection: " << std::hex << Event->NEW_CONNECTION.Connection << std::dec << "\n";
+        HTTP3_LOG_DEBUG("QUIC_LISTENER_EVENT_NEW_CONNECTION");
+        HTTP3_LOG_DEBUG("New connection: {}", Event->NEW_CONNECTION.Connection);
 
-        // SAFE: Just set callbacks, NO THREADING
-        std::cout << getTimestamp() << " Setting ServerConnectionCallback...\n";
-        MsQuic->SetCallbackHandler(Event->NEW_CONNECTION.Connection, ServerConnectionCallback, nullptr);
+        // SAFE: Just set callbacks, NO THREADING. The context lives until SHUTDOWN_COMPLETE.
+        HTTP3_LOG_DEBUG("Setting ServerConnectionCallback...");
+        auto* context = new ConnectionContext(Event->NEW_CONNECTION.Connection);
+        Count(LocalWorkerStats().connections);
+        MsQuic->SetCallbackHandler(Event->NEW_CONNECTION.Connection, ServerConnectionCallback, context);
 
-        std::cout << getTimestamp() << " Setting connection configuration...\n";
+        HTTP3_LOG_DEBUG("Setting connection configuration...");
         MsQuic->ConnectionSetConfiguration(Event->NEW_CONNECTION.Connection, Configuration);
 
-        std::cout << getTimestamp() << " Connection configured safely\n";
+        HTTP3_LOG_DEBUG("Connection configured safely");
     }
 
-    std::cout << getTimestamp() << " === SERVER LISTENER CALLBACK END ===\n";
+    HTTP3_LOG_DEBUG("=== SERVER LISTENER CALLBACK END ===");
     return QUIC_STATUS_SUCCESS;
 }
 
@@ -1234,6 +1177,7 @@ QUIC_STATUS QUIC_API ServerListenerCallback(
 int main(int argc, char** argv) {
     std::string_view certHashArg;
     uint16_t port = 4443;
+    const ExecutionProfileName* profile = &EXECUTION_PROFILES[0];
 
     for (int i = 1; i < argc; ++i) {
         std::string_view arg = argv[i];
@@ -1243,17 +1187,29 @@ int main(int argc, char** argv) {
         else if (arg.starts_with("-port:")) {
             port = static_cast<uint16_t>(std::stoul(std::string(arg.substr(6))));
         }
+        else if (arg == "-defer_receive") {
+            DeferReceiveCompletion = true;
+        }
+        else if (arg.starts_with("-profile:")) {
+            profile = FindExecutionProfile(arg.substr(9));
+            if (profile == nullptr) {
+                std::cerr << "Unknown execution profile: " << arg.substr(9) << "\n";
+                return 1;
+            }
+        }
     }
 
     std::cout << "=== MsQuic WebTransport Server ===\n";
     std::cout << "Port: " << port << "\n";
+    std::cout << "Receive completion: " << (DeferReceiveCompletion ? "deferred" : "inline") << "\n";
+    std::cout << "Execution profile: " << profile->name << "\n";
 
     if (QUIC_FAILED(MsQuicOpen2(&MsQuic))) {
         std::cerr << "MsQuicOpen2 failed\n";
         return 1;
     }
 
-    QUIC_REGISTRATION_CONFIG regConfig = { "QuicWebTransportServer", QUIC_EXECUTION_PROFILE_LOW_LATENCY };
+    QUIC_REGISTRATION_CONFIG regConfig = { "QuicWebTransportServer", profile->profile };
     if (QUIC_FAILED(MsQuic->RegistrationOpen(&regConfig, &Registration))) {
         std::cerr << "RegistrationOpen failed\n";
         return 1;
@@ -1338,7 +1294,7 @@ int main(int argc, char** argv) {
     // Certificate configuration (existing code)
     std::array<uint8_t, 20> shaHash = {};
     if (certHashArg.empty() || !ParseHexHash(certHashArg, shaHash)) {
-        std::cerr << "Usage: server -cert_hash:<40-char SHA1> [-port:<port>]\n";
+        std::cerr << "Usage: server -cert_hash:<40-char SHA1> [-port:<port>] [-defer_receive] [-profile:low_latency|max_throughput|scavenger|real_time]\n";
         return 1;
     }
 
@@ -1360,8 +1316,12 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    // From here on MsQuic's workers log too, so everything goes through the logger's drain
+    // thread rather than straight to the console
+    Http3Log::start();
+
     // CRITICAL: Enhanced listener creation with explicit callback verification
-    std::cout << "Creating listener with ServerListenerCallback...\n";
+    HTTP3_LOG_DEBUG("Creating listener with ServerListenerCallback...");
     if (QUIC_FAILED(MsQuic->ListenerOpen(Registration, ServerListenerCallback, nullptr, &Listener))) {
         std::cerr << "ListenerOpen failed\n";
         return 1;
@@ -1377,21 +1337,38 @@ int main(int argc, char** argv) {
         return 1;
     }
 
-    std::cout << "\nENHANCED Server listening on port " << port << "\n";
-    std::cout << "Ready for WebTransport connections with PEER_STREAM_STARTED monitoring\n";
-    std::cout << "Press Enter to exit...\n";
+    HTTP3_LOG_INFO("ENHANCED Server listening on port {}", port);
+    HTTP3_LOG_INFO("Ready for WebTransport connections with PEER_STREAM_STARTED monitoring");
+    HTTP3_LOG_INFO("Press Enter to exit...");
 
     std::cin.get();
 
-    std::cout << "\nShutting down...\n";
-
-    activeSessions.clear();
+    HTTP3_LOG_INFO("Shutting down...");
 
     MsQuic->ListenerClose(Listener);
     MsQuic->ConfigurationClose(Configuration);
     MsQuic->RegistrationClose(Registration);
     MsQuicClose(MsQuic);
 
+    // MsQuic's workers have stopped, so their counters are final
+    uint64_t connections = 0;
+    uint64_t requests = 0;
+    uint64_t sessions = 0;
+    for (size_t i = 0; i < AllWorkerStats.size(); ++i) {
+        const WorkerStats& stats = *AllWorkerStats[i];
+        HTTP3_LOG_INFO("Worker {}: {} connections, {} requests, {} sessions ({} closed), {} bytes received", i,
+            stats.connections.load(), stats.requests.load(), stats.sessionsEstablished.load(),
+            stats.sessionsClosed.load(), stats.receivedBytes.load());
+        connections += stats.connections.load();
+        requests += stats.requests.load();
+        sessions += stats.sessionsEstablished.load();
+    }
+    HTTP3_LOG_INFO("{} workers served {} connections, {} requests and {} sessions", AllWorkerStats.size(),
+        connections, requests, sessions);
+
+    // No worker is left to log, so the last records can be written out
+    Http3Log::stop();
+
     std::cout << "Shutdown complete\n";
     return 0;
 }
\ No newline at end of file